@@ -0,0 +1,306 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+   Microbenchmark for the endian accessors.  Decodes and encodes a buffer
+   of packed D304 track points (the bulk of most .gmn files) three ways:
+
+     loop      the old byte-by-byte copy, called out of line
+     exported  the exported get_* / put_* functions, called out of line
+     inline    the inline versions from byte_util.h, as the library uses
+
+   and prints the time per record for each.  Not installed; build it with
+   'make byte_bench'.
+
+   usage: byte_bench [records] [rounds]
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "garmin.h"
+
+#define GARMIN_BYTE_UTIL_EXPORTS
+#include "byte_util.h"
+
+
+#define D304_SIZE  23
+
+
+/* The accessors as byte_util.c used to define them. */
+
+#ifdef WORDS_BIGENDIAN
+#define ENDIAN_FOR(i,x)     for ( i = sizeof(x)-1; i >= 0; i-- )
+#else
+#define ENDIAN_FOR(i,x)     for ( i = 0; i < (int)sizeof(x); i++ )
+#endif
+
+#define DEF_LOOP_GET(x)                                                \
+  static x                                                             \
+  loop_get_##x ( const uint8 * d )                                     \
+  {                                                                    \
+    x       v;                                                         \
+    uint8 * b = (uint8 *)&v;                                           \
+    int     i;                                                         \
+                                                                       \
+    ENDIAN_FOR(i,x) *b++ = d[i];                                       \
+    return v;                                                          \
+  }
+
+#define DEF_LOOP_PUT(x)                                                \
+  static void                                                          \
+  loop_put_##x ( uint8 * d, const x v )                                \
+  {                                                                    \
+    const uint8 * b = (const uint8 *)&v;                               \
+    int           i;                                                   \
+                                                                       \
+    ENDIAN_FOR(i,x) d[i] = *b++;                                       \
+  }
+
+DEF_LOOP_GET(sint32)
+DEF_LOOP_GET(uint32)
+DEF_LOOP_GET(float32)
+DEF_LOOP_PUT(sint32)
+DEF_LOOP_PUT(uint32)
+DEF_LOOP_PUT(float32)
+
+
+/*
+   A set of accessors.  The out-of-line variants are called through
+   volatile pointers so that the compiler cannot inline them here, which
+   is how the library called them before.
+*/
+
+typedef struct accessors {
+  sint32  (* volatile get_s32) ( const uint8 * d );
+  uint32  (* volatile get_u32) ( const uint8 * d );
+  float32 (* volatile get_f32) ( const uint8 * d );
+  void    (* volatile put_s32) ( uint8 * d, const sint32 v );
+  void    (* volatile put_u32) ( uint8 * d, const uint32 v );
+  void    (* volatile put_f32) ( uint8 * d, const float32 v );
+} accessors;
+
+
+static accessors loop_accessors = {
+  loop_get_sint32, loop_get_uint32, loop_get_float32,
+  loop_put_sint32, loop_put_uint32, loop_put_float32
+};
+
+static accessors exported_accessors = {
+  get_sint32, get_uint32, get_float32,
+  put_sint32, put_uint32, put_float32
+};
+
+
+static double
+now ( void )
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+
+static void
+decode_calls ( accessors * a, const uint8 * buf, D304 * pts, int records )
+{
+  const uint8 * p;
+  int           i;
+
+  for ( i = 0, p = buf; i < records; i++, p += D304_SIZE ) {
+    pts[i].posn.lat   = a->get_s32(p);
+    pts[i].posn.lon   = a->get_s32(p+4);
+    pts[i].time       = a->get_u32(p+8);
+    pts[i].alt        = a->get_f32(p+12);
+    pts[i].distance   = a->get_f32(p+16);
+    pts[i].heart_rate = p[20];
+    pts[i].cadence    = p[21];
+    pts[i].sensor     = p[22];
+  }
+}
+
+
+static void
+decode_inline ( const uint8 * buf, D304 * pts, int records )
+{
+  const uint8 * p;
+  int           i;
+
+  for ( i = 0, p = buf; i < records; i++, p += D304_SIZE ) {
+    pts[i].posn.lat   = garmin_le_get_sint32(p);
+    pts[i].posn.lon   = garmin_le_get_sint32(p+4);
+    pts[i].time       = garmin_le_get_uint32(p+8);
+    pts[i].alt        = garmin_le_get_float32(p+12);
+    pts[i].distance   = garmin_le_get_float32(p+16);
+    pts[i].heart_rate = p[20];
+    pts[i].cadence    = p[21];
+    pts[i].sensor     = p[22];
+  }
+}
+
+
+static void
+encode_calls ( accessors * a, uint8 * buf, const D304 * pts, int records )
+{
+  uint8 * p;
+  int     i;
+
+  for ( i = 0, p = buf; i < records; i++, p += D304_SIZE ) {
+    a->put_s32(p,pts[i].posn.lat);
+    a->put_s32(p+4,pts[i].posn.lon);
+    a->put_u32(p+8,pts[i].time);
+    a->put_f32(p+12,pts[i].alt);
+    a->put_f32(p+16,pts[i].distance);
+    p[20] = pts[i].heart_rate;
+    p[21] = pts[i].cadence;
+    p[22] = pts[i].sensor;
+  }
+}
+
+
+static void
+encode_inline ( uint8 * buf, const D304 * pts, int records )
+{
+  uint8 * p;
+  int     i;
+
+  for ( i = 0, p = buf; i < records; i++, p += D304_SIZE ) {
+    garmin_le_put_sint32(p,pts[i].posn.lat);
+    garmin_le_put_sint32(p+4,pts[i].posn.lon);
+    garmin_le_put_uint32(p+8,pts[i].time);
+    garmin_le_put_float32(p+12,pts[i].alt);
+    garmin_le_put_float32(p+16,pts[i].distance);
+    p[20] = pts[i].heart_rate;
+    p[21] = pts[i].cadence;
+    p[22] = pts[i].sensor;
+  }
+}
+
+
+/* Run one variant (0 = loop, 1 = exported, 2 = inline) and time it. */
+
+static double
+run ( int variant, int encode, uint8 * buf, D304 * pts, int records,
+      int rounds )
+{
+  double start = now();
+  int    r;
+
+  for ( r = 0; r < rounds; r++ ) {
+    switch ( variant ) {
+    case 0:
+      if ( encode ) encode_calls(&loop_accessors,buf,pts,records);
+      else          decode_calls(&loop_accessors,buf,pts,records);
+      break;
+    case 1:
+      if ( encode ) encode_calls(&exported_accessors,buf,pts,records);
+      else          decode_calls(&exported_accessors,buf,pts,records);
+      break;
+    default:
+      if ( encode ) encode_inline(buf,pts,records);
+      else          decode_inline(buf,pts,records);
+      break;
+    }
+  }
+
+  return (now() - start) * 1.0e9 / ((double)records * rounds);
+}
+
+
+int
+main ( int argc, char ** argv )
+{
+  static const char * names[] = { "loop", "exported", "inline" };
+
+  int      records = (argc > 1) ? atoi(argv[1]) : 100000;
+  int      rounds  = (argc > 2) ? atoi(argv[2]) : 50;
+  uint8 *  buf;
+  uint8 *  check;
+  D304 *   pts;
+  double   get[3];
+  double   put[3];
+  int      i;
+  int      v;
+
+  if ( records <= 0 || rounds <= 0 ) {
+    printf("usage: %s [records] [rounds]\n",argv[0]);
+    return 1;
+  }
+
+  buf   = malloc(records * D304_SIZE);
+  check = malloc(records * D304_SIZE);
+  pts   = calloc(records,sizeof(D304));
+
+  if ( buf == NULL || check == NULL || pts == NULL ) {
+    printf("%s: out of memory\n",argv[0]);
+    return 1;
+  }
+
+  /* A plausible run: a point every second, moving north-east. */
+
+  for ( i = 0; i < records; i++ ) {
+    pts[i].posn.lat   = 470000000 + 1000 * i;
+    pts[i].posn.lon   = -1450000000 + 700 * i;
+    pts[i].time       = 600000000 + i;
+    pts[i].alt        = 100.0 + (i % 500) * 0.25;
+    pts[i].distance   = 3.2 * i;
+    pts[i].heart_rate = 120 + i % 60;
+    pts[i].cadence    = 80 + i % 20;
+    pts[i].sensor     = 1;
+  }
+
+  /* Every variant must produce the same bytes and the same records. */
+
+  encode_calls(&loop_accessors,check,pts,records);
+  for ( v = 0; v < 3; v++ ) {
+    memset(buf,0,records * D304_SIZE);
+    run(v,1,buf,pts,records,1);
+    if ( memcmp(buf,check,records * D304_SIZE) != 0 ) {
+      printf("%s: %s encoding differs\n",argv[0],names[v]);
+      return 1;
+    }
+  }
+
+  for ( v = 0; v < 3; v++ ) {
+    put[v] = run(v,1,buf,pts,records,rounds);
+    get[v] = run(v,0,buf,pts,records,rounds);
+  }
+
+  if ( memcmp(buf,check,records * D304_SIZE) != 0 ||
+       pts[records-1].time != (uint32)(600000000 + records - 1) ) {
+    printf("%s: decoding differs\n",argv[0]);
+    return 1;
+  }
+
+  printf("%d D304 records x %d rounds, ns per record\n",records,rounds);
+  printf("%-10s %10s %10s\n","","decode","encode");
+  for ( v = 0; v < 3; v++ ) {
+    printf("%-10s %10.2f %10.2f\n",names[v],get[v],put[v]);
+  }
+
+  free(pts);
+  free(check);
+  free(buf);
+
+  return 0;
+}
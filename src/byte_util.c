@@ -22,29 +22,20 @@
 #include <string.h>
 #include "garmin.h"
 
+#define GARMIN_BYTE_UTIL_EXPORTS
+#include "byte_util.h"
 
-#ifdef WORDS_BIGENDIAN
-#define ENDIAN_FOR(i,x)     for ( i = sizeof(x)-1; i >= 0; i-- )
-#define ENDIAN_GET(i,x,y,z) ENDIAN_FOR(i,x) *z++ = y[i]
-#define ENDIAN_PUT(i,x,y,z) ENDIAN_FOR(i,x) z[i] = *y++
-#else /* WORDS_BIGENDIAN */
-#define ENDIAN_FOR(i,x)     for ( i = 0; i < (int)sizeof(x); i++ )
-#define ENDIAN_GET(i,x,y,z) ENDIAN_FOR(i,x) *z++ = y[i]
-#define ENDIAN_PUT(i,x,y,z) ENDIAN_FOR(i,x) z[i] = *y++
-#endif /* WORDS_BIGENDIAN */
+
+/* 
+   The exported get/put functions.  The library itself uses the inline
+   versions in byte_util.h; these are kept for applications.
+*/
 
 #define DEF_ENDIAN_GET(x)          \
   x                                \
   get_##x ( const uint8 * d )      \
   {                                \
-    x       v;                     \
-    uint8 * b;                     \
-    int     i;                     \
-                                   \
-    b = (uint8 *)&v;               \
-    ENDIAN_GET(i,x,d,b);           \
-                                   \
-    return v;                      \
+    return garmin_le_get_##x(d);   \
   }
 
 
@@ -52,11 +43,7 @@
   void                             \
   put_##x ( uint8 * d, const x v ) \
   {                                \
-    uint8 * b;                     \
-    int     i;                     \
-                                   \
-    b = (uint8 *)&v;               \
-    ENDIAN_PUT(i,x,b,d);           \
+    garmin_le_put_##x(d,v);        \
   }
 
 
@@ -100,7 +87,7 @@ get_string ( garmin_packet * p, int * offset )
   do { bytes++; } while ( --allow && *cursor++ );
   
   ret = malloc(bytes);
-  strncpy(ret,start,bytes-1);
+  memcpy(ret,start,bytes);
   
   *offset += bytes;
 
@@ -124,7 +111,7 @@ get_vstring ( uint8 ** buf )
   do { bytes++; } while ( *cursor++ );
 
   ret = malloc(bytes);
-  strncpy(ret,start,bytes-1);
+  memcpy(ret,start,bytes);
 
   *buf += bytes;
 
@@ -0,0 +1,198 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __GARMIN_BYTE_UTIL_H__
+#define __GARMIN_BYTE_UTIL_H__
+
+/*
+   Inline versions of the get_* and put_* functions in byte_util.c, for
+   use inside the library.  Garmin data is little-endian, so on a
+   little-endian host each one is a single (possibly unaligned) load or
+   store, and on a big-endian host a load or store and a byte swap.
+
+   Include this after config.h and garmin.h.  The get_* and put_* names
+   are redefined as macros so that existing callers use the inline
+   versions.  byte_util.c defines GARMIN_BYTE_UTIL_EXPORTS to keep the
+   names for the exported functions, which remain for applications.
+*/
+
+#include <string.h>
+
+
+#ifdef WORDS_BIGENDIAN
+
+#define GARMIN_SWAP16(v) ((uint16)(((v) >> 8) | ((v) << 8)))
+#define GARMIN_SWAP32(v)                                               \
+  (((v) >> 24) | (((v) >> 8) & 0xff00) |                               \
+   (((v) << 8) & 0xff0000) | ((v) << 24))
+
+static inline void
+garmin_swap_bytes ( uint8 * b, int n )
+{
+  uint8 t;
+  int   i;
+
+  for ( i = 0; i < n / 2; i++ ) {
+    t          = b[i];
+    b[i]       = b[n-1-i];
+    b[n-1-i]   = t;
+  }
+}
+
+#else /* WORDS_BIGENDIAN */
+
+#define GARMIN_SWAP16(v) (v)
+#define GARMIN_SWAP32(v) (v)
+
+#endif /* WORDS_BIGENDIAN */
+
+
+static inline uint16
+garmin_le_get_uint16 ( const uint8 * d )
+{
+  uint16 v;
+
+  memcpy(&v,d,sizeof(v));
+
+  return GARMIN_SWAP16(v);
+}
+
+
+static inline sint16
+garmin_le_get_sint16 ( const uint8 * d )
+{
+  return (sint16)garmin_le_get_uint16(d);
+}
+
+
+static inline uint32
+garmin_le_get_uint32 ( const uint8 * d )
+{
+  uint32 v;
+
+  memcpy(&v,d,sizeof(v));
+
+  return GARMIN_SWAP32(v);
+}
+
+
+static inline sint32
+garmin_le_get_sint32 ( const uint8 * d )
+{
+  return (sint32)garmin_le_get_uint32(d);
+}
+
+
+static inline float32
+garmin_le_get_float32 ( const uint8 * d )
+{
+  uint32  u = garmin_le_get_uint32(d);
+  float32 v;
+
+  memcpy(&v,&u,sizeof(v));
+
+  return v;
+}
+
+
+static inline float64
+garmin_le_get_float64 ( const uint8 * d )
+{
+  float64 v;
+
+  memcpy(&v,d,sizeof(v));
+#ifdef WORDS_BIGENDIAN
+  garmin_swap_bytes((uint8 *)&v,sizeof(v));
+#endif
+
+  return v;
+}
+
+
+static inline void
+garmin_le_put_uint16 ( uint8 * d, const uint16 v )
+{
+  uint16 u = GARMIN_SWAP16(v);
+
+  memcpy(d,&u,sizeof(u));
+}
+
+
+static inline void
+garmin_le_put_sint16 ( uint8 * d, const sint16 v )
+{
+  garmin_le_put_uint16(d,(uint16)v);
+}
+
+
+static inline void
+garmin_le_put_uint32 ( uint8 * d, const uint32 v )
+{
+  uint32 u = GARMIN_SWAP32(v);
+
+  memcpy(d,&u,sizeof(u));
+}
+
+
+static inline void
+garmin_le_put_sint32 ( uint8 * d, const sint32 v )
+{
+  garmin_le_put_uint32(d,(uint32)v);
+}
+
+
+static inline void
+garmin_le_put_float32 ( uint8 * d, const float32 v )
+{
+  uint32 u;
+
+  memcpy(&u,&v,sizeof(u));
+  garmin_le_put_uint32(d,u);
+}
+
+
+static inline void
+garmin_le_put_float64 ( uint8 * d, const float64 v )
+{
+  memcpy(d,&v,sizeof(v));
+#ifdef WORDS_BIGENDIAN
+  garmin_swap_bytes(d,sizeof(v));
+#endif
+}
+
+
+#ifndef GARMIN_BYTE_UTIL_EXPORTS
+
+#define get_uint16(d)    garmin_le_get_uint16(d)
+#define get_sint16(d)    garmin_le_get_sint16(d)
+#define get_uint32(d)    garmin_le_get_uint32(d)
+#define get_sint32(d)    garmin_le_get_sint32(d)
+#define get_float32(d)   garmin_le_get_float32(d)
+#define get_float64(d)   garmin_le_get_float64(d)
+
+#define put_uint16(d,v)  garmin_le_put_uint16(d,v)
+#define put_sint16(d,v)  garmin_le_put_sint16(d,v)
+#define put_uint32(d,v)  garmin_le_put_uint32(d,v)
+#define put_sint32(d,v)  garmin_le_put_sint32(d,v)
+#define put_float32(d,v) garmin_le_put_float32(d,v)
+#define put_float64(d,v) garmin_le_put_float64(d,v)
+
+#endif /* GARMIN_BYTE_UTIL_EXPORTS */
+
+#endif /* __GARMIN_BYTE_UTIL_H__ */
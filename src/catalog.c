@@ -0,0 +1,624 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "garmin.h"
+#include "byte_util.h"
+
+
+/*
+   A catalog of the run files saved under a directory, so that runs can be
+   found by time and place without opening the files themselves.  The
+   catalog is a single file:
+
+     GARMIN_C_MAGIC (12 bytes), GARMIN_VERSION, number of entries
+     the entries, CATALOG_RECORD bytes each, sorted by start time
+     the paths of the files, each one NUL-terminated
+
+   Each entry is packed, little-endian, as:
+
+     start_time, duration, distance, sw.lat, sw.lon, ne.lat, ne.lon,
+     mtime, size, offset of the path   (4 bytes each)
+     laps (2 bytes), sport_type (1 byte), 1 unused byte
+
+   The file is mapped, and a time range is found with a binary search, so
+   a query reads only the entries it returns (or, with a bounding box,
+   the entries in its time range).
+*/
+
+#define CATALOG_RECORD  44
+#define NO_POSITION     0x7fffffff
+
+
+/* ========================================================================= */
+/* Summarizing a run file                                                    */
+/* ========================================================================= */
+
+/* The types we need to look at; everything else is left packed. */
+
+static int
+garmin_catalog_wants ( uint32 type )
+{
+  switch ( type ) {
+  case data_Dlist:
+  case data_D1000:
+  case data_D1009:
+  case data_D1010:
+  case data_D1001:
+  case data_D1011:
+  case data_D1015:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+static void
+garmin_catalog_add_lap ( garmin_catalog_entry * e,
+			 time_type              start_time,
+			 uint32                 total_time,
+			 float32                total_dist )
+{
+  if ( e->laps == 0 || start_time < e->start_time ) {
+    e->start_time = start_time;
+  }
+  e->duration += total_time;
+  e->distance += total_dist;
+  e->laps++;
+}
+
+
+/* Find the sport, and add up the laps, of the runs in the data. */
+
+static void
+garmin_catalog_scan ( garmin_catalog_entry * e,
+		      garmin_data *          data,
+		      int *                  have_run )
+{
+  garmin_list *       l;
+  garmin_list_node *  n;
+  D1001 *             d1001;
+  D1011 *             d1011;
+  D1015 *             d1015;
+
+  if ( data == NULL || data->data == NULL ) return;
+
+  switch ( data->type ) {
+  case data_Dlist:
+    l = data->data;
+    for ( n = l->head; n != NULL; n = n->next ) {
+      if ( n->packed == NULL || garmin_catalog_wants(n->packed_type) ) {
+	garmin_catalog_scan(e,garmin_list_node_data(l,n),have_run);
+      }
+    }
+    break;
+  case data_D1000:
+    if ( !*have_run ) e->sport_type = ((D1000 *)data->data)->sport_type;
+    *have_run = 1;
+    break;
+  case data_D1009:
+    if ( !*have_run ) e->sport_type = ((D1009 *)data->data)->sport_type;
+    *have_run = 1;
+    break;
+  case data_D1010:
+    if ( !*have_run ) e->sport_type = ((D1010 *)data->data)->sport_type;
+    *have_run = 1;
+    break;
+  case data_D1001:
+    d1001 = data->data;
+    garmin_catalog_add_lap(e,d1001->start_time,d1001->total_time,
+			   d1001->total_dist);
+    break;
+  case data_D1011:
+    d1011 = data->data;
+    garmin_catalog_add_lap(e,d1011->start_time,d1011->total_time,
+			   d1011->total_dist);
+    break;
+  case data_D1015:
+    d1015 = data->data;
+    garmin_catalog_add_lap(e,d1015->start_time,d1015->total_time,
+			   d1015->total_dist);
+    break;
+  default:
+    break;
+  }
+}
+
+
+/*
+   Fill in an entry from a run file.  The file is unpacked lazily, and the
+   track points go straight into columns for the bounding box.  A file
+   without laps gets its start time and duration from its track.  Returns
+   0 for a file that can't be read, or that has neither a run nor any
+   track points (waypoints, say), so that it is left out.
+*/
+
+static int
+garmin_catalog_summarize ( garmin_catalog_entry * e, const char * path )
+{
+  garmin_map *           map;
+  garmin_track_columns * c;
+  int                    have_run = 0;
+  uint32                 points   = 0;
+  uint32                 i;
+
+  if ( (map = garmin_map_file(path,GARMIN_MAP_STRINGS | GARMIN_MAP_LAZY))
+       == NULL ) {
+    return 0;
+  }
+
+  e->sw.lat = e->sw.lon = NO_POSITION;
+  e->ne.lat = e->ne.lon = NO_POSITION;
+
+  garmin_catalog_scan(e,map->data,&have_run);
+
+  if ( (c = garmin_track_columns_new(map->data)) != NULL ) {
+    points = c->count;
+    for ( i = 0; i < c->count; i++ ) {
+      if ( c->lat[i] == NO_POSITION || c->lon[i] == NO_POSITION ) continue;
+      if ( e->sw.lat == NO_POSITION ) {
+	e->sw.lat = e->ne.lat = c->lat[i];
+	e->sw.lon = e->ne.lon = c->lon[i];
+      } else {
+	if ( c->lat[i] < e->sw.lat ) e->sw.lat = c->lat[i];
+	if ( c->lat[i] > e->ne.lat ) e->ne.lat = c->lat[i];
+	if ( c->lon[i] < e->sw.lon ) e->sw.lon = c->lon[i];
+	if ( c->lon[i] > e->ne.lon ) e->ne.lon = c->lon[i];
+      }
+    }
+    if ( e->laps == 0 && c->count > 0 ) {
+      e->start_time = c->time[0];
+      e->duration   = (c->time[c->count-1] - c->time[0]) * 100;
+    }
+    garmin_track_columns_free(c);
+  }
+
+  garmin_unmap(map);
+
+  return ( have_run || points > 0 );
+}
+
+
+/* ========================================================================= */
+/* Reading a catalog                                                         */
+/* ========================================================================= */
+
+garmin_catalog *
+garmin_catalog_open ( const char * filename )
+{
+  garmin_catalog * c = NULL;
+  struct stat      sb;
+  void *           addr;
+  uint32           entries;
+  int              fd;
+
+  if ( (fd = open(filename,O_RDONLY)) == -1 ) {
+    printf("%s: open: %s\n",filename,strerror(errno));
+    return NULL;
+  }
+
+  if ( fstat(fd,&sb) == -1 ) {
+    printf("%s: fstat: %s\n",filename,strerror(errno));
+  } else if ( sb.st_size < GARMIN_HEADER ) {
+    printf("%s: not a catalog\n",filename);
+  } else if ( (addr = mmap(NULL,sb.st_size,PROT_READ,MAP_PRIVATE,fd,0))
+	      == MAP_FAILED ) {
+    printf("%s: mmap: %s\n",filename,strerror(errno));
+  } else {
+    entries = get_uint32((uint8 *)addr + 16);
+    if ( memcmp(addr,GARMIN_C_MAGIC,strlen(GARMIN_C_MAGIC)) != 0 ||
+	 get_uint32((uint8 *)addr + 12) > GARMIN_VERSION ||
+	 entries > (sb.st_size - GARMIN_HEADER) / CATALOG_RECORD ) {
+      printf("%s: not a catalog\n",filename);
+      munmap(addr,sb.st_size);
+    } else if ( (c = calloc(1,sizeof(garmin_catalog))) == NULL ) {
+      printf("%s: calloc: %s\n",filename,strerror(errno));
+      munmap(addr,sb.st_size);
+    } else {
+      c->addr       = addr;
+      c->length     = sb.st_size;
+      c->entries    = entries;
+      c->records    = (uint8 *)addr + GARMIN_HEADER;
+      c->names      = (char *)c->records + entries * CATALOG_RECORD;
+      c->names_size = c->length - GARMIN_HEADER - entries * CATALOG_RECORD;
+    }
+  }
+
+  close(fd);
+
+  return c;
+}
+
+
+/*
+   Read entry i.  Its path points into the catalog, and is only valid
+   until the catalog is closed.  Returns 0 if there is no such entry.
+*/
+
+int
+garmin_catalog_entry_get ( garmin_catalog *       c,
+			   uint32                 i,
+			   garmin_catalog_entry * e )
+{
+  const uint8 * r;
+  uint32        name;
+
+  if ( i >= c->entries ) return 0;
+
+  r = c->records + i * CATALOG_RECORD;
+
+  e->start_time = get_uint32(r);
+  e->duration   = get_uint32(r+4);
+  e->distance   = get_float32(r+8);
+  e->sw.lat     = get_sint32(r+12);
+  e->sw.lon     = get_sint32(r+16);
+  e->ne.lat     = get_sint32(r+20);
+  e->ne.lon     = get_sint32(r+24);
+  e->mtime      = get_uint32(r+28);
+  e->size       = get_uint32(r+32);
+  name          = get_uint32(r+36);
+  e->laps       = get_uint16(r+40);
+  e->sport_type = r[42];
+
+  /* Never hand back a path that runs off the end of the catalog. */
+
+  if ( name < c->names_size &&
+       memchr(c->names + name,0,c->names_size - name) != NULL ) {
+    e->path = c->names + name;
+  } else {
+    e->path = "";
+  }
+
+  return 1;
+}
+
+
+/*
+   Call back with every run that started between 'from' and 'to'
+   (inclusive) and, if 'sw' and 'ne' are given, whose track overlaps that
+   box.  Returns the number of runs found.
+*/
+
+uint32
+garmin_catalog_find ( garmin_catalog *  c,
+		      time_type         from,
+		      time_type         to,
+		      position_type *   sw,
+		      position_type *   ne,
+		      garmin_catalog_cb callback,
+		      void *            context )
+{
+  garmin_catalog_entry  e;
+  uint32                lo    = 0;
+  uint32                hi    = c->entries;
+  uint32                mid;
+  uint32                found = 0;
+  uint32                i;
+
+  /* The first entry starting at or after 'from'. */
+
+  while ( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if ( get_uint32(c->records + mid * CATALOG_RECORD) < from ) lo = mid + 1;
+    else                                                         hi = mid;
+  }
+
+  for ( i = lo; i < c->entries; i++ ) {
+    if ( get_uint32(c->records + i * CATALOG_RECORD) > to ) break;
+    garmin_catalog_entry_get(c,i,&e);
+    if ( sw != NULL && ne != NULL &&
+	 (e.sw.lat == NO_POSITION ||
+	  e.sw.lat > ne->lat || e.ne.lat < sw->lat ||
+	  e.sw.lon > ne->lon || e.ne.lon < sw->lon) ) {
+      continue;
+    }
+    found++;
+    if ( callback != NULL && callback(&e,context) == 0 ) break;
+  }
+
+  return found;
+}
+
+
+void
+garmin_catalog_close ( garmin_catalog * c )
+{
+  if ( c != NULL ) {
+    if ( c->addr != NULL ) munmap(c->addr,c->length);
+    free(c);
+  }
+}
+
+
+/* ========================================================================= */
+/* Building a catalog                                                        */
+/* ========================================================================= */
+
+/* An entry of the old catalog, by path. */
+
+typedef struct catalog_old {
+  const char *            path;
+  uint32                  index;
+} catalog_old;
+
+
+typedef struct catalog_build {
+  const char *            dir;
+  garmin_catalog_entry *  entries;
+  uint32                  count;
+  uint32                  capacity;
+  garmin_catalog *        old;
+  catalog_old *           by_path;
+  uint32                  reused;
+} catalog_build;
+
+
+static int
+catalog_old_cmp ( const void * a, const void * b )
+{
+  return strcmp(((const catalog_old *)a)->path,((const catalog_old *)b)->path);
+}
+
+
+static int
+catalog_entry_cmp ( const void * a, const void * b )
+{
+  const garmin_catalog_entry * x = a;
+  const garmin_catalog_entry * y = b;
+
+  if ( x->start_time != y->start_time ) {
+    return (x->start_time < y->start_time) ? -1 : 1;
+  }
+
+  return strcmp(x->path,y->path);
+}
+
+
+static int
+garmin_catalog_is_run_file ( const char * name )
+{
+  const char * dot = strrchr(name,'.');
+
+  return ( dot != NULL &&
+	   (strcmp(dot,".gmn") == 0 || strcmp(dot,".gmnz") == 0) );
+}
+
+
+/*
+   Add the file at 'rel' (relative to the directory) to the catalog.  If
+   the old catalog has it, and it hasn't changed since, its old entry is
+   used instead of opening it again.
+*/
+
+static void
+garmin_catalog_add ( catalog_build * b,
+		     const char *    rel,
+		     const char *    path,
+		     struct stat *   sb )
+{
+  garmin_catalog_entry * e;
+  garmin_catalog_entry * grown;
+  catalog_old            key;
+  catalog_old *          old = NULL;
+  uint32                 size;
+
+  if ( b->count == b->capacity ) {
+    size = (b->capacity == 0) ? 256 : 2 * b->capacity;
+    if ( (grown = realloc(b->entries,size * sizeof(*grown))) == NULL ) {
+      printf("garmin_catalog_build: out of memory\n");
+      return;
+    }
+    b->entries  = grown;
+    b->capacity = size;
+  }
+
+  e = b->entries + b->count;
+  memset(e,0,sizeof(*e));
+
+  if ( b->by_path != NULL ) {
+    key.path = rel;
+    old = bsearch(&key,b->by_path,b->old->entries,sizeof(key),
+		  catalog_old_cmp);
+  }
+
+  if ( old != NULL && garmin_catalog_entry_get(b->old,old->index,e) &&
+       e->mtime == (uint32)sb->st_mtime && e->size == (uint32)sb->st_size ) {
+    b->reused++;
+  } else {
+    memset(e,0,sizeof(*e));
+    if ( !garmin_catalog_summarize(e,path) ) return;
+    e->mtime = sb->st_mtime;
+    e->size  = sb->st_size;
+  }
+
+  if ( (e->path = strdup(rel)) != NULL ) b->count++;
+}
+
+
+/* Walk the directory 'rel' (relative to the top), adding every run file. */
+
+static void
+garmin_catalog_walk ( catalog_build * b, const char * rel )
+{
+  DIR *           d;
+  struct dirent * de;
+  struct stat     sb;
+  char            path[PATH_MAX];
+  char            sub[PATH_MAX];
+  int             n;
+
+  if ( rel[0] != 0 ) snprintf(path,sizeof(path),"%s/%s",b->dir,rel);
+  else               snprintf(path,sizeof(path),"%s",b->dir);
+
+  if ( (d = opendir(path)) == NULL ) {
+    printf("%s: opendir: %s\n",path,strerror(errno));
+    return;
+  }
+
+  while ( (de = readdir(d)) != NULL ) {
+    if ( de->d_name[0] == '.' ) continue;
+    if ( rel[0] != 0 ) n = snprintf(sub,sizeof(sub),"%s/%s",rel,de->d_name);
+    else               n = snprintf(sub,sizeof(sub),"%s",de->d_name);
+    if ( n >= (int)sizeof(sub) ||
+	 snprintf(path,sizeof(path),"%s/%s",b->dir,sub) >= (int)sizeof(path) ||
+	 stat(path,&sb) == -1 ) {
+      continue;
+    }
+    if ( S_ISDIR(sb.st_mode) ) {
+      garmin_catalog_walk(b,sub);
+    } else if ( S_ISREG(sb.st_mode) && garmin_catalog_is_run_file(sub) ) {
+      garmin_catalog_add(b,sub,path,&sb);
+    }
+  }
+
+  closedir(d);
+}
+
+
+/* Write the catalog next to 'filename', then move it into place. */
+
+static int
+garmin_catalog_write ( catalog_build * b, const char * filename )
+{
+  uint8 *  buf;
+  uint8 *  r;
+  char *   names;
+  uint32   names_size = 0;
+  uint32   bytes;
+  uint32   i;
+  char     tmp[PATH_MAX];
+  int      fd;
+  int      ok = 0;
+
+  for ( i = 0; i < b->count; i++ ) {
+    names_size += strlen(b->entries[i].path) + 1;
+  }
+
+  bytes = GARMIN_HEADER + b->count * CATALOG_RECORD + names_size;
+
+  if ( (buf = calloc(1,bytes)) == NULL ) {
+    printf("garmin_catalog_build: out of memory\n");
+    return 0;
+  }
+
+  strncpy((char *)buf,GARMIN_C_MAGIC,11);
+  put_uint32(buf+12,GARMIN_VERSION);
+  put_uint32(buf+16,b->count);
+
+  r     = buf + GARMIN_HEADER;
+  names = (char *)r + b->count * CATALOG_RECORD;
+
+  for ( i = 0; i < b->count; i++, r += CATALOG_RECORD ) {
+    put_uint32(r,b->entries[i].start_time);
+    put_uint32(r+4,b->entries[i].duration);
+    put_float32(r+8,b->entries[i].distance);
+    put_sint32(r+12,b->entries[i].sw.lat);
+    put_sint32(r+16,b->entries[i].sw.lon);
+    put_sint32(r+20,b->entries[i].ne.lat);
+    put_sint32(r+24,b->entries[i].ne.lon);
+    put_uint32(r+28,b->entries[i].mtime);
+    put_uint32(r+32,b->entries[i].size);
+    put_uint32(r+36,names - (char *)(buf + GARMIN_HEADER +
+				     b->count * CATALOG_RECORD));
+    put_uint16(r+40,b->entries[i].laps);
+    r[42] = b->entries[i].sport_type;
+    strcpy(names,b->entries[i].path);
+    names += strlen(names) + 1;
+  }
+
+  snprintf(tmp,sizeof(tmp),"%s.new",filename);
+
+  if ( (fd = open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0664)) == -1 ) {
+    printf("creat: %s: %s\n",tmp,strerror(errno));
+  } else {
+    if ( write(fd,buf,bytes) != (ssize_t)bytes ) {
+      printf("%s: write: %s\n",tmp,strerror(errno));
+    } else {
+      ok = 1;
+    }
+    close(fd);
+    if ( ok && rename(tmp,filename) == -1 ) {
+      printf("rename: %s: %s\n",filename,strerror(errno));
+      ok = 0;
+    }
+    if ( !ok ) unlink(tmp);
+  }
+
+  free(buf);
+
+  return ok;
+}
+
+
+/* ========================================================================= */
+/* garmin_catalog_build                                                      */
+/*                                                                           */
+/* Catalog every .gmn and .gmnz file under 'dir' (as laid out by             */
+/* garmin_save_runs) into 'filename'.  If 'filename' already holds a         */
+/* catalog, files that have not changed since are not opened again.          */
+/* Returns 1 on success and 0 on failure.                                    */
+/* ========================================================================= */
+
+int
+garmin_catalog_build ( const char * dir, const char * filename )
+{
+  catalog_build          b;
+  garmin_catalog_entry   e;
+  struct stat            sb;
+  uint32                 i;
+  int                    ok;
+
+  memset(&b,0,sizeof(b));
+  b.dir = dir;
+
+  if ( stat(filename,&sb) != -1 && (b.old = garmin_catalog_open(filename))
+       != NULL && b.old->entries > 0 &&
+       (b.by_path = calloc(b.old->entries,sizeof(catalog_old))) != NULL ) {
+    for ( i = 0; i < b.old->entries; i++ ) {
+      garmin_catalog_entry_get(b.old,i,&e);
+      b.by_path[i].path  = e.path;
+      b.by_path[i].index = i;
+    }
+    qsort(b.by_path,b.old->entries,sizeof(catalog_old),catalog_old_cmp);
+  }
+
+  garmin_catalog_walk(&b,"");
+
+  qsort(b.entries,b.count,sizeof(garmin_catalog_entry),catalog_entry_cmp);
+
+  ok = garmin_catalog_write(&b,filename);
+
+  for ( i = 0; i < b.count; i++ ) free((char *)b.entries[i].path);
+  if ( b.entries != NULL ) free(b.entries);
+  if ( b.by_path != NULL ) free(b.by_path);
+  garmin_catalog_close(b.old);
+
+  return ok;
+}
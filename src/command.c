@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "garmin.h"
+#include "byte_util.h"
 
 
 /* 
@@ -224,7 +225,7 @@ garmin_make_command_packet ( garmin_unit *    garmin,
 }
 
 
-/* Send a command */
+/* Send a command.  Returns 0 if it isn't supported or can't be sent. */
 
 int
 garmin_send_command ( garmin_unit * garmin, garmin_command cmd )
@@ -234,7 +235,10 @@ garmin_send_command ( garmin_unit * garmin, garmin_command cmd )
 
   if ( garmin_command_supported(garmin,cmd) &&
        garmin_make_command_packet(garmin,cmd,&packet) ) {
-    ret = garmin_write(garmin,&packet);
+    if ( (ret = garmin_write(garmin,&packet)) < 0 ) {
+      /* The unit has gone away, or won't take it. */
+      ret = 0;
+    }
   } else {
     /* Error: command not supported */
 
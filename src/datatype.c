@@ -23,78 +23,146 @@
 #include "garmin.h"
 
 
+/* The last list id handed out.  Lists are allocated on several threads. */
+
 static uint32 gListId = 0;
 
 
+#define ARENA_BLOCK      65536    /* size of the first arena block */
+#define ARENA_BLOCK_MAX  1048576  /* blocks double in size up to this */
+#define ARENA_ALIGN      8
+
+
+/* 
+   An arena is a chain of large blocks that allocations are carved out of
+   in order.  Nothing is freed until the whole arena is freed at once.
+*/
+
+typedef struct garmin_arena_block {
+  struct garmin_arena_block * next;
+  size_t                      size;
+  size_t                      used;
+} garmin_arena_block;
+
+
+struct garmin_arena {
+  garmin_arena_block *        blocks;
+  size_t                      next_size;
+};
+
+
+garmin_arena *
+garmin_arena_new ( void )
+{
+  garmin_arena * a;
+
+  if ( (a = calloc(1,sizeof(garmin_arena))) != NULL ) {
+    a->next_size = ARENA_BLOCK;
+  }
+
+  return a;
+}
+
+
+/* Return 'size' zeroed bytes from the arena. */
+
+void *
+garmin_arena_alloc ( garmin_arena * a, size_t size )
+{
+  garmin_arena_block * b = a->blocks;
+  size_t               bytes;
+  void *               ret;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if ( b == NULL || b->used + size > b->size ) {
+    bytes = a->next_size;
+    if ( bytes < size ) bytes = size;
+    if ( (b = malloc(sizeof(garmin_arena_block) + bytes)) == NULL ) {
+      return NULL;
+    }
+    b->size   = bytes;
+    b->used   = 0;
+    b->next   = a->blocks;
+    a->blocks = b;
+    if ( a->next_size < ARENA_BLOCK_MAX ) a->next_size *= 2;
+  }
+
+  ret      = (char *)(b + 1) + b->used;
+  b->used += size;
+  memset(ret,0,size);
+
+  return ret;
+}
+
+
+/* Free an arena and everything that was allocated from it. */
+
+void
+garmin_arena_free ( garmin_arena * a )
+{
+  garmin_arena_block * b;
+  garmin_arena_block * x;
+
+  if ( a != NULL ) {
+    for ( b = a->blocks; b != NULL; b = x ) {
+      x = b->next;
+      free(b);
+    }
+    free(a);
+  }
+}
+
+
+/* The size of the structure holding a given data type (0 if unknown). */
+
+static size_t
+garmin_datatype_size ( garmin_datatype type )
+{
+  size_t size = 0;
+
+  switch ( type ) {
+#define RECORD(x) \
+  case data_D##x: size = sizeof(D##x); break;
+#include "schema.h"
+  default: break;
+  }
+
+  return size;
+}
+
+
 garmin_data *
 garmin_alloc_data ( garmin_datatype type )
 {
-  garmin_data * d = malloc(sizeof(garmin_data));
+  return garmin_arena_alloc_data(NULL,type);
+}
 
-  d->type = type;
 
-#define CASE_DATA(x) \
-  case data_D##x: d->data = calloc(1,sizeof(D##x)); break
+/* 
+   Allocate data from an arena, or from the heap if the arena is NULL.
+   Data from an arena must only be released by garmin_arena_free().
+*/
 
-  switch ( type ) {
-  case data_Dlist: d->data = garmin_alloc_list(); break;
-  CASE_DATA(100);
-  CASE_DATA(101);
-  CASE_DATA(102);
-  CASE_DATA(103);
-  CASE_DATA(104);
-  CASE_DATA(105);
-  CASE_DATA(106);
-  CASE_DATA(107);
-  CASE_DATA(108);
-  CASE_DATA(109);
-  CASE_DATA(110);
-  CASE_DATA(120);
-  CASE_DATA(150);
-  CASE_DATA(151);
-  CASE_DATA(152);
-  CASE_DATA(154);
-  CASE_DATA(155);
-  CASE_DATA(200);
-  CASE_DATA(201);
-  CASE_DATA(202);
-  CASE_DATA(210);
-  CASE_DATA(300);
-  CASE_DATA(301);
-  CASE_DATA(302);
-  CASE_DATA(303);
-  CASE_DATA(304);
-  CASE_DATA(310);
-  CASE_DATA(311);
-  CASE_DATA(312);
-  CASE_DATA(400);
-  CASE_DATA(403);
-  CASE_DATA(450);
-  CASE_DATA(500);
-  CASE_DATA(501);
-  CASE_DATA(550);
-  CASE_DATA(551);
-  CASE_DATA(600);
-  CASE_DATA(650);
-  CASE_DATA(700);
-  CASE_DATA(800);
-  CASE_DATA(906);
-  CASE_DATA(1000);
-  CASE_DATA(1001);
-  CASE_DATA(1002);
-  CASE_DATA(1003);
-  CASE_DATA(1004);
-  CASE_DATA(1005);
-  CASE_DATA(1006);
-  CASE_DATA(1007);
-  CASE_DATA(1008);
-  CASE_DATA(1009);
-  CASE_DATA(1010);
-  CASE_DATA(1011);
-  CASE_DATA(1012);
-  CASE_DATA(1013);
-  CASE_DATA(1015);
-  default: d->data = NULL; break;
+garmin_data *
+garmin_arena_alloc_data ( garmin_arena * a, garmin_datatype type )
+{
+  garmin_data * d;
+  size_t        size;
+
+  if ( a == NULL ) d = malloc(sizeof(garmin_data));
+  else             d = garmin_arena_alloc(a,sizeof(garmin_data));
+
+  d->type = type;
+
+  if ( type == data_Dlist ) {
+    d->data = garmin_arena_alloc_list(a);
+  } else if ( (size = garmin_datatype_size(type)) == 0 ) {
+    d->data = NULL;
+  } else if ( a == NULL ) {
+    d->data = calloc(1,size);
+  } else {
+    d->data = garmin_arena_alloc(a,size);
   }
 
   return d;
@@ -103,53 +171,149 @@ garmin_alloc_data ( garmin_datatype type )
 
 garmin_list *
 garmin_alloc_list ( void )
+{
+  return garmin_arena_alloc_list(NULL);
+}
+
+
+/* 
+   Allocate a list from an arena (or the heap if NULL).  Elements appended
+   to the list later on are allocated from the same arena.
+*/
+
+garmin_list *
+garmin_arena_alloc_list ( garmin_arena * a )
 {
   garmin_list * l;
 
-  l = calloc(1,sizeof(garmin_list));
-  l->id = ++gListId;
+  if ( a == NULL ) l = calloc(1,sizeof(garmin_list));
+  else             l = garmin_arena_alloc(a,sizeof(garmin_list));
+  l->id    = __sync_add_and_fetch(&gListId,1);
+  l->arena = a;
 
   return l;
 }
 
 
+static garmin_list_node *
+garmin_list_new_node ( garmin_list * l )
+{
+  garmin_list_node * n;
+
+  if ( l->arena == NULL ) n = malloc(sizeof(garmin_list_node));
+  else n = garmin_arena_alloc(l->arena,sizeof(garmin_list_node));
+
+  n->data   = NULL;
+  n->next   = NULL;
+  n->packed = NULL;
+
+  if ( l->head == NULL ) l->head = n;
+  if ( l->tail != NULL ) l->tail->next = n;
+  l->tail = n;
+
+  l->elements++;
+
+  return n;
+}
+
+
 garmin_list *
 garmin_list_append ( garmin_list * list, garmin_data * data )
 {
   garmin_list *      l = list;
-  garmin_list_node * n;
 
   if ( data != NULL ) {
     if ( l == NULL ) l = garmin_alloc_list();
-    n = malloc(sizeof(garmin_list_node));
-
-    n->data = data;
-    n->next = NULL;
-    
-    if ( l->head == NULL ) l->head = n;
-    if ( l->tail != NULL ) l->tail->next = n;
-    l->tail = n;
-    
-    l->elements++;
+    garmin_list_new_node(l)->data = data;
   }
 
   return l;
 }
 
 
+/*
+   Append an element that is still in its packed form.  It is unpacked
+   the first time garmin_list_node_data() is called on its node.  The
+   packed bytes are not copied and must stay valid until then.
+*/
+
+garmin_list *
+garmin_list_append_packed ( garmin_list *     list,
+			    garmin_datatype   type,
+			    uint8 *           packed,
+			    uint32            size )
+{
+  garmin_list *      l = list;
+  garmin_list_node * n;
+
+  if ( packed != NULL ) {
+    if ( l == NULL ) l = garmin_alloc_list();
+    n = garmin_list_new_node(l);
+    n->packed      = packed;
+    n->packed_type = type;
+    n->packed_size = size;
+  }
+
+  return l;
+}
+
+
+/* 
+   Return the node at position 'which' in a list, or NULL.  The list keeps
+   an array of its nodes that is filled in on demand, so after the first
+   lookup this is a constant time operation.  Nodes are only ever added at
+   the tail, so the array is extended from where it left off.
+*/
+
+garmin_list_node *
+garmin_list_node_at ( garmin_list * l, uint32 which )
+{
+  garmin_list_node ** index;
+  garmin_list_node *  n;
+  uint32              size;
+
+  if ( l == NULL || which >= (uint32)l->elements ) return NULL;
+
+  if ( which >= l->indexed ) {
+    if ( l->index_size < (uint32)l->elements ) {
+      size = (l->index_size < 16) ? 16 : 2 * l->index_size;
+      if ( size < (uint32)l->elements ) size = l->elements;
+      if ( l->arena == NULL ) {
+	index = realloc(l->index,size * sizeof(garmin_list_node *));
+      } else {
+	index = garmin_arena_alloc(l->arena,size * sizeof(garmin_list_node *));
+	if ( index != NULL && l->indexed > 0 ) {
+	  memcpy(index,l->index,l->indexed * sizeof(garmin_list_node *));
+	}
+      }
+      if ( index == NULL ) return NULL;
+      l->index      = index;
+      l->index_size = size;
+    }
+    n = (l->indexed == 0) ? l->head : l->index[l->indexed-1]->next;
+    for ( ; n != NULL && l->indexed < (uint32)l->elements; n = n->next ) {
+      l->index[l->indexed++] = n;
+    }
+    if ( which >= l->indexed ) return NULL;
+  }
+
+  return l->index[which];
+}
+
+
 garmin_data *
 garmin_list_data ( garmin_data * data, uint32 which )
 {
   garmin_data *       ret = NULL;
   garmin_list *       list;
   garmin_list_node *  n;
-  int                 i;
 
   if ( data                 != NULL       && 
        data->type           == data_Dlist && 
        (list = data->data)  != NULL ) {
-    for ( i = 0, n = list->head; i < which && n != NULL; i++, n = n->next );
-    if ( n != NULL ) ret = n->data;
+    if ( (n = garmin_list_node_at(list,which)) != NULL ) {
+      ret = garmin_list_node_data(list,n);
+    }
   }
 
   return ret;
@@ -168,6 +332,7 @@ garmin_free_list ( garmin_list * l )
       garmin_free_data(n->data);
       free(n);
     }
+    if ( l->index != NULL ) free(l->index);
     free(l);
   }
 }
@@ -184,6 +349,7 @@ garmin_free_list_only ( garmin_list * l )
       x = n->next;
       free(n);
     }
+    if ( l->index != NULL ) free(l->index);
     free(l);
   }
 }
@@ -192,86 +358,38 @@ garmin_free_list_only ( garmin_list * l )
 #define TRYFREE(x) if ( x != NULL ) free(x)
 
 
+/* 
+   Free the variable length strings in each record, generated from the
+   layouts in schema.h.  The record itself is not freed.
+*/
+
+#define RECORD(x) static void garmin_free_d##x ( D##x * r );
+#include "schema.h"
+
+#define RECORD(x)                                                        \
+  static void                                                            \
+  garmin_free_d##x ( D##x * r )                                          \
+  {
+#define END_RECORD   }
+#define F_VST(f)     TRYFREE((*r)f);
+#define F_REC(x,f)   garmin_free_d##x(&(*r)f);
+#define F_LOOP(i,n)  { int i; for ( i = 0; i < (n); i++ ) {
+#define F_END_LOOP   } }
+#include "schema.h"
+
+
 void
 garmin_free_data ( garmin_data * d )
 {
-  D105 *   d105;
-  D106 *   d106;
-  D108 *   d108;
-  D109 *   d109;
-  D110 *   d110;
-  D202 *   d202;
-  D210 *   d210;
-  D310 *   d310;
-  D312 *   d312;
-  D650 *   d650;
-
   if ( d != NULL ) {
     if ( d->data != NULL ) {
       if ( d->type == data_Dlist ) {
 	garmin_free_list((garmin_list *)d->data);
       } else {
 	switch ( d->type ) {
-	case data_D105:
-	  d105 = d->data;
-	  TRYFREE(d105->wpt_ident);
-	  break;
-	case data_D106:
-	  d106 = d->data;
-	  TRYFREE(d106->wpt_ident);
-	  TRYFREE(d106->lnk_ident);
-	  break;
-	case data_D108:
-	  d108 = d->data;
-	  TRYFREE(d108->ident);
-	  TRYFREE(d108->comment);
-	  TRYFREE(d108->facility);
-	  TRYFREE(d108->city);
-	  TRYFREE(d108->addr);
-	  TRYFREE(d108->cross_road);
-	  break;
-	case data_D109:
-	  d109 = d->data;
-	  TRYFREE(d109->ident);
-	  TRYFREE(d109->comment);
-	  TRYFREE(d109->facility);
-	  TRYFREE(d109->city);
-	  TRYFREE(d109->addr);
-	  TRYFREE(d109->cross_road);
-	  break;
-	case data_D110:
-	  d110 = d->data;
-	  TRYFREE(d110->ident);
-	  TRYFREE(d110->comment);
-	  TRYFREE(d110->facility);
-	  TRYFREE(d110->city);
-	  TRYFREE(d110->addr);
-	  TRYFREE(d110->cross_road);
-	  break;
-	case data_D202:
-	  d202 = d->data;
-	  TRYFREE(d202->rte_ident);
-	  break;
-	case data_D210:
-	  d210 = d->data;
-	  TRYFREE(d210->ident);
-	  break;
-	case data_D310:
-	  d310 = d->data;
-	  TRYFREE(d310->trk_ident);
-	  break;
-	case data_D312:
-	  d312 = d->data;
-	  TRYFREE(d312->trk_ident);
-	  break;
-	case data_D650:
-	  d650 = d->data;
-	  TRYFREE(d650->departure_name);
-	  TRYFREE(d650->departure_ident);
-	  TRYFREE(d650->arrival_name);
-	  TRYFREE(d650->arrival_ident);
-	  TRYFREE(d650->ac_id);
-	  break;
+#define RECORD(x) \
+	case data_D##x: garmin_free_d##x(d->data); break;
+#include "schema.h"
 	default:
 	  break;
 	}
@@ -284,10 +402,77 @@ garmin_free_data ( garmin_data * d )
 
 
 /* 
-   Returns the number of bytes needed in order to serialize the data.  Note
-   that this is an upper bound!  Some of the Garmin data structures do not
-   align to word boundaries.  Their memory representation will take up more
-   bytes than the serialized representation will.
+   Free data whose strings are not ours to free (they point into a file
+   mapped by garmin_map_file).  Everything else is freed as usual.
+*/
+
+void
+garmin_free_data_borrowed ( garmin_data * d )
+{
+  garmin_list *      l;
+  garmin_list_node * n;
+  garmin_list_node * x;
+
+  if ( d != NULL ) {
+    if ( d->type == data_Dlist && (l = d->data) != NULL ) {
+      for ( n = l->head; n != NULL; n = x ) {
+	x = n->next;
+	garmin_free_data_borrowed(n->data);
+	free(n);
+      }
+      if ( l->index != NULL ) free(l->index);
+      free(l);
+    } else if ( d->data != NULL ) {
+      free(d->data);
+    }
+    free(d);
+  }
+}
+
+
+/* 
+   The packed size of each record, generated from the layouts in schema.h.
+   Fixed size fields count their packed size (not their size in memory,
+   which may include padding), and a variable length string counts its
+   length plus the terminating '\0' (nothing if it is NULL, since it is
+   not packed at all).
+*/
+
+#define RECORD(x) static uint32 garmin_size_d##x ( D##x * r );
+#include "schema.h"
+
+#define RECORD(x)                                                        \
+  static uint32                                                          \
+  garmin_size_d##x ( D##x * r )                                          \
+  {                                                                      \
+    uint32 bytes = 0;
+#define END_RECORD   return bytes; }
+#define F_U8(f)      bytes += 1;
+#define F_U16(f)     bytes += 2;
+#define F_S16(f)     bytes += 2;
+#define F_U32(f)     bytes += 4;
+#define F_S32(f)     bytes += 4;
+#define F_F32(f)     bytes += 4;
+#define F_F64(f)     bytes += 8;
+#define F_POS(f)     bytes += 8;
+#define F_RPT(f)     bytes += 16;
+#define F_STR(f)     bytes += sizeof((*r)f);
+#define F_VST(f)     if ( (*r)f != NULL ) bytes += strlen((*r)f) + 1;
+#define F_PAD(n)     bytes += (n);
+#define F_REC(x,f)   bytes += garmin_size_d##x(&(*r)f);
+#define F_LOOP(i,n)  { int i; for ( i = 0; i < (n); i++ ) {
+#define F_END_LOOP   } }
+#include "schema.h"
+
+
+/* 
+   Returns the number of bytes needed in order to serialize the data.  This
+   is exact: it is the number of bytes that garmin_pack will write.  Each
+   record takes 4 bytes for the data type, and 4 additional bytes in which
+   we store the number of bytes that we should seek forward in order to
+   skip this record.  This allows us to handle files that include new,
+   unrecognized data types but still conform to the file format rules
+   (i.e. we can skip data records that we don't yet know about).
 */
 
 uint32
@@ -297,73 +482,6 @@ garmin_data_size ( garmin_data * d )
   garmin_list_node *  node;
   uint32              bytes = 0;
 
-  /* 
-     The number of bytes needed in order to serialize a Garmin data structure
-     is almost equal to the size of its data structure - but not quite.  If
-     we have variable length strings, we need to add their string lengths
-     (including space for the terminating '\0') and subtract the size of the 
-     char * placeholders.  We also need 4 bytes for the data type, and 4
-     additional bytes in which we store the number of bytes that we should
-     seek forward in order to skip this record.  This allows us to handle
-     files that include new, unrecognized data types but still conform to
-     the file format rules (i.e. we can skip data records that we don't
-     yet know about).
-  */
-
-#define ADDBYTES(x,y) \
-  bytes = sizeof(D##x) + 8 - 3 * y
-
-#define ADDSTRING(x,y) \
-  if (d##x->y != NULL) bytes += strlen(d##x->y)
-
-#define ADDBYTES1(x,a) \
-  ADDBYTES(x,1);  \
-  ADDSTRING(x,a)
-
-#define ADDBYTES2(x,a,b) \
-  ADDBYTES(x,2);  \
-  ADDSTRING(x,a); \
-  ADDSTRING(x,b)
-
-#define ADDBYTES5(x,a,b,c,d,e) \
-  ADDBYTES(x,5);  \
-  ADDSTRING(x,a); \
-  ADDSTRING(x,b); \
-  ADDSTRING(x,c); \
-  ADDSTRING(x,d); \
-  ADDSTRING(x,e)
-
-#define ADDBYTES6(x,a,b,c,d,e,f) \
-  ADDBYTES(x,6);  \
-  ADDSTRING(x,a); \
-  ADDSTRING(x,b); \
-  ADDSTRING(x,c); \
-  ADDSTRING(x,d); \
-  ADDSTRING(x,e); \
-  ADDSTRING(x,f)
-
-#define DATASIZE0(x)              \
-  case data_D##x:                 \
-    {                             \
-      ADDBYTES(x,0);              \
-    }                             \
-    break
-
-#define DATASIZE(x,y)             \
-  case data_D##x:                 \
-    {                             \
-      D##x * d##x = d->data;      \
-                                  \
-      y;                          \
-    }                             \
-    break
-
-#define DATASIZE1(x,a)             DATASIZE(x,ADDBYTES1(x,a))
-#define DATASIZE2(x,a,b)           DATASIZE(x,ADDBYTES2(x,a,b))
-#define DATASIZE5(x,a,b,c,d,e)     DATASIZE(x,ADDBYTES5(x,a,b,c,d,e))
-#define DATASIZE6(x,a,b,c,d,e,f)   DATASIZE(x,ADDBYTES6(x,a,b,c,d,e,f))
-
-
   if ( d != NULL ) {
     if ( d->data != NULL ) {
       if ( d->type == data_Dlist ) {
@@ -371,67 +489,17 @@ garmin_data_size ( garmin_data * d )
 	bytes += 16;  /* { datatype, bytes, list ID, element count } */
 	for ( node = list->head; node != NULL; node = node->next ) {
 	  bytes += 4; /* list ID */
-	  bytes += garmin_data_size(node->data);
+	  if ( node->packed != NULL ) {
+	    bytes += 8 + node->packed_size;
+	  } else {
+	    bytes += garmin_data_size(node->data);
+	  }
 	}
       } else {
 	switch ( d->type ) {
-        DATASIZE0(100);
-        DATASIZE0(101);
-        DATASIZE0(102);
-        DATASIZE0(103);
-        DATASIZE0(104);
-	DATASIZE1(105,wpt_ident);
-	DATASIZE2(106,wpt_ident,lnk_ident);
-	DATASIZE0(107);
-	DATASIZE6(108,ident,comment,facility,city,addr,cross_road);
-	DATASIZE6(109,ident,comment,facility,city,addr,cross_road);
-	DATASIZE6(110,ident,comment,facility,city,addr,cross_road);
-	DATASIZE0(120);
-	DATASIZE0(150);
-	DATASIZE0(151);
-	DATASIZE0(152);
-	DATASIZE0(154);
-	DATASIZE0(155);
-	DATASIZE0(200);
-	DATASIZE0(201);
-	DATASIZE1(202,rte_ident);
-	DATASIZE1(210,ident);
-	DATASIZE0(300);
-	DATASIZE0(301);
-	DATASIZE0(302);
-	DATASIZE0(303);
-	DATASIZE0(304);
-	DATASIZE1(310,trk_ident);
-	DATASIZE0(311);
-	DATASIZE1(312,trk_ident);
-	DATASIZE0(400);
-	DATASIZE0(403);
-	DATASIZE0(450);
-	DATASIZE0(500);
-	DATASIZE0(501);
-	DATASIZE0(550);
-	DATASIZE0(551);
-	DATASIZE0(600);
-	DATASIZE5(650,departure_name,departure_ident,
-		  arrival_name,arrival_ident,ac_id);
-	DATASIZE0(700);
-	DATASIZE0(800);
-	DATASIZE0(906);
-	DATASIZE0(1000);
-	DATASIZE0(1001);
-	DATASIZE0(1002);
-	DATASIZE0(1003);
-	DATASIZE0(1004);
-	DATASIZE0(1005);
-	DATASIZE0(1006);
-	DATASIZE0(1007);
-	DATASIZE0(1008);
-	DATASIZE0(1009);
-	DATASIZE0(1010);
-	DATASIZE0(1011);
-	DATASIZE0(1012);
-	DATASIZE0(1013);
-	DATASIZE0(1015);
+#define RECORD(x) \
+	case data_D##x: bytes = 8 + garmin_size_d##x(d->data); break;
+#include "schema.h"
 	default:
 	  printf("garmin_data_size: data type %d not supported\n",d->type);
 	  break;
@@ -1460,9 +1460,18 @@ typedef struct garmin_data {
 typedef struct garmin_list_node {
   garmin_data *                      data;
   struct garmin_list_node *          next;
+  uint8 *                            packed;       /* not yet unpacked */
+  uint32                             packed_type;
+  uint32                             packed_size;
 } garmin_list_node;
 
 
+/* A region that many garmin data structures are allocated from and freed
+   together (see datatype.c). */
+
+typedef struct garmin_arena garmin_arena;
+
+
 /* A singly linked list of garmin data (can be a list of lists) */
 
 typedef struct garmin_list {
@@ -1470,9 +1479,96 @@ typedef struct garmin_list {
   int                                elements;
   garmin_list_node *                 head;
   garmin_list_node *                 tail;
+  garmin_arena *                     arena;  /* nodes come from here if set */
+  garmin_list_node **                index;  /* nodes by position, on demand */
+  uint32                             indexed;
+  uint32                             index_size;
+  int                                flags;  /* unpacked with these */
 } garmin_list;
 
 
+/* 
+   Track points stored field by field in contiguous arrays (see track.c).
+   Point i is lat[i], lon[i], time[i] and so on.
+*/
+
+typedef struct garmin_track_columns {
+  uint32                             count;
+  uint32                             capacity;
+  sint32 *                           lat;         /* semicircles */
+  sint32 *                           lon;         /* semicircles */
+  uint32 *                           time;
+  float32 *                          alt;
+  float32 *                          distance;
+  uint8 *                            heart_rate;
+  uint8 *                            cadence;
+  uint8 *                            sensor;
+  uint8 *                            new_trk;     /* starts a new track */
+  int                                header;      /* saw a track header */
+} garmin_track_columns;
+
+
+/* A .gmn file mapped into memory, and the data unpacked from it. */
+
+typedef struct garmin_map {
+  void *                             addr;
+  size_t                             length;
+  int                                flags;
+  garmin_data *                      data;
+} garmin_map;
+
+
+/* A .gmn file read one chunk at a time. */
+
+typedef struct garmin_chunk_reader {
+  void *                             addr;
+  size_t                             length;
+  int                                flags;
+  char *                             filename;
+  size_t                             offset;      /* current chunk header */
+  size_t                             next;        /* next chunk header */
+  uint32                             type;        /* of the current chunk */
+  uint32                             chunk;       /* bytes of packed data */
+} garmin_chunk_reader;
+
+
+/* 
+   One saved run in a catalog of saved run files (see catalog.c).  A run
+   with no track points has a bounding box of 0x7fffffff.
+*/
+
+typedef struct garmin_catalog_entry {
+  time_type                          start_time;  /* of the first lap */
+  uint32                             duration;    /* hundredths of seconds */
+  float32                            distance;    /* meters */
+  position_type                      sw;          /* bounding box of the */
+  position_type                      ne;          /* track (semicircles) */
+  uint16                             laps;
+  uint8                              sport_type;  /* D1000_sport_type */
+  uint32                             mtime;       /* of the file, when */
+  uint32                             size;        /* it was catalogued */
+  const char *                       path;        /* relative to the dir */
+} garmin_catalog_entry;
+
+
+/* A catalog mapped into memory.  Its entries are sorted by start time. */
+
+typedef struct garmin_catalog {
+  void *                             addr;
+  size_t                             length;
+  uint32                             entries;
+  const uint8 *                      records;     /* packed entries */
+  const char *                       names;       /* their paths */
+  uint32                             names_size;
+} garmin_catalog;
+
+
+/* Called with each entry found by garmin_catalog_find; return 0 to stop. */
+
+typedef int (*garmin_catalog_cb) ( const garmin_catalog_entry * entry,
+				   void *                       context );
+
+
 /* ------------------------------------------------------------------------- */
 /* 3.2   USB Protocol                                                        */
 /* ------------------------------------------------------------------------- */
@@ -1822,6 +1918,12 @@ typedef enum {
 #define GARMIN_MAGIC    "<@gArMiN@>"  /* appears at the start of all files. */
 #define GARMIN_VERSION  100           /* version 1.00 */
 #define GARMIN_HEADER   20            /* bytes needed for file header. */
+#define GARMIN_Z_MAGIC  "<@gArMiNz>"  /* starts a compact .gmnz file. */
+#define GARMIN_C_MAGIC  "<@gArMiNc>"  /* starts a catalog of run files. */
+#define GARMIN_S_MAGIC  "<@gArMiNs>"  /* starts a unit's sync state. */
+
+#define GARMIN_MAP_STRINGS  0x01      /* strings point into the mapped file */
+#define GARMIN_MAP_LAZY     0x02      /* list elements unpacked on access */
 
 
 /* ========================================================================= */
@@ -1924,15 +2026,120 @@ typedef struct garmin_datatypes {
 } garmin_datatypes;
 
 
+/* 
+   How packets get to and from a unit.  The USB transport is the default;
+   garmin_replay installs one that plays back a captured session instead.
+   read returns the packet size, or -ETIMEDOUT if nothing arrived within
+   'timeout' ms; write returns 'size'.  Either returns a negative errno
+   value if the unit can't be talked to.  open and close return 1 and 0
+   on success and failure.
+*/
+
+struct garmin_unit;
+
+typedef struct garmin_transport {
+  const char *  name;
+  int        (* open)  ( struct garmin_unit * garmin );
+  int        (* read)  ( struct garmin_unit * garmin, 
+			 union garmin_packet * p,
+			 int                   timeout );
+  int        (* write) ( struct garmin_unit * garmin,
+			 union garmin_packet * p,
+			 int                   size );
+  void       (* close) ( struct garmin_unit * garmin );
+} garmin_transport;
+
+
 typedef struct garmin_usb {
+  struct usb_device *       device;     /* if set, the only unit to open */
   usb_dev_handle *          handle;
   int                       bulk_out;
   int                       bulk_in;
   int                       intr_in;
   int                       read_bulk;
+  struct garmin_queue *     queue;      /* non-NULL while reading ahead */
+  const garmin_transport *  transport;  /* NULL until first opened */
+  void *                    context;    /* owned by the transport */
+  int                       open;
+  FILE *                    capture;    /* if set, every packet goes here */
+  int                       error;      /* first read or write that failed
+					   (-errno), or 0 */
 } garmin_usb;
 
 
+/* 
+   Counters kept while talking to a unit, per application protocol (A1000,
+   A906, ...; protocol 0 holds the session start and everything else done
+   outside a transfer).  Times are in seconds.  The latency histograms
+   count transport calls by how long they took: bucket i counts calls
+   that took under 2^i microseconds, and the last bucket everything
+   slower.  The counters are updated without locking, so read them once
+   the transfer is over.
+*/
+
+#define GARMIN_STATS_BUCKETS  20
+#define GARMIN_STATS_PHASES   16
+
+
+typedef struct garmin_phase_stats {
+  appl_protocol             protocol;
+  uint32                    packets_read;
+  uint32                    packets_written;
+  uint32                    bytes_read;
+  uint32                    bytes_written;
+  uint32                    timeouts;    /* garmin_read calls that got nothing */
+  uint32                    errors;      /* reads and writes that failed */
+  uint32                    retries;     /* reads reissued by the read-ahead
+					    thread after a timeout */
+  float64                   read_wait;   /* time blocked in garmin_read */
+  float64                   write_wait;  /* time blocked in garmin_write */
+  float64                   unpack;      /* time spent unpacking records */
+  uint32                    read_latency[GARMIN_STATS_BUCKETS];
+  uint32                    write_latency[GARMIN_STATS_BUCKETS];
+} garmin_phase_stats;
+
+
+typedef struct garmin_stats {
+  int                       current;     /* phase being counted now */
+  int                       phases;      /* phases in use, besides 0 */
+  garmin_phase_stats        phase[GARMIN_STATS_PHASES];
+} garmin_stats;
+
+
+/* 
+   Called with each record as it is unpacked by garmin_get_stream.  The
+   callback owns the record, and returns 0 to ignore the rest.
+*/
+
+typedef int (*garmin_record_cb) ( garmin_data * data, void * context );
+
+
+typedef struct garmin_stream {
+  garmin_record_cb           callback;
+  void *                     context;
+  int                        stopped;
+} garmin_stream;
+
+
+/* 
+   The newest run saved from a unit, so that the next sync can skip the
+   runs saved before it (see garmin_get_new_runs).  Lap indices only go
+   up on a unit, so a run is new if its first lap comes after the last
+   lap of this one.  The start time of that last lap is kept to notice a
+   unit that has been reset and has started its indices over.
+*/
+
+typedef struct garmin_sync_state {
+  uint32                     id;             /* garmin->id of the unit    */
+  int                        valid;          /* 0 if nothing is known     */
+  uint32                     track;          /* the run's track index     */
+  uint32                     first_lap;      /* its first lap index       */
+  uint32                     last_lap;       /* its last lap index        */
+  time_type                  start_time;     /* start of its first lap    */
+  time_type                  last_lap_time;  /* start of its last lap     */
+} garmin_sync_state;
+
+
 typedef struct garmin_unit {
   uint32                     id;
   garmin_product             product;
@@ -1940,6 +2147,11 @@ typedef struct garmin_unit {
   garmin_protocols           protocol;
   garmin_datatypes           datatype;
   garmin_usb                 usb;
+  garmin_stream              stream;    /* set only by garmin_get_stream */
+  struct garmin_decoder *    decoder;   /* non-NULL while in garmin_get  */
+  struct garmin_sync *       sync;      /* set only by garmin_get_new_runs */
+  garmin_arena *             arena;     /* set only by garmin_get_arena  */
+  garmin_stats               stats;
   int                        verbose;   /* this may become a 'flags' field. */
 } garmin_unit;
 
@@ -1985,9 +2197,26 @@ garmin_pid  garmin_gpid ( link_protocol     link,
 /* ------------------------------------------------------------------------- */
 
 garmin_data * garmin_load          ( const char *     filename );
+garmin_data * garmin_load_arena    ( const char *     filename,
+				    garmin_arena *   arena );
+garmin_map *  garmin_map_file      ( const char *     filename,
+				    int              flags );
+void          garmin_unmap         ( garmin_map *     map );
+garmin_data * garmin_list_node_data ( garmin_list *      l,
+				      garmin_list_node * n );
+garmin_chunk_reader *
+              garmin_chunk_open    ( const char *     filename,
+				    int              flags );
+int           garmin_chunk_next    ( garmin_chunk_reader * r );
+garmin_data * garmin_chunk_data    ( garmin_chunk_reader * r );
+void          garmin_chunk_close   ( garmin_chunk_reader * r );
+garmin_data * garmin_unpack_packet_arena ( garmin_packet *   p,
+					  garmin_datatype   type,
+					  garmin_arena *    arena );
 garmin_data * garmin_unpack_packet ( garmin_packet *  p, 
 				     garmin_datatype  type );
 garmin_data * garmin_unpack        ( uint8 **         buf,
+				     uint8 *          end,
 				     garmin_datatype  type );
 
 
@@ -2000,6 +2229,25 @@ uint32 garmin_save ( garmin_data * data,
 		     const char *  dir );
 uint32 garmin_pack ( garmin_data * data, 
 		     uint8 **      buf );
+uint8 * garmin_pack_file ( garmin_data * data,
+			  uint32 *      bytes );
+
+
+/* ------------------------------------------------------------------------- */
+/* gmnz.c                                                                    */
+/* ------------------------------------------------------------------------- */
+
+int     garmin_is_gmnz     ( const uint8 * buf,
+			     uint32        bytes );
+uint8 * garmin_gmnz_encode ( const uint8 * gmn,
+			     uint32        bytes,
+			     uint32 *      out );
+uint32  garmin_gmnz_size   ( const uint8 * gmnz,
+			     uint32        bytes );
+int     garmin_gmnz_decode ( const uint8 * gmnz,
+			     uint32        bytes,
+			     uint8 *       gmn,
+			     uint32        size );
 
 
 /* ------------------------------------------------------------------------- */
@@ -2061,19 +2309,39 @@ garmin_data * garmin_read_via        ( garmin_unit *    garmin,
 				       appl_protocol    protocol );
 garmin_data * garmin_get             ( garmin_unit *    garmin, 
 				       garmin_get_type  what );
+garmin_data * garmin_get_arena       ( garmin_unit *    garmin,
+				       garmin_get_type  what,
+				       garmin_arena *   arena );
+int           garmin_get_stream      ( garmin_unit *    garmin,
+				       garmin_get_type  what,
+				       garmin_record_cb callback,
+				       void *           context );
+garmin_data * garmin_get_new_runs    ( garmin_unit *    garmin,
+				       garmin_sync_state * state );
 int           garmin_init            ( garmin_unit *    garmin,
 				       int              verbose );
+int           garmin_init_device     ( garmin_unit *    garmin,
+				       struct usb_device * device,
+				       int              verbose );
+int           garmin_init_replay     ( garmin_unit *    garmin,
+				       const char *     filename,
+				       int              latency,
+				       int              verbose );
 
 
 /* ------------------------------------------------------------------------- */
 /* usb_comm.c                                                                */
 /* ------------------------------------------------------------------------- */
 
+int     garmin_enumerate      ( struct usb_device ** devices, int max );
 int     garmin_open           ( garmin_unit * garmin );
 int     garmin_close          ( garmin_unit * garmin );
 uint32  garmin_start_session  ( garmin_unit * garmin );
 int     garmin_read           ( garmin_unit * garmin, garmin_packet * p );
 int     garmin_write          ( garmin_unit * garmin, garmin_packet * p );
+int     garmin_start_async    ( garmin_unit * garmin, int depth );
+void    garmin_stop_async     ( garmin_unit * garmin );
+int     garmin_capture        ( garmin_unit * garmin, const char * filename );
 uint8   garmin_packet_type    ( garmin_packet * p );
 uint16  garmin_packet_id      ( garmin_packet * p );
 uint32  garmin_packet_size    ( garmin_packet * p );
@@ -2088,6 +2356,38 @@ int     garmin_packetize      ( garmin_packet *  p,
 				uint8 *          data );
 
 
+/* ------------------------------------------------------------------------- */
+/* stats.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+void    garmin_stats_reset    ( garmin_unit *  garmin );
+int     garmin_stats_enter    ( garmin_unit *  garmin, 
+				appl_protocol  protocol );
+void    garmin_stats_leave    ( garmin_unit *  garmin, 
+				int            previous );
+garmin_phase_stats * garmin_stats_phase ( garmin_unit *  garmin, 
+					  appl_protocol  protocol );
+void    garmin_stats_total    ( garmin_unit *        garmin, 
+				garmin_phase_stats * total );
+float64 garmin_stats_clock    ( void );
+void    garmin_stats_latency  ( uint32 *       histogram, 
+				float64        seconds );
+void    garmin_print_stats    ( garmin_unit *  garmin, 
+				FILE *         fp, 
+				int            spaces );
+int     garmin_save_stats     ( garmin_unit *  garmin, 
+				const char *   filename );
+
+
+/* ------------------------------------------------------------------------- */
+/* replay.c                                                                  */
+/* ------------------------------------------------------------------------- */
+
+int     garmin_replay         ( garmin_unit *  garmin,
+				const char *   filename,
+				int            latency );
+
+
 /* ------------------------------------------------------------------------- */
 /* byte_util.c                                                               */
 /* ------------------------------------------------------------------------- */
@@ -2116,15 +2416,27 @@ char **  get_strings ( garmin_packet * p, int * offset );
 /* datatype.c                                                                */
 /* ------------------------------------------------------------------------- */
 
+garmin_arena * garmin_arena_new     ( void );
+void *        garmin_arena_alloc    ( garmin_arena * a, size_t size );
+void          garmin_arena_free     ( garmin_arena * a );
 garmin_data * garmin_alloc_data     ( garmin_datatype type );
+garmin_data * garmin_arena_alloc_data ( garmin_arena *  a,
+					garmin_datatype type );
 garmin_list * garmin_alloc_list     ( void );
+garmin_list * garmin_arena_alloc_list ( garmin_arena * a );
 garmin_list * garmin_list_append    ( garmin_list * list, 
 				      garmin_data * data );
 garmin_data * garmin_list_data      ( garmin_data * data, 
 				      uint32        which );
+garmin_list_node * garmin_list_node_at ( garmin_list * l, uint32 which );
+garmin_list * garmin_list_append_packed ( garmin_list *     list,
+					  garmin_datatype   type,
+					  uint8 *           packed,
+					  uint32            size );
 void          garmin_free_list      ( garmin_list * l );
 void          garmin_free_list_only ( garmin_list * l );
 void          garmin_free_data      ( garmin_data * d );
+void          garmin_free_data_borrowed ( garmin_data * d );
 uint32        garmin_data_size      ( garmin_data * d );
 
 
@@ -2135,6 +2447,50 @@ uint32        garmin_data_size      ( garmin_data * d );
 char * garmin_symbol_name ( symbol_value s );
 
 
+/* ------------------------------------------------------------------------- */
+/* track.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+garmin_track_columns * garmin_track_columns_new  ( garmin_data *   data );
+garmin_track_columns * garmin_track_columns_load ( const char *    filename );
+garmin_track_columns * garmin_track_columns_get  ( garmin_unit *   garmin,
+						   garmin_get_type what );
+void                   garmin_track_columns_free ( garmin_track_columns * c );
+
+
+/* ------------------------------------------------------------------------- */
+/* catalog.c                                                                 */
+/* ------------------------------------------------------------------------- */
+
+int              garmin_catalog_build ( const char *      dir,
+					const char *      filename );
+garmin_catalog * garmin_catalog_open  ( const char *      filename );
+int              garmin_catalog_entry_get ( garmin_catalog *       c,
+					    uint32                 i,
+					    garmin_catalog_entry * entry );
+uint32           garmin_catalog_find  ( garmin_catalog *  c,
+					time_type         from,
+					time_type         to,
+					position_type *   sw,
+					position_type *   ne,
+					garmin_catalog_cb callback,
+					void *            context );
+void             garmin_catalog_close ( garmin_catalog *  c );
+
+
+/* ------------------------------------------------------------------------- */
+/* sync.c                                                                    */
+/* ------------------------------------------------------------------------- */
+
+int           garmin_load_sync_state ( const char *        dir,
+				       uint32              id,
+				       garmin_sync_state * state );
+int           garmin_save_sync_state ( const char *        dir,
+				       garmin_sync_state * state );
+int           garmin_run_is_new      ( garmin_sync_state * state,
+				       garmin_data *       run );
+
+
 /* ------------------------------------------------------------------------- */
 /* run.c                                                                     */
 /* ------------------------------------------------------------------------- */
@@ -2147,6 +2503,7 @@ int           get_run_track_lap_info ( garmin_data * run,
                                        uint32      * last_lap_index );
 
 void          garmin_save_runs       ( garmin_unit * garmin );
+void          garmin_save_new_runs   ( garmin_unit * garmin );
 
 
 #ifdef __cplusplus
@@ -0,0 +1,562 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+   Benchmark for loading, saving and converting run files.  For each size
+   (in track points) it generates a synthetic run like the ones
+   garmin_save_runs writes (a D1009 run, its D1015 laps, and a D311 track
+   of D304 points), then times
+
+     save, save_gmnz   garmin_save to a .gmn and a .gmnz file
+     load, load_gmnz   garmin_load of those files
+     free              garmin_free_data of what garmin_load returned
+     print             garmin_print_data to /dev/null
+     gpx, gmap, gchart the conversion programs, run on the .gmn file
+
+   taking the best of several rounds of each.  Throughput is reported in
+   points and in .gmn bytes per second.  Peak RSS is that of this process
+   so far for the library calls, and that of the program for conversions.
+   With -o, the results are also written to a file as JSON.
+
+   The conversion programs are looked for next to garmin_bench (or in the
+   directory given with -p), and skipped if they aren't found.  Not
+   installed; build it with 'make garmin_bench'.
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "garmin.h"
+
+
+#define BENCH_ROUNDS      3
+#define BENCH_MAX_SIZES   16
+#define BENCH_MAX_RESULTS (BENCH_MAX_SIZES * 16)
+#define POINTS_PER_LAP    1000   /* about 3 km at the pace below */
+#define START_TIME        600000000
+
+
+typedef struct bench_result {
+  const char *   op;
+  uint32         points;
+  uint32         bytes;      /* size of the .gmn file */
+  double         seconds;    /* best of the rounds */
+  long           peak_rss;   /* kilobytes */
+} bench_result;
+
+
+typedef struct bench {
+  int            rounds;
+  const char *   dir;
+  const char *   tools;      /* NULL: look for the programs in $PATH */
+  bench_result   results[BENCH_MAX_RESULTS];
+  int            count;
+} bench;
+
+
+static double
+now ( void )
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+
+static long
+peak_rss ( void )
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF,&ru);
+
+  return ru.ru_maxrss;
+}
+
+
+/* A small generator of our own, so the corpus is the same everywhere. */
+
+static uint32
+bench_random ( uint32 * seed )
+{
+  *seed = *seed * 1103515245 + 12345;
+
+  return (*seed >> 16) & 0x7fff;
+}
+
+
+/*
+   Generate a run of 'points' track points, one a second at about 3 m/s,
+   wandering around with a lap every POINTS_PER_LAP points.  Now and then
+   a point has no position, as when the unit loses its fix.
+*/
+
+static garmin_data *
+bench_generate ( uint32 points )
+{
+  garmin_data *  run;
+  garmin_data *  laps;
+  garmin_data *  track;
+  garmin_data *  data;
+  D1009 *        d1009;
+  D1015 *        lap    = NULL;
+  D304 *         d304;
+  uint32         seed   = points;
+  uint32         nlaps  = (points + POINTS_PER_LAP - 1) / POINTS_PER_LAP;
+  sint32         lat    = 470000000;
+  sint32         lon    = -1450000000;
+  sint32         dlat   = 0;
+  sint32         dlon   = 0;
+  float32        dist   = 0;
+  float32        alt    = 1800;
+  uint32         hr_sum = 0;
+  uint32         n      = 0;
+  uint32         i;
+
+  if ( nlaps == 0 ) nlaps = 1;
+
+  run   = garmin_alloc_data(data_Dlist);
+  laps  = garmin_alloc_data(data_Dlist);
+  track = garmin_alloc_data(data_Dlist);
+
+  data  = garmin_alloc_data(data_D1009);
+  d1009 = data->data;
+  d1009->track_index     = 0;
+  d1009->first_lap_index = 0;
+  d1009->last_lap_index  = nlaps - 1;
+  d1009->sport_type      = D1000_running;
+  garmin_list_append(run->data,data);
+
+  data = garmin_alloc_data(data_D311);
+  ((D311 *)data->data)->index = 0;
+  garmin_list_append(track->data,data);
+
+  for ( i = 0; i < points; i++ ) {
+
+    /* A new lap, heading off in a new direction. */
+
+    if ( i % POINTS_PER_LAP == 0 ) {
+      hr_sum = 0;
+      n      = 0;
+      data = garmin_alloc_data(data_D1015);
+      lap  = data->data;
+      lap->index          = i / POINTS_PER_LAP;
+      lap->start_time     = START_TIME + i;
+      lap->begin.lat      = lat;
+      lap->begin.lon      = lon;
+      lap->max_heart_rate = 0;
+      lap->intensity      = D1001_active;
+      lap->avg_cadence    = 0xff;
+      lap->trigger_method = D1011_distance;
+      garmin_list_append(laps->data,data);
+      dlat = (sint32)bench_random(&seed) % 700 - 350;
+      dlon = (sint32)bench_random(&seed) % 700 - 350;
+    }
+
+    lat  += dlat + (sint32)bench_random(&seed) % 41 - 20;
+    lon  += dlon + (sint32)bench_random(&seed) % 41 - 20;
+    alt  += ((int)(bench_random(&seed) % 9) - 4) * 0.25;
+    dist += 2.5 + (bench_random(&seed) % 100) * 0.01;
+
+    data = garmin_alloc_data(data_D304);
+    d304 = data->data;
+    d304->time       = START_TIME + i;
+    d304->alt        = alt;
+    d304->distance   = dist;
+    d304->heart_rate = 140 + bench_random(&seed) % 30;
+    d304->cadence    = 0xff;
+    d304->sensor     = 0;
+    if ( bench_random(&seed) % 500 == 0 ) {
+      d304->posn.lat = 0x7fffffff;
+      d304->posn.lon = 0x7fffffff;
+    } else {
+      d304->posn.lat = lat;
+      d304->posn.lon = lon;
+    }
+    garmin_list_append(track->data,data);
+
+    hr_sum += d304->heart_rate;
+    lap->avg_heart_rate = hr_sum / ++n;
+    if ( d304->heart_rate > lap->max_heart_rate ) {
+      lap->max_heart_rate = d304->heart_rate;
+    }
+    lap->total_time += 100;
+    lap->total_dist += 3.0;
+    lap->max_speed   = 3.5;
+    lap->calories   += (i % 10 == 0);
+    lap->end.lat     = lat;
+    lap->end.lon     = lon;
+  }
+
+  garmin_list_append(run->data,laps);
+  garmin_list_append(run->data,track);
+
+  return run;
+}
+
+
+static void
+bench_report ( bench *       b,
+	       const char *  op,
+	       uint32        points,
+	       uint32        bytes,
+	       double        seconds,
+	       long          rss )
+{
+  bench_result * r;
+
+  if ( b->count == BENCH_MAX_RESULTS ) return;
+
+  r = &b->results[b->count++];
+  r->op       = op;
+  r->points   = points;
+  r->bytes    = bytes;
+  r->seconds  = seconds;
+  r->peak_rss = rss;
+
+  printf("%-10s %9u %10.4f %14.0f %14.0f %10ld\n",op,points,seconds,
+	 (seconds > 0) ? points / seconds : 0,
+	 (seconds > 0) ? bytes / seconds : 0,
+	 rss);
+  fflush(stdout);
+}
+
+
+/* Time garmin_save, starting from scratch each round.  Returns the size. */
+
+static uint32
+bench_save ( bench *        b,
+	     const char *   op,
+	     garmin_data *  data,
+	     uint32         points,
+	     const char *   name,
+	     const char *   path,
+	     uint32         bytes )
+{
+  double  best = 0;
+  double  t;
+  uint32  size = 0;
+  int     r;
+
+  for ( r = 0; r < b->rounds; r++ ) {
+    unlink(path);
+    t    = now();
+    size = garmin_save(data,name,b->dir);
+    t    = now() - t;
+    if ( r == 0 || t < best ) best = t;
+  }
+
+  bench_report(b,op,points,(bytes) ? bytes : size,best,peak_rss());
+
+  return size;
+}
+
+
+static void
+bench_load ( bench *       b,
+	     const char *  op,
+	     const char *  path,
+	     uint32        points,
+	     uint32        bytes,
+	     int           report_free )
+{
+  garmin_data * data;
+  double        load  = 0;
+  double        drop  = 0;
+  double        t;
+  long          rss   = 0;
+  int           r;
+
+  for ( r = 0; r < b->rounds; r++ ) {
+    t    = now();
+    data = garmin_load(path);
+    t    = now() - t;
+    if ( r == 0 || t < load ) load = t;
+    rss  = peak_rss();
+    t    = now();
+    garmin_free_data(data);
+    t    = now() - t;
+    if ( r == 0 || t < drop ) drop = t;
+  }
+
+  bench_report(b,op,points,bytes,load,rss);
+  if ( report_free ) bench_report(b,"free",points,bytes,drop,peak_rss());
+}
+
+
+static void
+bench_print ( bench * b, garmin_data * data, uint32 points, uint32 bytes )
+{
+  FILE *  fp;
+  double  best = 0;
+  double  t;
+  int     r;
+
+  if ( (fp = fopen("/dev/null","w")) == NULL ) return;
+
+  for ( r = 0; r < b->rounds; r++ ) {
+    t = now();
+    garmin_print_data(data,fp,0);
+    fflush(fp);
+    t = now() - t;
+    if ( r == 0 || t < best ) best = t;
+  }
+
+  fclose(fp);
+
+  bench_report(b,"print",points,bytes,best,peak_rss());
+}
+
+
+/*
+   Time one of the conversion programs on a file, with its output thrown
+   away.  The peak RSS is the program's own.
+*/
+
+static void
+bench_tool ( bench *       b,
+	     const char *  op,
+	     const char *  tool,
+	     const char *  path,
+	     uint32        points,
+	     uint32        bytes )
+{
+  char           prog[PATH_MAX];
+  struct rusage  ru;
+  double         best = 0;
+  double         t;
+  long           rss  = 0;
+  pid_t          pid;
+  int            status;
+  int            fd;
+  int            r;
+
+  if ( b->tools != NULL ) {
+    snprintf(prog,sizeof(prog),"%s/%s",b->tools,tool);
+  } else {
+    snprintf(prog,sizeof(prog),"%s",tool);
+  }
+
+  for ( r = 0; r < b->rounds; r++ ) {
+    t = now();
+    if ( (pid = fork()) == 0 ) {
+      if ( (fd = open("/dev/null",O_WRONLY)) != -1 ) dup2(fd,1);
+      execlp(prog,prog,path,(char *)NULL);
+      _exit(127);
+    } else if ( pid == -1 || wait4(pid,&status,0,&ru) == -1 ) {
+      printf("%s: %s\n",prog,strerror(errno));
+      return;
+    }
+    t = now() - t;
+    if ( !WIFEXITED(status) || WEXITSTATUS(status) == 127 ) {
+      printf("%-10s skipped (%s could not be run)\n",tool,prog);
+      return;
+    }
+    if ( r == 0 || t < best ) best = t;
+    if ( ru.ru_maxrss > rss ) rss = ru.ru_maxrss;
+  }
+
+  bench_report(b,op,points,bytes,best,rss);
+}
+
+
+static void
+bench_size ( bench * b, uint32 points )
+{
+  garmin_data * data;
+  char          name[64];
+  char          zname[64];
+  char          path[PATH_MAX];
+  char          zpath[PATH_MAX];
+  uint32        bytes;
+
+  snprintf(name,sizeof(name),"bench-%u.gmn",points);
+  snprintf(zname,sizeof(zname),"bench-%u.gmnz",points);
+  snprintf(path,sizeof(path),"%s/%s",b->dir,name);
+  snprintf(zpath,sizeof(zpath),"%s/%s",b->dir,zname);
+
+  data  = bench_generate(points);
+
+  bytes = bench_save(b,"save",data,points,name,path,0);
+  bench_save(b,"save_gmnz",data,points,zname,zpath,bytes);
+  bench_print(b,data,points,bytes);
+  garmin_free_data(data);
+
+  bench_load(b,"load",path,points,bytes,1);
+  bench_load(b,"load_gmnz",zpath,points,bytes,0);
+
+  bench_tool(b,"gpx","garmin_gpx",path,points,bytes);
+  bench_tool(b,"gmap","garmin_gmap",path,points,bytes);
+  bench_tool(b,"gchart","garmin_gchart",path,points,bytes);
+
+  unlink(path);
+  unlink(zpath);
+}
+
+
+static int
+bench_write_json ( bench * b, const char * filename )
+{
+  FILE *          fp;
+  bench_result *  r;
+  int             i;
+
+  if ( (fp = fopen(filename,"w")) == NULL ) {
+    printf("%s: %s\n",filename,strerror(errno));
+    return 0;
+  }
+
+  fprintf(fp,"{\n");
+  fprintf(fp,"  \"package\": \"%s\",\n",PACKAGE_STRING);
+  fprintf(fp,"  \"time\": %ld,\n",(long)time(NULL));
+  fprintf(fp,"  \"rounds\": %d,\n",b->rounds);
+  fprintf(fp,"  \"results\": [\n");
+  for ( i = 0; i < b->count; i++ ) {
+    r = &b->results[i];
+    fprintf(fp,"    { \"op\": \"%s\", \"points\": %u, \"bytes\": %u, "
+	    "\"seconds\": %.6f, \"points_per_sec\": %.0f, "
+	    "\"bytes_per_sec\": %.0f, \"peak_rss_kb\": %ld }%s\n",
+	    r->op,r->points,r->bytes,r->seconds,
+	    (r->seconds > 0) ? r->points / r->seconds : 0,
+	    (r->seconds > 0) ? r->bytes / r->seconds : 0,
+	    r->peak_rss,
+	    (i + 1 < b->count) ? "," : "");
+  }
+  fprintf(fp,"  ]\n");
+  fprintf(fp,"}\n");
+
+  return (fclose(fp) == 0);
+}
+
+
+static void
+usage ( const char * name )
+{
+  printf("usage: %s [-r rounds] [-o results.json] [-d dir] [-p tooldir] "
+	 "[points ...]\n\n",name);
+  printf("  Times loading, saving and converting synthetic run files of\n"
+	 "  each size (default: 1000 10000 100000 1000000 points).\n\n");
+  printf("  -r  rounds of each operation; the best is reported (default %d)\n",
+	 BENCH_ROUNDS);
+  printf("  -o  also write the results to this file, as JSON\n");
+  printf("  -d  where to write the run files (default: a directory in /tmp)\n");
+  printf("  -p  where the conversion programs are (default: next to %s)\n",
+	 name);
+}
+
+
+int
+main ( int argc, char ** argv )
+{
+  static uint32 defaults[] = { 1000, 10000, 100000, 1000000 };
+
+  bench *       b;
+  uint32        sizes[BENCH_MAX_SIZES];
+  int           nsizes = 0;
+  char *        output = NULL;
+  char          tools[PATH_MAX];
+  char          tmp[PATH_MAX];
+  char *        slash;
+  int           made   = 0;
+  int           ok     = 1;
+  int           c;
+  int           i;
+
+  if ( (b = calloc(1,sizeof(bench))) == NULL ) return 1;
+  b->rounds = BENCH_ROUNDS;
+
+  while ( (c = getopt(argc,argv,"r:o:d:p:")) != -1 ) {
+    switch ( c ) {
+    case 'r':
+      b->rounds = atoi(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'd':
+      b->dir = optarg;
+      break;
+    case 'p':
+      b->tools = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  for ( i = optind; i < argc && nsizes < BENCH_MAX_SIZES; i++ ) {
+    if ( (sizes[nsizes++] = strtoul(argv[i],NULL,10)) == 0 ) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if ( nsizes == 0 ) {
+    for ( ; nsizes < 4; nsizes++ ) sizes[nsizes] = defaults[nsizes];
+  }
+  if ( b->rounds <= 0 ) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* The conversion programs are built alongside this one. */
+
+  if ( b->tools == NULL && (slash = strrchr(argv[0],'/')) != NULL ) {
+    snprintf(tools,sizeof(tools),"%.*s",(int)(slash - argv[0]),argv[0]);
+    b->tools = tools;
+  }
+
+  if ( b->dir == NULL ) {
+    snprintf(tmp,sizeof(tmp),"%s/garmin_bench.XXXXXX",
+	     (getenv("TMPDIR") != NULL) ? getenv("TMPDIR") : "/tmp");
+    if ( mkdtemp(tmp) == NULL ) {
+      printf("%s: %s: %s\n",argv[0],tmp,strerror(errno));
+      return 1;
+    }
+    b->dir = tmp;
+    made   = 1;
+  }
+
+  printf("%-10s %9s %10s %14s %14s %10s\n",
+	 "op","points","seconds","points/s","bytes/s","rss (kB)");
+
+  for ( i = 0; i < nsizes; i++ ) {
+    bench_size(b,sizes[i]);
+  }
+
+  if ( made ) rmdir(b->dir);
+
+  if ( output != NULL ) ok = bench_write_json(b,output);
+
+  free(b);
+
+  return !ok;
+}
@@ -79,7 +79,8 @@ gchart_e_encode ( float32 num, float32 max, char * str )
   num = 4095*num/max;
   /* printf(" %f\n", num); */
   if (num < 0 || num > 4095 ) {
-    str = "__";
+    strcpy(str,"__");
+    return;
   }
   str[0]=gchart_e_encode_single((int)num/64);
   str[1]=gchart_e_encode_single(num - ((int)(num/64)*64) );
@@ -19,22 +19,38 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <unistd.h>
 #include "garmin.h"
 
 
 int
 main ( int argc, char ** argv )
 {
-  garmin_unit   garmin;
-  int           verbose;
+  garmin_unit garmin;
+  int         verbose = 0;
+  char *      stats   = NULL;
+  int         c;
 
-  /* Set the verbosity if the -v option was provided. */
+  /* -v sets the verbosity; -s writes transfer statistics to a file. */
 
-  verbose = (getopt(argc,argv,"v") != -1);
+  while ( (c = getopt(argc,argv,"vs:")) != -1 ) {
+    switch ( c ) {
+    case 'v':
+      verbose = 1;
+      break;
+    case 's':
+      stats = optarg;
+      break;
+    default:
+      printf("usage: %s [-v] [-s stats.json]\n",argv[0]);
+      return 1;
+    }
+  }
 
   if ( garmin_init(&garmin,verbose) != 0 ) {
     /* Now print the info. */
     garmin_print_info(&garmin,stdout,0);
+    if ( stats != NULL ) garmin_save_stats(&garmin,stats);
   } else {
     printf("garmin unit could not be opened!\n");
   }
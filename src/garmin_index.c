@@ -0,0 +1,214 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "garmin.h"
+
+
+#define CATALOG_NAME  "catalog.gmc"
+
+
+static void
+usage ( const char * name )
+{
+  printf("usage: %s [-u] [-c catalog] [-f from] [-t to] "
+	 "[-b south,west,north,east] [dir]\n\n",name);
+  printf("  Lists the runs saved under dir (default: $GARMIN_SAVE_RUNS, or\n"
+	 "  the current directory), using the catalog in dir/%s.\n\n",
+	 CATALOG_NAME);
+  printf("  -u  update the catalog first (it is built if it is missing)\n");
+  printf("  -c  use this catalog file instead\n");
+  printf("  -f  only runs that started at or after this local time\n");
+  printf("  -t  only runs that started at or before this local time\n");
+  printf("      (times are YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS)\n");
+  printf("  -b  only runs whose track overlaps this box (degrees)\n");
+}
+
+
+/* 
+   Parse a local time into a Garmin time.  A date alone means its start
+   (or its end, if 'end_of_day' is set).  Anything after the date or the
+   time makes it invalid.
+*/
+
+static int
+parse_time ( const char * s, int end_of_day, time_type * t )
+{
+  struct tm tm;
+  time_t    u;
+  int       n;
+  int       date = -1;
+  int       hms  = -1;
+
+  memset(&tm,0,sizeof(tm));
+  n = sscanf(s,"%d-%d-%d%n",&tm.tm_year,&tm.tm_mon,&tm.tm_mday,&date);
+  if ( n != 3 || date < 0 ) return 0;
+  if ( s[date] != '\0' ) {
+    n = sscanf(s+date,"T%d:%d:%d%n",&tm.tm_hour,&tm.tm_min,&tm.tm_sec,&hms);
+    if ( n != 3 || hms < 0 || s[date+hms] != '\0' ) return 0;
+  } else if ( end_of_day ) {
+    tm.tm_hour = 23;
+    tm.tm_min  = 59;
+    tm.tm_sec  = 59;
+  }
+  tm.tm_year  -= 1900;
+  tm.tm_mon   -= 1;
+  tm.tm_isdst  = -1;
+
+  if ( (u = mktime(&tm)) == (time_t)-1 || u < TIME_OFFSET ) return 0;
+  *t = u - TIME_OFFSET;
+
+  return 1;
+}
+
+
+static int
+parse_box ( const char * s, position_type * sw, position_type * ne )
+{
+  double south;
+  double west;
+  double north;
+  double east;
+
+  if ( sscanf(s,"%lf,%lf,%lf,%lf",&south,&west,&north,&east) != 4 ) return 0;
+
+  sw->lat = DEG2SEMI(south);
+  sw->lon = DEG2SEMI(west);
+  ne->lat = DEG2SEMI(north);
+  ne->lon = DEG2SEMI(east);
+
+  return 1;
+}
+
+
+static int
+print_entry ( const garmin_catalog_entry * e, void * context )
+{
+  static const char * sports[] = { "running", "biking", "other" };
+
+  time_t     t = e->start_time + TIME_OFFSET;
+  struct tm  tm;
+  char       when[32];
+  uint32     secs = e->duration / 100;
+
+  localtime_r(&t,&tm);
+  strftime(when,sizeof(when),"%Y-%m-%d %H:%M:%S",&tm);
+
+  printf("%s  %-7s %3d lap%s %8.2f km %4d:%02d:%02d  %s\n",
+	 when,
+	 (e->sport_type < 3) ? sports[e->sport_type] : "unknown",
+	 e->laps,(e->laps == 1) ? " " : "s",
+	 e->distance / 1000.0,
+	 secs / 3600,(secs / 60) % 60,secs % 60,
+	 e->path);
+
+  return 1;
+}
+
+
+int
+main ( int argc, char ** argv )
+{
+  garmin_catalog * catalog;
+  position_type    sw;
+  position_type    ne;
+  position_type *  box     = NULL;
+  time_type        from    = 0;
+  time_type        to      = 0xffffffff;
+  char *           dir     = NULL;
+  char *           file    = NULL;
+  char             path[PATH_MAX];
+  char             cfile[PATH_MAX];
+  struct stat      sb;
+  int              update  = 0;
+  int              query   = 0;
+  int              c;
+
+  while ( (c = getopt(argc,argv,"uc:f:t:b:")) != -1 ) {
+    switch ( c ) {
+    case 'u':
+      update = 1;
+      break;
+    case 'c':
+      file = optarg;
+      break;
+    case 'f':
+      if ( !parse_time(optarg,0,&from) ) {
+	printf("%s: bad time '%s'\n",argv[0],optarg);
+	return 1;
+      }
+      query = 1;
+      break;
+    case 't':
+      if ( !parse_time(optarg,1,&to) ) {
+	printf("%s: bad time '%s'\n",argv[0],optarg);
+	return 1;
+      }
+      query = 1;
+      break;
+    case 'b':
+      if ( !parse_box(optarg,&sw,&ne) ) {
+	printf("%s: bad box '%s'\n",argv[0],optarg);
+	return 1;
+      }
+      box   = &sw;
+      query = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if ( optind < argc ) {
+    dir = argv[optind];
+  } else if ( (dir = getenv("GARMIN_SAVE_RUNS")) == NULL ) {
+    dir = getcwd(path,sizeof(path));
+  }
+
+  if ( file == NULL ) {
+    snprintf(cfile,sizeof(cfile),"%s/%s",dir,CATALOG_NAME);
+    file = cfile;
+  }
+
+  if ( update || stat(file,&sb) == -1 ) {
+    if ( !garmin_catalog_build(dir,file) ) return 1;
+  }
+
+  if ( (catalog = garmin_catalog_open(file)) == NULL ) return 1;
+
+  if ( update && !query ) {
+    printf("%s: %d run%s\n",file,catalog->entries,
+	   (catalog->entries == 1) ? "" : "s");
+  } else {
+    garmin_catalog_find(catalog,from,to,box,box ? &ne : NULL,print_entry,NULL);
+  }
+
+  garmin_catalog_close(catalog);
+
+  return 0;
+}
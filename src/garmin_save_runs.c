@@ -27,15 +27,43 @@ int
 main ( int argc, char ** argv )
 {
   garmin_unit garmin;
-  int         verbose;
+  int         verbose     = 0;
+  int         incremental = 0;
+  char *      stats       = NULL;
+  int         c;
 
-  /* Set the verbosity if the -v option was provided. */
+  /* 
+     -v sets the verbosity; -n saves only the runs that are new since the
+     last time; -s writes transfer statistics to a file.
+  */
 
-  verbose = (getopt(argc,argv,"v") != -1);
+  while ( (c = getopt(argc,argv,"vns:")) != -1 ) {
+    switch ( c ) {
+    case 'v':
+      verbose = 1;
+      break;
+    case 'n':
+      incremental = 1;
+      break;
+    case 's':
+      stats = optarg;
+      break;
+    default:
+      printf("usage: %s [-v] [-n] [-s stats.json]\n",argv[0]);
+      return 1;
+    }
+  }
 
   if ( garmin_init(&garmin,verbose) != 0 ) {
-    /* Read and save the runs. */
-    garmin_save_runs(&garmin);
+    /* Read ahead while we unpack, then read and save the runs. */
+    garmin_start_async(&garmin,0);
+    if ( incremental ) {
+      garmin_save_new_runs(&garmin);
+    } else {
+      garmin_save_runs(&garmin);
+    }
+    garmin_close(&garmin);
+    if ( stats != NULL ) garmin_save_stats(&garmin,stats);
   } else {
     printf("garmin unit could not be opened!\n");
   }
@@ -0,0 +1,168 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "garmin.h"
+
+
+#define MAX_UNITS  64
+
+
+/* One worker per attached Garmin unit. */
+
+typedef struct sync_worker {
+  pthread_t            thread;
+  struct usb_device *  device;
+  int                  verbose;
+  int                  incremental;   /* only the runs not saved before */
+  int                  started;
+  int                  opened;
+  garmin_unit          garmin;    /* kept for the statistics */
+} sync_worker;
+
+
+static void *
+sync_unit ( void * arg )
+{
+  sync_worker * w      = arg;
+  garmin_unit * garmin = &w->garmin;
+
+  if ( garmin_init_device(garmin,w->device,w->verbose) != 0 ) {
+    /* Read ahead while we unpack, then read and save the runs. */
+    garmin_start_async(garmin,0);
+    if ( w->incremental ) {
+      garmin_save_new_runs(garmin);
+    } else {
+      garmin_save_runs(garmin);
+    }
+    garmin_close(garmin);
+    w->opened = 1;
+    if ( garmin->usb.error != 0 ) {
+      /* Only this unit's transfer failed; the others carry on. */
+      printf("garmin unit on %s/%s failed: %s\n",
+	     w->device->bus->dirname,w->device->filename,
+	     strerror(-garmin->usb.error));
+    }
+  } else {
+    printf("garmin unit on %s/%s could not be opened!\n",
+	   w->device->bus->dirname,w->device->filename);
+  }
+
+  return NULL;
+}
+
+
+/* Write the statistics of every unit synced as a JSON array. */
+
+static void
+write_stats ( sync_worker * workers, int units, const char * filename )
+{
+  FILE * fp    = stdout;
+  int    first = 1;
+  int    i;
+
+  if ( strcmp(filename,"-") != 0 && (fp = fopen(filename,"w")) == NULL ) {
+    printf("%s: %s\n",filename,strerror(errno));
+    return;
+  }
+
+  fprintf(fp,"[\n");
+  for ( i = 0; i < units; i++ ) {
+    if ( workers[i].opened == 0 ) continue;
+    if ( !first ) fprintf(fp,",\n");
+    garmin_print_stats(&workers[i].garmin,fp,2);
+    first = 0;
+  }
+  fprintf(fp,"]\n");
+
+  if ( fp != stdout ) fclose(fp);
+}
+
+
+int
+main ( int argc, char ** argv )
+{
+  struct usb_device *  devices[MAX_UNITS];
+  static sync_worker   workers[MAX_UNITS];
+  int                  verbose     = 0;
+  int                  incremental = 0;
+  char *               stats       = NULL;
+  int                  units;
+  int                  i;
+  int                  c;
+
+  /* 
+     -v sets the verbosity; -n saves only the runs that are new since the
+     last time; -s writes transfer statistics to a file.
+  */
+
+  while ( (c = getopt(argc,argv,"vns:")) != -1 ) {
+    switch ( c ) {
+    case 'v':
+      verbose = 1;
+      break;
+    case 'n':
+      incremental = 1;
+      break;
+    case 's':
+      stats = optarg;
+      break;
+    default:
+      printf("usage: %s [-v] [-n] [-s stats.json]\n",argv[0]);
+      return 1;
+    }
+  }
+
+  /* Find every attached unit, then sync them all at once. */
+
+  if ( (units = garmin_enumerate(devices,MAX_UNITS)) == 0 ) {
+    printf("No garmin units found!\n");
+    return 0;
+  }
+
+  printf("Found %d garmin unit%s\n",units,(units == 1) ? "" : "s");
+
+  memset(workers,0,sizeof(workers));
+  for ( i = 0; i < units; i++ ) {
+    workers[i].device      = devices[i];
+    workers[i].verbose     = verbose;
+    workers[i].incremental = incremental;
+    if ( pthread_create(&workers[i].thread,NULL,sync_unit,&workers[i]) == 0 ) {
+      workers[i].started = 1;
+    } else {
+      /* Couldn't start a thread; do this one ourselves. */
+      sync_unit(&workers[i]);
+    }
+  }
+
+  for ( i = 0; i < units; i++ ) {
+    if ( workers[i].started != 0 ) {
+      pthread_join(workers[i].thread,NULL);
+    }
+  }
+
+  if ( stats != NULL ) write_stats(workers,units,stats);
+
+  return 0;
+}
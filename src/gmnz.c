@@ -0,0 +1,519 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "garmin.h"
+#include "byte_util.h"
+
+
+/*
+   The compact .gmnz format.  A .gmnz file is a re-encoding of the bytes
+   of a .gmn file, and decodes back to exactly those bytes, so it holds
+   the same garmin_data and is unpacked by the same code.
+
+   It starts with a header laid out like a .gmn chunk header:
+
+     GARMIN_Z_MAGIC (12 bytes), GARMIN_VERSION, size of the .gmn bytes
+
+   followed by blocks, each starting with a tag byte:
+
+     GMNZ_LITERAL   varint n, then n bytes copied as they are
+     GMNZ_D304_RUN  varint list ID, varint n, then the columns of n
+		    consecutive D304 list elements of that list
+
+   Track points are almost all of a run file, and neighbouring points
+   differ very little.  In a D304 run, the latitude, longitude, time,
+   altitude and distance are each stored as a column of differences from
+   the previous point, zigzag encoded so that small negative differences
+   stay small, as varints (7 bits per byte, low bits first).  Altitude
+   and distance are floats and are differenced as their bit patterns,
+   so nothing is lost.  Heart rate, cadence and sensor are each stored
+   as a column of (varint count, byte) runs.
+*/
+
+#define GMNZ_LITERAL    0
+#define GMNZ_D304_RUN   1
+
+#define D304_PACKED     23             /* packed size of a D304 */
+#define ELEMENT_HEADER  12             /* { list ID, datatype, bytes } */
+#define D304_ELEMENT    (ELEMENT_HEADER + D304_PACKED)
+
+
+/* A growing output buffer, and the start of the bytes not yet encoded. */
+
+typedef struct gmnz_encoder {
+  uint8 *        buf;
+  uint32         pos;
+  uint32         size;
+  int            error;
+  const uint8 *  literal;
+} gmnz_encoder;
+
+
+static uint8 *
+gmnz_reserve ( gmnz_encoder * z, uint32 bytes )
+{
+  uint8 * buf;
+  uint32  size;
+
+  if ( z->error ) return NULL;
+
+  if ( z->pos + bytes > z->size ) {
+    size = 2 * z->size;
+    if ( size < z->pos + bytes ) size = z->pos + bytes;
+    if ( size < 4096 )           size = 4096;
+    if ( (buf = realloc(z->buf,size)) == NULL ) {
+      z->error = 1;
+      return NULL;
+    }
+    z->buf  = buf;
+    z->size = size;
+  }
+
+  return z->buf + z->pos;
+}
+
+
+static void
+gmnz_put_varint ( gmnz_encoder * z, uint32 v )
+{
+  uint8 * p;
+
+  if ( (p = gmnz_reserve(z,5)) != NULL ) {
+    while ( v >= 0x80 ) {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+    *p++   = v;
+    z->pos = p - z->buf;
+  }
+}
+
+
+static void
+gmnz_put_bytes ( gmnz_encoder * z, const uint8 * b, uint32 bytes )
+{
+  uint8 * p;
+
+  if ( (p = gmnz_reserve(z,bytes)) != NULL ) {
+    memcpy(p,b,bytes);
+    z->pos += bytes;
+  }
+}
+
+
+static void
+gmnz_put_tag ( gmnz_encoder * z, uint8 tag )
+{
+  gmnz_put_bytes(z,&tag,1);
+}
+
+
+/* Write out everything between the last block and 'upto' as a literal. */
+
+static void
+gmnz_flush_literal ( gmnz_encoder * z, const uint8 * upto )
+{
+  if ( upto > z->literal ) {
+    gmnz_put_tag(z,GMNZ_LITERAL);
+    gmnz_put_varint(z,upto - z->literal);
+    gmnz_put_bytes(z,z->literal,upto - z->literal);
+  }
+  z->literal = upto;
+}
+
+
+static uint32
+gmnz_zigzag ( uint32 delta )
+{
+  return (delta << 1) ^ (uint32)((sint32)delta >> 31);
+}
+
+
+static uint32
+gmnz_unzigzag ( uint32 v )
+{
+  return (v >> 1) ^ (0 - (v & 1));
+}
+
+
+/* One column of 32-bit values at 'offset' in each of 'n' D304 elements. */
+
+static void
+gmnz_put_delta_column ( gmnz_encoder * z,
+			const uint8 *  run,
+			uint32         n,
+			int            offset )
+{
+  const uint8 * p    = run + ELEMENT_HEADER + offset;
+  uint32        prev = 0;
+  uint32        v;
+  uint32        i;
+
+  for ( i = 0; i < n; i++, p += D304_ELEMENT ) {
+    v = get_uint32(p);
+    gmnz_put_varint(z,gmnz_zigzag(v - prev));
+    prev = v;
+  }
+}
+
+
+/* One column of bytes at 'offset' in each of 'n' D304 elements. */
+
+static void
+gmnz_put_rle_column ( gmnz_encoder * z,
+		      const uint8 *  run,
+		      uint32         n,
+		      int            offset )
+{
+  const uint8 * p = run + ELEMENT_HEADER + offset;
+  uint8         b;
+  uint32        i;
+  uint32        j;
+
+  for ( i = 0; i < n; i = j ) {
+    b = p[i * D304_ELEMENT];
+    for ( j = i + 1; j < n && p[j * D304_ELEMENT] == b; j++ );
+    gmnz_put_varint(z,j - i);
+    gmnz_put_bytes(z,&b,1);
+  }
+}
+
+
+static void
+gmnz_put_d304_run ( gmnz_encoder * z, const uint8 * run, uint32 n )
+{
+  gmnz_flush_literal(z,run);
+  gmnz_put_tag(z,GMNZ_D304_RUN);
+  gmnz_put_varint(z,get_uint32(run));
+  gmnz_put_varint(z,n);
+  gmnz_put_delta_column(z,run,n,0);   /* posn.lat   */
+  gmnz_put_delta_column(z,run,n,4);   /* posn.lon   */
+  gmnz_put_delta_column(z,run,n,8);   /* time       */
+  gmnz_put_delta_column(z,run,n,12);  /* alt        */
+  gmnz_put_delta_column(z,run,n,16);  /* distance   */
+  gmnz_put_rle_column(z,run,n,20);    /* heart_rate */
+  gmnz_put_rle_column(z,run,n,21);    /* cadence    */
+  gmnz_put_rle_column(z,run,n,22);    /* sensor     */
+  z->literal = run + n * D304_ELEMENT;
+}
+
+
+static void gmnz_encode_record ( gmnz_encoder * z,
+				 const uint8 *  p,
+				 const uint8 *  end );
+
+
+/*
+   Find runs of D304 elements in a packed list.  Anything that doesn't
+   look the way garmin_pack writes it is simply left to be copied.
+*/
+
+static void
+gmnz_encode_list ( gmnz_encoder * z, const uint8 * p, const uint8 * end )
+{
+  uint32 id;
+  uint32 elements;
+  uint32 size;
+  uint32 n;
+  uint32 i;
+
+  if ( end - p < 8 ) return;
+
+  id       = get_uint32(p);
+  elements = get_uint32(p+4);
+  p       += 8;
+
+  for ( i = 0; i < elements && end - p >= ELEMENT_HEADER; ) {
+    size = get_uint32(p+8);
+    if ( size > (uint32)(end - p - ELEMENT_HEADER) ) break;
+    switch ( get_uint32(p+4) ) {
+    case data_D304:
+      for ( n = 0; i + n < elements &&
+	      end - (p + n * D304_ELEMENT) >= D304_ELEMENT &&
+	      get_uint32(p + n * D304_ELEMENT) == id &&
+	      get_uint32(p + n * D304_ELEMENT + 4) == data_D304 &&
+	      get_uint32(p + n * D304_ELEMENT + 8) == D304_PACKED; n++ );
+      if ( n > 0 ) {
+	gmnz_put_d304_run(z,p,n);
+	p += n * D304_ELEMENT;
+	i += n;
+	continue;
+      }
+      break;
+    case data_Dlist:
+      gmnz_encode_record(z,p+4,p+ELEMENT_HEADER+size);
+      break;
+    default:
+      break;
+    }
+    p += ELEMENT_HEADER + size;
+    i++;
+  }
+}
+
+
+static void
+gmnz_encode_record ( gmnz_encoder * z, const uint8 * p, const uint8 * end )
+{
+  uint32 size;
+
+  if ( end - p < 8 ) return;
+
+  size = get_uint32(p+4);
+  if ( size <= (uint32)(end - p - 8) && get_uint32(p) == data_Dlist ) {
+    gmnz_encode_list(z,p+8,p+8+size);
+  }
+}
+
+
+/* ========================================================================= */
+/* garmin_is_gmnz                                                            */
+/* ========================================================================= */
+
+/* Do these bytes (the start of a file) hold a .gmnz file? */
+
+int
+garmin_is_gmnz ( const uint8 * buf, uint32 bytes )
+{
+  return ( bytes >= GARMIN_HEADER &&
+	   memcmp(buf,GARMIN_Z_MAGIC,strlen(GARMIN_Z_MAGIC)) == 0 );
+}
+
+
+/* ========================================================================= */
+/* garmin_gmnz_encode                                                        */
+/*                                                                           */
+/* Encode the contents of a .gmn file (as made by garmin_pack_file) as a     */
+/* .gmnz file.  The buffer returned is allocated with malloc and its length  */
+/* is stored in 'out'.  Returns NULL if we ran out of memory.                */
+/* ========================================================================= */
+
+uint8 *
+garmin_gmnz_encode ( const uint8 * gmn, uint32 bytes, uint32 * out )
+{
+  gmnz_encoder   z;
+  const uint8 *  p   = gmn;
+  const uint8 *  end = gmn + bytes;
+  uint8 *        h;
+  uint32         size;
+
+  memset(&z,0,sizeof(z));
+  *out = 0;
+
+  if ( (h = gmnz_reserve(&z,GARMIN_HEADER)) == NULL ) return NULL;
+
+  memset(h,0,GARMIN_HEADER);
+  strncpy((char *)h,GARMIN_Z_MAGIC,11);
+  put_uint32(h+12,GARMIN_VERSION);
+  put_uint32(h+16,bytes);
+  z.pos     = GARMIN_HEADER;
+  z.literal = gmn;
+
+  /* Walk the chunks, looking for lists. */
+
+  while ( end - p >= GARMIN_HEADER + 8 &&
+	  memcmp(p,GARMIN_MAGIC,strlen(GARMIN_MAGIC)) == 0 ) {
+    size = get_uint32(p+16);
+    if ( size > (uint32)(end - p - GARMIN_HEADER) ) break;
+    gmnz_encode_record(&z,p+GARMIN_HEADER,p+GARMIN_HEADER+size);
+    p += GARMIN_HEADER + size;
+  }
+  gmnz_flush_literal(&z,end);
+
+  if ( z.error ) {
+    printf("garmin_gmnz_encode: out of memory\n");
+    if ( z.buf != NULL ) free(z.buf);
+    return NULL;
+  }
+
+  *out = z.pos;
+
+  return z.buf;
+}
+
+
+/* ========================================================================= */
+/* garmin_gmnz_size                                                          */
+/* ========================================================================= */
+
+/* The size of the .gmn file that a .gmnz file decodes to. */
+
+uint32
+garmin_gmnz_size ( const uint8 * gmnz, uint32 bytes )
+{
+  return garmin_is_gmnz(gmnz,bytes) ? get_uint32(gmnz+16) : 0;
+}
+
+
+/* Decoding.  Nothing is read at or past 'end', nor written past 'out_end'. */
+
+typedef struct gmnz_decoder {
+  const uint8 *  pos;
+  const uint8 *  end;
+  uint8 *        out;
+  uint8 *        out_end;
+  int            error;
+} gmnz_decoder;
+
+
+static uint32
+gmnz_get_varint ( gmnz_decoder * d )
+{
+  uint32 v     = 0;
+  int    shift = 0;
+  uint8  b;
+
+  do {
+    if ( d->pos >= d->end || shift > 28 ) {
+      d->error = 1;
+      return 0;
+    }
+    b      = *d->pos++;
+    v     |= (uint32)(b & 0x7f) << shift;
+    shift += 7;
+  } while ( b & 0x80 );
+
+  return v;
+}
+
+
+static void
+gmnz_get_delta_column ( gmnz_decoder * d, uint32 n, int offset )
+{
+  uint8 * p    = d->out + ELEMENT_HEADER + offset;
+  uint32  prev = 0;
+  uint32  i;
+
+  for ( i = 0; i < n && !d->error; i++, p += D304_ELEMENT ) {
+    prev += gmnz_unzigzag(gmnz_get_varint(d));
+    put_uint32(p,prev);
+  }
+}
+
+
+static void
+gmnz_get_rle_column ( gmnz_decoder * d, uint32 n, int offset )
+{
+  uint8 * p = d->out + ELEMENT_HEADER + offset;
+  uint32  count;
+  uint32  i;
+
+  for ( i = 0; i < n && !d->error; ) {
+    count = gmnz_get_varint(d);
+    if ( count == 0 || count > n - i || d->pos >= d->end ) {
+      d->error = 1;
+      break;
+    }
+    for ( ; count > 0; count--, i++, p += D304_ELEMENT ) *p = *d->pos;
+    d->pos++;
+  }
+}
+
+
+static void
+gmnz_get_d304_run ( gmnz_decoder * d )
+{
+  uint8 * p;
+  uint32  id = gmnz_get_varint(d);
+  uint32  n  = gmnz_get_varint(d);
+  uint32  i;
+
+  if ( d->error || n > (uint32)(d->out_end - d->out) / D304_ELEMENT ) {
+    d->error = 1;
+    return;
+  }
+
+  for ( i = 0, p = d->out; i < n; i++, p += D304_ELEMENT ) {
+    put_uint32(p,id);
+    put_uint32(p+4,data_D304);
+    put_uint32(p+8,D304_PACKED);
+  }
+  gmnz_get_delta_column(d,n,0);
+  gmnz_get_delta_column(d,n,4);
+  gmnz_get_delta_column(d,n,8);
+  gmnz_get_delta_column(d,n,12);
+  gmnz_get_delta_column(d,n,16);
+  gmnz_get_rle_column(d,n,20);
+  gmnz_get_rle_column(d,n,21);
+  gmnz_get_rle_column(d,n,22);
+
+  d->out += n * D304_ELEMENT;
+}
+
+
+/* ========================================================================= */
+/* garmin_gmnz_decode                                                        */
+/*                                                                           */
+/* Decode a .gmnz file into the .gmn bytes it was made from.  'gmn' must     */
+/* have room for garmin_gmnz_size(gmnz,bytes) bytes, and 'size' must be that */
+/* size.  Returns 1 on success and 0 if the file is damaged.                 */
+/* ========================================================================= */
+
+int
+garmin_gmnz_decode ( const uint8 * gmnz,
+		     uint32        bytes,
+		     uint8 *       gmn,
+		     uint32        size )
+{
+  gmnz_decoder d;
+  uint32       n;
+
+  if ( garmin_gmnz_size(gmnz,bytes) != size ) {
+    printf("garmin_gmnz_decode: not a .gmnz file\n");
+    return 0;
+  }
+
+  d.pos     = gmnz + GARMIN_HEADER;
+  d.end     = gmnz + bytes;
+  d.out     = gmn;
+  d.out_end = gmn + size;
+  d.error   = 0;
+
+  while ( d.pos < d.end && !d.error ) {
+    switch ( *d.pos++ ) {
+    case GMNZ_LITERAL:
+      n = gmnz_get_varint(&d);
+      if ( d.error || n > (uint32)(d.end - d.pos) ||
+	   n > (uint32)(d.out_end - d.out) ) {
+	d.error = 1;
+	break;
+      }
+      memcpy(d.out,d.pos,n);
+      d.out += n;
+      d.pos += n;
+      break;
+    case GMNZ_D304_RUN:
+      gmnz_get_d304_run(&d);
+      break;
+    default:
+      d.error = 1;
+      break;
+    }
+  }
+
+  if ( d.error || d.out != d.out_end ) {
+    printf("garmin_gmnz_decode: damaged .gmnz file\n");
+    return 0;
+  }
+
+  return 1;
+}
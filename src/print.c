@@ -18,6 +18,8 @@
 */
 
 #include "config.h"
+#include <stdio.h>
+#include <stdarg.h>
 #include <time.h>
 #include <string.h>
 #include "garmin.h"
@@ -47,97 +49,474 @@
                                                      \
     return name
 
-#define GARMIN_TAGFMT(w,x,y,z)                       \
-  do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s>" w "</%s>\n",y,z,y);            \
-  } while ( 0 )
+/* 
+   Output is formatted into a buffer, which is handed to stdio with fwrite
+   when it fills up and when the outermost garmin_print_* call returns.
+   The numbers, times and positions that make up most of a track log are
+   formatted by hand; the output is the same as printf's, character for
+   character.  Anything else goes through vsnprintf into the buffer.
+*/
+
+#define PRINT_BUFFER  16384
+#define PRINT_INDENT  64
+
+
+typedef unsigned long long uint64;
+
+typedef struct garmin_printer {
+  FILE *        fp;
+  char *        pos;
+  char *        end;
+  time_t        zone_hour;     /* the hour of UTC the zone fields are for */
+  time_t        zone_shift;    /* local time minus UTC in that hour       */
+  int           zone_fixed;    /* 0 if the offset changes in that hour    */
+  char          zone_name[16]; /* the offset as printed, e.g. "-07:00"    */
+  char          buf[PRINT_BUFFER];
+} garmin_printer;
+
+
+static const char indentation[PRINT_INDENT + 1] =
+  "                                                                ";
+
+static const uint64 powers_of_ten[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+  10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+
+static void
+print_start ( garmin_printer * out, FILE * fp )
+{
+  out->fp        = fp;
+  out->pos       = out->buf;
+  out->end       = out->buf + sizeof(out->buf);
+  out->zone_hour = -1;
+}
+
+
+static void
+print_flush ( garmin_printer * out )
+{
+  if ( out->pos > out->buf ) {
+    fwrite(out->buf,1,out->pos - out->buf,out->fp);
+    out->pos = out->buf;
+  }
+}
+
+
+static void
+print_bytes ( garmin_printer * out, const char * s, size_t n )
+{
+  if ( n > (size_t)(out->end - out->pos) ) {
+    print_flush(out);
+    if ( n > sizeof(out->buf) ) {
+      fwrite(s,1,n,out->fp);
+      return;
+    }
+  }
+  memcpy(out->pos,s,n);
+  out->pos += n;
+}
+
+
+/* Like fputs, but a NULL string is printed as "(null)", as printf does. */
+
+static void
+print_string ( garmin_printer * out, const char * s )
+{
+  if ( s == NULL ) s = "(null)";
+  print_bytes(out,s,strlen(s));
+}
+
+
+static void
+print_format ( garmin_printer * out, const char * fmt, ... )
+{
+  va_list  ap;
+  int      n;
+
+  va_start(ap,fmt);
+  n = vsnprintf(out->pos,out->end - out->pos,fmt,ap);
+  va_end(ap);
+
+  if ( n >= out->end - out->pos ) {
+    print_flush(out);
+    va_start(ap,fmt);
+    if ( n < (int)sizeof(out->buf) ) {
+      n = vsnprintf(out->pos,out->end - out->pos,fmt,ap);
+    } else {
+      vfprintf(out->fp,fmt,ap);
+      n = 0;
+    }
+    va_end(ap);
+  }
+  if ( n > 0 ) out->pos += n;
+}
+
+
+static void
+print_uint ( garmin_printer * out, uint32 v )
+{
+  char   buf[10];
+  char * c = buf + sizeof(buf);
+
+  do {
+    *--c = '0' + v % 10;
+    v   /= 10;
+  } while ( v != 0 );
+
+  print_bytes(out,c,buf + sizeof(buf) - c);
+}
+
+
+static void
+print_int ( garmin_printer * out, int v )
+{
+  if ( v < 0 ) {
+    print_bytes(out,"-",1);
+    print_uint(out,-(uint32)v);
+  } else {
+    print_uint(out,v);
+  }
+}
+
+
+static void
+print_hex ( garmin_printer * out, uint32 v )
+{
+  char   buf[8];
+  char * c = buf + sizeof(buf);
+
+  do {
+    *--c = "0123456789abcdef"[v & 0xf];
+    v  >>= 4;
+  } while ( v != 0 );
+
+  print_bytes(out,c,buf + sizeof(buf) - c);
+}
+
+
+/* Two digits, with a leading zero ("%02d") */
+
+static void
+print_2digits ( garmin_printer * out, int v )
+{
+  char buf[2];
+
+  if ( v < 0 || v > 99 ) {
+    print_format(out,"%02d",v);
+  } else {
+    buf[0] = '0' + v / 10;
+    buf[1] = '0' + v % 10;
+    print_bytes(out,buf,2);
+  }
+}
+
+
+/* Two hex digits ("%02x") */
+
+static void
+print_2hex ( garmin_printer * out, uint8 v )
+{
+  char buf[2];
+
+  buf[0] = "0123456789abcdef"[v >> 4];
+  buf[1] = "0123456789abcdef"[v & 0xf];
+  print_bytes(out,buf,2);
+}
+
+
+/* 
+   Print q / 10^digits with 'digits' decimal places.  'q' is the value
+   already scaled and rounded.
+*/
+
+static void
+print_scaled ( garmin_printer * out, int negative, uint64 q, int digits )
+{
+  char   buf[32];
+  char * c = buf + sizeof(buf);
+  int    i;
+
+  for ( i = 0; i < digits; i++ ) {
+    *--c = '0' + q % 10;
+    q   /= 10;
+  }
+  *--c = '.';
+  do {
+    *--c = '0' + q % 10;
+    q   /= 10;
+  } while ( q != 0 );
+  if ( negative ) *--c = '-';
+
+  print_bytes(out,c,buf + sizeof(buf) - c);
+}
+
+
+/* 
+   m / 2^shift, rounded to the nearest integer, ties to even (which is how
+   printf rounds a value that is exactly halfway).
+*/
+
+static uint64
+round_shifted ( uint64 m, int shift )
+{
+  uint64 q;
+  uint64 r;
+  uint64 half;
+
+  if ( shift <= 0 ) return m << -shift;
+  if ( shift >= 64 ) return 0;
+
+  q    = m >> shift;
+  r    = m & ((1ULL << shift) - 1);
+  half = 1ULL << (shift - 1);
+  if ( r > half || (r == half && (q & 1) != 0) ) q++;
+
+  return q;
+}
+
+
+/* 
+   "%.*f" for a float32 of magnitude at most 1e8, to at most 9 places.
+   The float is exactly m * 2^e, so the rounding can be done exactly in
+   64 bits.
+*/
+
+static void
+print_float32_fixed ( garmin_printer * out, float32 f, int digits )
+{
+  union { float32 f; uint32 u; } v;
+  uint64                         m;
+  int                            e;
+
+  v.f = f;
+  e   = (v.u >> 23) & 0xff;
+  m   = v.u & 0x7fffff;
+  if ( e != 0 ) m |= 0x800000;
+  else          e  = 1;
+  e -= 150;
+
+  print_scaled(out,v.u >> 31,
+	       round_shifted(m * powers_of_ten[digits],-e),digits);
+}
+
+
+/* 
+   A position in degrees, as "%.8lf" prints SEMI2DEG(a).  a * 180 / 2^31
+   is exactly a * 45 / 2^29, and fits in 64 bits when scaled by 10^8.
+*/
+
+static void
+print_semicircles ( garmin_printer * out, sint32 a )
+{
+  uint64 m = (a < 0) ? -(uint64)a : (uint64)a;
+
+  print_scaled(out,a < 0,round_shifted(m * 45 * powers_of_ten[8],29),8);
+}
+
 
 #define GARMIN_TAGFUN(w,x,y,z)                       \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s>",y);                            \
-    w(z,fp);                                         \
-    fprintf(fp,"</%s>\n",y);                         \
+    print_spaces(out,spaces+x);                      \
+    print_bytes(out,"<",1);                          \
+    print_string(out,y);                             \
+    print_bytes(out,">",1);                          \
+    w(z,out);                                        \
+    print_bytes(out,"</",2);                         \
+    print_string(out,y);                             \
+    print_bytes(out,">\n",2);                        \
   } while ( 0 )
 
 #define GARMIN_TAGPOS(x,y,z)                         \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s lat=\"%.8lf\" lon=\"%.8lf\"/>\n",\
-            y,SEMI2DEG((z).lat),SEMI2DEG((z).lon));  \
+    print_spaces(out,spaces+x);                      \
+    print_bytes(out,"<",1);                          \
+    print_string(out,y);                             \
+    print_bytes(out," lat=\"",6);                    \
+    print_semicircles(out,(z).lat);                  \
+    print_bytes(out,"\" lon=\"",7);                  \
+    print_semicircles(out,(z).lon);                  \
+    print_bytes(out,"\"/>\n",4);                     \
   } while ( 0 )
 
 #define GARMIN_TAGSYM(x,y,z)                         \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s value=\"0x%x\" name=\"%s\"/>\n", \
-	    y,z,garmin_symbol_name(z));              \
+    print_spaces(out,spaces+x);                      \
+    print_format(out,"<%s value=\"0x%x\" name=\"%s\"/>\n", \
+		 y,z,garmin_symbol_name(z));         \
   } while ( 0 )
 
 #define GARMIN_TAGU8B(x,y,z,l)			     \
   do {                                               \
     int u8b;                                         \
                                                      \
-    open_tag(y,fp,spaces+x);                         \
-    print_spaces(fp,spaces+x);                       \
+    open_tag(y,out,spaces+x);                        \
+    print_spaces(out,spaces+x);                      \
     for ( u8b = 0; u8b < l; u8b++ ) {                \
-      fprintf(fp," 0x%02x",z[u8b]);                  \
+      print_bytes(out," 0x",3);                      \
+      print_2hex(out,z[u8b]);                        \
     }                                                \
-    fprintf(fp,"\n");                                \
-    close_tag(y,fp,spaces+x);                        \
+    print_bytes(out,"\n",1);                         \
+    close_tag(y,out,spaces+x);                       \
   } while ( 0 )
 
-#define GARMIN_TAGSTR(x,y,z) GARMIN_TAGFMT("%s",x,y,z)
-#define GARMIN_TAGINT(x,y,z) GARMIN_TAGFMT("%d",x,y,z)
-#define GARMIN_TAGU32(x,y,z) GARMIN_TAGFMT("%u",x,y,z)
+#define GARMIN_TAGSTR(x,y,z) GARMIN_TAGFUN(garmin_print_string,x,y,z)
+#define GARMIN_TAGINT(x,y,z) GARMIN_TAGFUN(garmin_print_int,x,y,z)
+#define GARMIN_TAGU32(x,y,z) GARMIN_TAGFUN(garmin_print_uint,x,y,z)
 #define GARMIN_TAGF32(x,y,z) GARMIN_TAGFUN(garmin_print_float32,x,y,z)
 #define GARMIN_TAGF64(x,y,z) GARMIN_TAGFUN(garmin_print_float64,x,y,z)
-#define GARMIN_TAGHEX(x,y,z) GARMIN_TAGFMT("0x%x",x,y,z)
+#define GARMIN_TAGHEX(x,y,z) GARMIN_TAGFUN(garmin_print_hex,x,y,z)
 
 
 static void
-print_spaces ( FILE * fp, int spaces )
+print_spaces ( garmin_printer * out, int spaces )
 {
-  int i;
-
-  for ( i = 0; i < spaces; i++ ) {
-    fprintf(fp," ");
+  while ( spaces > PRINT_INDENT ) {
+    print_bytes(out,indentation,PRINT_INDENT);
+    spaces -= PRINT_INDENT;
   }
+  if ( spaces > 0 ) print_bytes(out,indentation,spaces);
 }
 
 
 static void
-open_tag ( const char * tag, FILE * fp, int spaces ) 
+open_tag ( const char * tag, garmin_printer * out, int spaces ) 
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s>\n",tag);
+  print_spaces(out,spaces);
+  print_bytes(out,"<",1);
+  print_string(out,tag);
+  print_bytes(out,">\n",2);
 }
 
 
 static void
-open_tag_with_type ( const char * tag, uint32 type, FILE * fp, int spaces ) 
+open_tag_with_type ( const char *     tag,
+		     uint32           type,
+		     garmin_printer * out,
+		     int              spaces ) 
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s type=\"%d\">\n",tag,type);
+  print_spaces(out,spaces);
+  print_bytes(out,"<",1);
+  print_string(out,tag);
+  print_bytes(out," type=\"",7);
+  print_int(out,type);
+  print_bytes(out,"\">\n",3);
 }
 
 
 static void
-close_tag ( const char * tag, FILE * fp, int spaces ) 
+close_tag ( const char * tag, garmin_printer * out, int spaces ) 
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"</%s>\n",tag);
+  print_spaces(out,spaces);
+  print_bytes(out,"</",2);
+  print_string(out,tag);
+  print_bytes(out,">\n",2);
 }
 
 
+static void print_data ( garmin_data * d, garmin_printer * out, int spaces );
+
+
 static void
-garmin_print_dlist ( garmin_list * l, FILE * fp, int spaces )
+garmin_print_dlist ( garmin_list * l, garmin_printer * out, int spaces )
 {
   garmin_list_node * n;
+  garmin_data *      d;
 
   for ( n = l->head; n != NULL; n = n->next ) {
-    garmin_print_data(n->data,fp,spaces);
+    if ( (d = garmin_list_node_data(l,n)) != NULL ) {
+      print_data(d,out,spaces);
+    }
+  }
+}
+
+
+/* The values of the simple tags, in the argument order GARMIN_TAGFUN uses. */
+
+static void
+garmin_print_string ( const char * s, garmin_printer * out )
+{
+  print_string(out,s);
+}
+
+
+static void
+garmin_print_int ( int v, garmin_printer * out )
+{
+  print_int(out,v);
+}
+
+
+static void
+garmin_print_uint ( uint32 v, garmin_printer * out )
+{
+  print_uint(out,v);
+}
+
+
+static void
+garmin_print_hex ( uint32 v, garmin_printer * out )
+{
+  print_bytes(out,"0x",2);
+  print_hex(out,v);
+}
+
+
+/* 
+   The time zone of the printer's current hour: how far local time is
+   ahead of UTC, and how strftime prints that.  If the offset changes
+   during the hour, zone_fixed is 0 and each time is converted on its own.
+*/
+
+static time_t
+local_seconds ( time_t t, char * name, int size )
+{
+  struct tm  tmval;
+  long       y;
+  long       m;
+  long       era;
+  long       yoe;
+  long       doe;
+  int        len;
+
+  localtime_r(&t,&tmval);
+
+  if ( name != NULL ) {
+    strftime(name,size-1,"%z",&tmval);
+    len = strlen(name);
+    if ( len > 0 && name[len-1] != 'Z' ) {
+      memmove(name+len-1,name+len-2,3);
+      name[len-2] = ':';
+    }
+  }
+
+  /* Days since 1970-01-01 of the local date (a proleptic Gregorian day). */
+
+  y   = tmval.tm_year + 1900;
+  m   = tmval.tm_mon + 1;
+  y  -= (m <= 2);
+  era = ((y >= 0) ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 +
+    (153 * ((m > 2) ? m - 3 : m + 9) + 2) / 5 + tmval.tm_mday - 1;
+
+  return ((time_t)(era * 146097 + doe - 719468) * 86400 +
+	  tmval.tm_hour * 3600 + tmval.tm_min * 60 + tmval.tm_sec);
+}
+
+
+static void
+print_zone ( garmin_printer * out, time_t t )
+{
+  time_t hour = t - ((t % 3600) + 3600) % 3600;
+
+  if ( hour != out->zone_hour ) {
+    out->zone_hour  = hour;
+    out->zone_shift = local_seconds(hour,out->zone_name,
+				    sizeof(out->zone_name)) - hour;
+    out->zone_fixed = (local_seconds(hour + 3599,NULL,0) - (hour + 3599) ==
+		       out->zone_shift);
   }
 }
 
@@ -145,12 +524,21 @@ garmin_print_dlist ( garmin_list * l, FILE * fp, int spaces )
 /* Support function to print a time value in ISO 8601 compliant format */
 
 static void
-garmin_print_dtime ( uint32 t, FILE * fp, const char * label )
+garmin_print_dtime ( uint32 t, garmin_printer * out, const char * label )
 {
   time_t     tval;
   struct tm  tmval;
   char       buf[128];
   int        len;
+  time_t     local;
+  long       z;
+  long       era;
+  long       doe;
+  long       yoe;
+  long       doy;
+  long       mp;
+  long       y;
+  int        sec;
 
   /* 
                                   012345678901234567890123
@@ -160,38 +548,87 @@ garmin_print_dtime ( uint32 t, FILE * fp, const char * label )
   */
 
   tval = t + TIME_OFFSET;
-  localtime_r(&tval,&tmval);
-  strftime(buf,sizeof(buf)-1,"%FT%T%z",&tmval);
 
-  /* 
-     If the last character is a 'Z', don't do anything.  Otherwise, we 
-     need to move the last two characters out one and stick a colon in 
-     the vacated spot.  Let's not forget the trailing '\0' that needs to 
-     be moved as well.
-  */
+  print_bytes(out," ",1);
+  print_string(out,label);
+  print_bytes(out,"=\"",2);
 
-  len = strlen(buf);
-  if ( len > 0 && buf[len-1] != 'Z' ) {
-    memmove(buf+len-1,buf+len-2,3);
-    buf[len-2] = ':';
-  }
+  print_zone(out,tval);
+
+  if ( out->zone_fixed == 0 ) {
+
+    /* The offset changes this hour, so let strftime sort it out. */
+
+    localtime_r(&tval,&tmval);
+    strftime(buf,sizeof(buf)-1,"%FT%T%z",&tmval);
 
-  /* OK.  Done. */
+    /* 
+       If the last character is a 'Z', don't do anything.  Otherwise, we 
+       need to move the last two characters out one and stick a colon in 
+       the vacated spot.  Let's not forget the trailing '\0' that needs to 
+       be moved as well.
+    */
 
-  fprintf(fp," %s=\"%s\"",label,buf);
+    len = strlen(buf);
+    if ( len > 0 && buf[len-1] != 'Z' ) {
+      memmove(buf+len-1,buf+len-2,3);
+      buf[len-2] = ':';
+    }
+
+    print_string(out,buf);
+
+  } else {
+
+    /* The local date and time from the day number (proleptic Gregorian). */
+
+    local = tval + out->zone_shift;
+    z     = local / 86400;
+    sec   = local % 86400;
+    if ( sec < 0 ) {
+      sec += 86400;
+      z--;
+    }
+
+    z   += 719468;
+    era  = ((z >= 0) ? z : z - 146096) / 146097;
+    doe  = z - era * 146097;
+    yoe  = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy  = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp   = (5 * doy + 2) / 153;
+    y    = yoe + era * 400 + (mp >= 10);
+
+    print_int(out,y);
+    print_bytes(out,"-",1);
+    print_2digits(out,(mp < 10) ? mp + 3 : mp - 9);
+    print_bytes(out,"-",1);
+    print_2digits(out,doy - (153 * mp + 2) / 5 + 1);
+    print_bytes(out,"T",1);
+    print_2digits(out,sec / 3600);
+    print_bytes(out,":",1);
+    print_2digits(out,(sec / 60) % 60);
+    print_bytes(out,":",1);
+    print_2digits(out,sec % 60);
+    print_string(out,out->zone_name);
+  }
+
+  print_bytes(out,"\"",1);
 }
 
 
 /* Support function to print a position type */
 
 static void
-garmin_print_dpos ( position_type * pos, FILE * fp )
+garmin_print_dpos ( position_type * pos, garmin_printer * out )
 {
   if ( pos->lat != 0x7fffffff ) {
-    fprintf(fp," lat=\"%.8lf\"",SEMI2DEG(pos->lat));
+    print_bytes(out," lat=\"",6);
+    print_semicircles(out,pos->lat);
+    print_bytes(out,"\"",1);
   }
   if ( pos->lon != 0x7fffffff ) {
-    fprintf(fp," lon=\"%.8lf\"",SEMI2DEG(pos->lon));
+    print_bytes(out," lon=\"",6);
+    print_semicircles(out,pos->lon);
+    print_bytes(out,"\"",1);
   }
 }
 
@@ -202,32 +639,32 @@ garmin_print_dpos ( position_type * pos, FILE * fp )
 */
 
 static void
-garmin_print_float32 ( float32 f, FILE * fp )
+garmin_print_float32 ( float32 f, garmin_printer * out )
 {
   if ( f > 100000000.0 || f < -100000000.0 ) {
-    fprintf(fp,"%.9e",f);
+    print_format(out,"%.9e",f);
   } else if ( f > 10000000.0 || f < -10000000.0 ) {
-    fprintf(fp,"%.1f",f);
+    print_float32_fixed(out,f,1);
   } else if ( f > 1000000.0 || f < -1000000.0 ) {
-    fprintf(fp,"%.2f",f);
+    print_float32_fixed(out,f,2);
   } else if ( f > 100000.0 || f < -100000.0 ) {
-    fprintf(fp,"%.3f",f);
+    print_float32_fixed(out,f,3);
   } else if ( f > 10000.0 || f < -10000.0 ) {
-    fprintf(fp,"%.4f",f);
+    print_float32_fixed(out,f,4);
   } else if ( f > 1000.0 || f < -1000.0 ) {
-    fprintf(fp,"%.5f",f);
+    print_float32_fixed(out,f,5);
   } else if ( f > 100.0 || f < -100.0 ) {
-    fprintf(fp,"%.6f",f);
+    print_float32_fixed(out,f,6);
   } else if ( f > 10.0 || f < -10.0 ) {
-    fprintf(fp,"%.7f",f);
+    print_float32_fixed(out,f,7);
   } else if ( f > 1.0 || f < -1.0 ) {
-    fprintf(fp,"%.8f",f);
+    print_float32_fixed(out,f,8);
   } else if ( f > 0.1 || f < -0.1 ) {
-    fprintf(fp,"%.9f",f);
+    print_float32_fixed(out,f,9);
   } else if ( f != 0 ) {
-    fprintf(fp,"%.9e",f);
+    print_format(out,"%.9e",f);
   } else {
-    fprintf(fp,"%.8f",f);
+    print_float32_fixed(out,f,8);
   }
 }
 
@@ -238,48 +675,48 @@ garmin_print_float32 ( float32 f, FILE * fp )
 */
 
 static void
-garmin_print_float64 ( float64 f, FILE * fp )
+garmin_print_float64 ( float64 f, garmin_printer * out )
 {
   if ( f > 10000000000000000.0 || f < -10000000000000000.0 ) {
-    fprintf(fp,"%.17e",f);
+    print_format(out,"%.17e",f);
   } else if ( f > 1000000000000000.0 || f < -1000000000000000.0 ) {
-    fprintf(fp,"%.1f",f);
+    print_format(out,"%.1f",f);
   } else if ( f > 100000000000000.0 || f < -100000000000000.0 ) {
-    fprintf(fp,"%.2f",f);
+    print_format(out,"%.2f",f);
   } else if ( f > 10000000000000.0 || f < -10000000000000.0 ) {
-    fprintf(fp,"%.3f",f);
+    print_format(out,"%.3f",f);
   } else if ( f > 1000000000000.0 || f < -1000000000000.0 ) {
-    fprintf(fp,"%.4f",f);
+    print_format(out,"%.4f",f);
   } else if ( f > 100000000000.0 || f < -100000000000.0 ) {
-    fprintf(fp,"%.5f",f);
+    print_format(out,"%.5f",f);
   } else if ( f > 10000000000.0 || f < -10000000000.0 ) {
-    fprintf(fp,"%.6f",f);
+    print_format(out,"%.6f",f);
   } else if ( f > 1000000000.0 || f < -1000000000.0 ) {
-    fprintf(fp,"%.7f",f);
+    print_format(out,"%.7f",f);
   } else if ( f > 100000000.0 || f < -100000000.0 ) {
-    fprintf(fp,"%.8f",f);
+    print_format(out,"%.8f",f);
   } else if ( f > 10000000.0 || f < -10000000.0 ) {
-    fprintf(fp,"%.9f",f);
+    print_format(out,"%.9f",f);
   } else if ( f > 1000000.0 || f < -1000000.0 ) {
-    fprintf(fp,"%.10f",f);
+    print_format(out,"%.10f",f);
   } else if ( f > 100000.0 || f < -100000.0 ) {
-    fprintf(fp,"%.11f",f);
+    print_format(out,"%.11f",f);
   } else if ( f > 10000.0 || f < -10000.0 ) {
-    fprintf(fp,"%.12f",f);
+    print_format(out,"%.12f",f);
   } else if ( f > 1000.0 || f < -1000.0 ) {
-    fprintf(fp,"%.13f",f);
+    print_format(out,"%.13f",f);
   } else if ( f > 100.0 || f < -100.0 ) {
-    fprintf(fp,"%.14f",f);
+    print_format(out,"%.14f",f);
   } else if ( f > 10.0 || f < -10.0 ) {
-    fprintf(fp,"%.15f",f);
+    print_format(out,"%.15f",f);
   } else if ( f > 1.0 || f < -1.0 ) {
-    fprintf(fp,"%.16f",f);
+    print_format(out,"%.16f",f);
   } else if ( f > 0.1 || f < -0.1 ) {
-    fprintf(fp,"%.17f",f);
+    print_format(out,"%.17f",f);
   } else if ( f != 0 ) {
-    fprintf(fp,"%.17e",f);
+    print_format(out,"%.17e",f);
   } else {
-    fprintf(fp,"%.16f",f);
+    print_format(out,"%.16f",f);
   }
 }
 
@@ -290,12 +727,14 @@ garmin_print_float64 ( float64 f, FILE * fp )
 */
 
 static void
-garmin_print_dfloat32 ( float32 f, FILE * fp, const char * label )
+garmin_print_dfloat32 ( float32 f, garmin_printer * out, const char * label )
 {
   if ( f < 1.0e24 ) {
-    fprintf(fp," %s=\"",label);
-    garmin_print_float32(f,fp);
-    fprintf(fp,"\"");
+    print_bytes(out," ",1);
+    print_string(out,label);
+    print_bytes(out,"=\"",2);
+    garmin_print_float32(f,out);
+    print_bytes(out,"\"",1);
   }
 }
 
@@ -303,7 +742,7 @@ garmin_print_dfloat32 ( float32 f, FILE * fp, const char * label )
 /* Print a duration and distance. */
 
 static void
-garmin_print_ddist ( uint32 dur, float32 dist, FILE * fp )
+garmin_print_ddist ( uint32 dur, float32 dist, garmin_printer * out )
 {
   int  hun;
   int  sec;
@@ -321,9 +760,17 @@ garmin_print_ddist ( uint32 dur, float32 dist, FILE * fp )
   dur /= 60;
   hrs  = dur;
 
-  fprintf(fp," duration=\"%d:%02d:%02d.%02d\" distance=\"",hrs,min,sec,hun);
-  garmin_print_float32(dist,fp);
-  fprintf(fp,"\"");
+  print_bytes(out," duration=\"",11);
+  print_int(out,hrs);
+  print_bytes(out,":",1);
+  print_2digits(out,min);
+  print_bytes(out,":",1);
+  print_2digits(out,sec);
+  print_bytes(out,".",1);
+  print_2digits(out,hun);
+  print_bytes(out,"\" distance=\"",12);
+  garmin_print_float32(dist,out);
+  print_bytes(out,"\"",1);
 }
 
 
@@ -332,13 +779,13 @@ garmin_print_ddist ( uint32 dur, float32 dist, FILE * fp )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d100 ( D100 * x, FILE * fp, int spaces )
+garmin_print_d100 ( D100 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",100,fp,spaces);
+  open_tag_with_type("waypoint",100,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -347,15 +794,15 @@ garmin_print_d100 ( D100 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d101 ( D101 * x, FILE * fp, int spaces )
+garmin_print_d101 ( D101 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",101,fp,spaces);
+  open_tag_with_type("waypoint",101,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGF32(1,"proximity_distance",x->dst);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -364,15 +811,15 @@ garmin_print_d101 ( D101 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d102 ( D102 * x, FILE * fp, int spaces )
+garmin_print_d102 ( D102 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",102,fp,spaces);
+  open_tag_with_type("waypoint",102,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGF32(1,"proximity_distance",x->dst);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -411,15 +858,15 @@ GARMIN_ENUM_NAME(103,dspl) {
 
 
 static void
-garmin_print_d103 ( D103 * x, FILE * fp, int spaces )
+garmin_print_d103 ( D103 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",103,fp,spaces);
+  open_tag_with_type("waypoint",103,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGSTR(1,"symbol",garmin_d103_smbl(x->smbl));
   GARMIN_TAGSTR(1,"display",garmin_d103_dspl(x->dspl));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -438,16 +885,16 @@ GARMIN_ENUM_NAME(104,dspl) {
 
 
 static void
-garmin_print_d104 ( D104 * x, FILE * fp, int spaces )
+garmin_print_d104 ( D104 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",104,fp,spaces);
+  open_tag_with_type("waypoint",104,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGF32(1,"proximity_distance",x->dst);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
   GARMIN_TAGSTR(1,"display",garmin_d104_dspl(x->dspl));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -456,13 +903,13 @@ garmin_print_d104 ( D104 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d105 ( D105 * x, FILE * fp, int spaces )
+garmin_print_d105 ( D105 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",105,fp,spaces);
+  open_tag_with_type("waypoint",105,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->wpt_ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -471,9 +918,9 @@ garmin_print_d105 ( D105 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d106 ( D106 * x, FILE * fp, int spaces )
+garmin_print_d106 ( D106 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",106,fp,spaces);
+  open_tag_with_type("waypoint",106,out,spaces);
   GARMIN_TAGSTR(1,"class",(x->wpt_class)?"non-user":"user");
   if ( x->wpt_class != 0 ) {
     GARMIN_TAGU8B(1,"subclass",x->subclass,13);
@@ -482,7 +929,7 @@ garmin_print_d106 ( D106 * x, FILE * fp, int spaces )
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
   GARMIN_TAGSTR(1,"link",x->lnk_ident);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -501,9 +948,9 @@ GARMIN_ENUM_NAME(107,clr) {
 
 
 static void
-garmin_print_d107 ( D107 * x, FILE * fp, int spaces )
+garmin_print_d107 ( D107 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",107,fp,spaces);
+  open_tag_with_type("waypoint",107,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
@@ -511,7 +958,7 @@ garmin_print_d107 ( D107 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"symbol",garmin_d103_smbl(x->smbl));
   GARMIN_TAGSTR(1,"display",garmin_d103_dspl(x->dspl));
   GARMIN_TAGSTR(1,"color",garmin_d107_clr(x->color));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -561,9 +1008,9 @@ GARMIN_ENUM_NAME(108,color) {
 
 
 static void
-garmin_print_d108 ( D108 * x, FILE * fp, int spaces )
+garmin_print_d108 ( D108 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",108,fp,spaces);
+  open_tag_with_type("waypoint",108,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->comment);
@@ -580,7 +1027,7 @@ garmin_print_d108 ( D108 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"city",x->city);
   GARMIN_TAGSTR(1,"addr",x->addr);
   GARMIN_TAGSTR(1,"cross_road",x->cross_road);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -589,13 +1036,13 @@ garmin_print_d108 ( D108 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d109 ( D109 * x, FILE * fp, int spaces )
+garmin_print_d109 ( D109 * x, garmin_printer * out, int spaces )
 {
   uint8 color = x->dspl_color & 0x1f;
 
   if ( color == 0x1f ) color = D108_default_color;
 
-  open_tag_with_type("waypoint",109,fp,spaces);
+  open_tag_with_type("waypoint",109,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->comment);
@@ -614,7 +1061,7 @@ garmin_print_d109 ( D109 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"city",x->city);
   GARMIN_TAGSTR(1,"addr",x->addr);
   GARMIN_TAGSTR(1,"cross_road",x->cross_road);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -672,9 +1119,9 @@ GARMIN_ENUM_NAME(110,dspl) {
 
 
 static void
-garmin_print_d110 ( D110 * x, FILE * fp, int spaces )
+garmin_print_d110 ( D110 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",110,fp,spaces);
+  open_tag_with_type("waypoint",110,out,spaces);
   GARMIN_TAGHEX(1,"dtyp",x->dtyp);
   GARMIN_TAGSTR(1,"wpt_class",garmin_d110_wpt_class(x->wpt_class));
   GARMIN_TAGSTR(1,"color",garmin_d110_color((x->dspl_color) & 0x1f));
@@ -697,7 +1144,7 @@ garmin_print_d110 ( D110 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"city",x->city);
   GARMIN_TAGSTR(1,"address_number",x->addr);
   GARMIN_TAGSTR(1,"cross_road",x->cross_road);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -706,7 +1153,7 @@ garmin_print_d110 ( D110 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d120 ( D120 * x, FILE * fp, int spaces )
+garmin_print_d120 ( D120 * x, garmin_printer * out, int spaces )
 {
   GARMIN_TAGSTR(0,"waypoint_category",x->name);
 }
@@ -731,9 +1178,9 @@ GARMIN_ENUM_NAME(150,wpt_class) {
 
 		  
 static void
-garmin_print_d150 ( D150 * x, FILE * fp, int spaces )
+garmin_print_d150 ( D150 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",150,fp,spaces);
+  open_tag_with_type("waypoint",150,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d150_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -747,7 +1194,7 @@ garmin_print_d150 ( D150 * x, FILE * fp, int spaces )
   if ( x->wpt_class == D150_apt_wpt_class ) {
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -766,9 +1213,9 @@ GARMIN_ENUM_NAME(151,wpt_class) {
 
 
 static void
-garmin_print_d151 ( D151 * x, FILE * fp, int spaces )
+garmin_print_d151 ( D151 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",151,fp,spaces);
+  open_tag_with_type("waypoint",151,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d151_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -783,7 +1230,7 @@ garmin_print_d151 ( D151 * x, FILE * fp, int spaces )
   if ( x->wpt_class == D151_apt_wpt_class ) {
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -804,9 +1251,9 @@ GARMIN_ENUM_NAME(152,wpt_class) {
 
 		  
 static void
-garmin_print_d152 ( D152 * x, FILE * fp, int spaces )
+garmin_print_d152 ( D152 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",152,fp,spaces);
+  open_tag_with_type("waypoint",152,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d152_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -821,7 +1268,7 @@ garmin_print_d152 ( D152 * x, FILE * fp, int spaces )
   if ( x->wpt_class == D152_apt_wpt_class ) {
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -846,9 +1293,9 @@ GARMIN_ENUM_NAME(154,wpt_class) {
 
 
 static void
-garmin_print_d154 ( D154 * x, FILE * fp, int spaces )
+garmin_print_d154 ( D154 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",154,fp,spaces);
+  open_tag_with_type("waypoint",154,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d154_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -864,7 +1311,7 @@ garmin_print_d154 ( D154 * x, FILE * fp, int spaces )
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -893,9 +1340,9 @@ GARMIN_ENUM_NAME(155,dspl) {
 
 
 static void
-garmin_print_d155 ( D155 * x, FILE * fp, int spaces )
+garmin_print_d155 ( D155 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("waypoint",155,fp,spaces);
+  open_tag_with_type("waypoint",155,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d155_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -912,7 +1359,7 @@ garmin_print_d155 ( D155 * x, FILE * fp, int spaces )
   }
   GARMIN_TAGSYM(1,"symbol",x->smbl);
   GARMIN_TAGSTR(1,"display",garmin_d155_dspl(x->dspl));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -921,10 +1368,10 @@ garmin_print_d155 ( D155 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d200 ( D200 * x, FILE * fp, int spaces )
+garmin_print_d200 ( D200 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_header type=\"200\" number=\"%d\"/>\n", *x);
+  print_spaces(out,spaces);
+  print_format(out,"<route_header type=\"200\" number=\"%d\"/>\n", *x);
 }
 
 
@@ -933,11 +1380,11 @@ garmin_print_d200 ( D200 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d201 ( D201 * x, FILE * fp, int spaces )
+garmin_print_d201 ( D201 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_header type=\"201\" number=\"%d\">%s</route_header>\n",
-	  x->nmbr,x->cmnt);
+  print_spaces(out,spaces);
+  print_format(out,"<route_header type=\"201\" number=\"%d\">%s</route_header>\n",
+	       x->nmbr,x->cmnt);
 }
 
 
@@ -946,11 +1393,11 @@ garmin_print_d201 ( D201 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d202 ( D202 * x, FILE * fp, int spaces )
+garmin_print_d202 ( D202 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_header type=\"202\" ident=\"%s\"/>\n",
-	  x->rte_ident);
+  print_spaces(out,spaces);
+  print_format(out,"<route_header type=\"202\" ident=\"%s\"/>\n",
+	       x->rte_ident);
 }
 
 
@@ -970,13 +1417,13 @@ GARMIN_ENUM_NAME(210,class) {
 
 
 static void
-garmin_print_d210 ( D210 * x, FILE * fp, int spaces )
+garmin_print_d210 ( D210 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_link type=\"210\" class=\"%s\" ident=\"%s\">\n",
-	  garmin_d210_class(x->link_class),x->ident);
+  print_spaces(out,spaces);
+  print_format(out,"<route_link type=\"210\" class=\"%s\" ident=\"%s\">\n",
+	       garmin_d210_class(x->link_class),x->ident);
   GARMIN_TAGU8B(1,"route_link_subclass",x->subclass,18);
-  close_tag("route_link",fp,spaces);
+  close_tag("route_link",out,spaces);
 }
 
 
@@ -985,16 +1432,16 @@ garmin_print_d210 ( D210 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d300 ( D300 * p, FILE * fp, int spaces )
+garmin_print_d300 ( D300 * p, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"300\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
+  print_spaces(out,spaces);
+  print_string(out,"<point type=\"300\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
   if ( p->new_trk != 0 ) {
-    fprintf(fp," new=\"true\"");
+    print_string(out," new=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  print_string(out,"/>\n");
 }
 
 
@@ -1003,18 +1450,18 @@ garmin_print_d300 ( D300 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d301 ( D301 * p, FILE * fp, int spaces )
+garmin_print_d301 ( D301 * p, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"301\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
-  garmin_print_dfloat32(p->dpth,fp,"depth");
+  print_spaces(out,spaces);
+  print_string(out,"<point type=\"301\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
+  garmin_print_dfloat32(p->dpth,out,"depth");
   if ( p->new_trk != 0 ) {
-    fprintf(fp," new=\"true\"");
+    print_string(out," new=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  print_string(out,"/>\n");
 }
 
 
@@ -1023,19 +1470,19 @@ garmin_print_d301 ( D301 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d302 ( D302 * p, FILE * fp, int spaces )
+garmin_print_d302 ( D302 * p, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"302\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
-  garmin_print_dfloat32(p->dpth,fp,"depth");
-  garmin_print_dfloat32(p->temp,fp,"temperature");
+  print_spaces(out,spaces);
+  print_string(out,"<point type=\"302\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
+  garmin_print_dfloat32(p->dpth,out,"depth");
+  garmin_print_dfloat32(p->temp,out,"temperature");
   if ( p->new_trk != 0 ) {
-    fprintf(fp," new=\"true\"");
+    print_string(out," new=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  print_string(out,"/>\n");
 
 }
 
@@ -1045,17 +1492,19 @@ garmin_print_d302 ( D302 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d303 ( D303 * p, FILE * fp, int spaces )
+garmin_print_d303 ( D303 * p, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"303\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
+  print_spaces(out,spaces);
+  print_string(out,"<point type=\"303\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
   if ( p->heart_rate != 0 ) {
-    fprintf(fp," hr=\"%d\"",p->heart_rate);
+    print_string(out," hr=\"");
+    print_int(out,p->heart_rate);
+    print_string(out,"\"");
   }
-  fprintf(fp,"/>\n");
+  print_string(out,"/>\n");
 }
 
 
@@ -1064,24 +1513,28 @@ garmin_print_d303 ( D303 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d304 ( D304 * p, FILE * fp, int spaces )
+garmin_print_d304 ( D304 * p, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"304\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
-  garmin_print_dfloat32(p->distance,fp,"distance");
+  print_spaces(out,spaces);
+  print_string(out,"<point type=\"304\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
+  garmin_print_dfloat32(p->distance,out,"distance");
   if ( p->heart_rate != 0 ) {
-    fprintf(fp," hr=\"%d\"", p->heart_rate);
+    print_string(out," hr=\"");
+    print_int(out,p->heart_rate);
+    print_string(out,"\"");
   }
   if ( p->cadence != 0xff ) {
-    fprintf(fp, " cadence=\"%d\"", p->cadence);
+    print_string(out," cadence=\"");
+    print_int(out,p->cadence);
+    print_string(out,"\"");
   }
   if ( p->sensor != 0 ) {
-    fprintf(fp, " sensor=\"true\"");
+    print_string(out," sensor=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  print_string(out,"/>\n");
 }
 
 
@@ -1090,13 +1543,13 @@ garmin_print_d304 ( D304 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d310 ( D310 * x, FILE * fp, int spaces )
+garmin_print_d310 ( D310 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<track type=\"310\" ident=\"%s\" color=\"%s\" "
-	  "display=\"%s\"/>\n",
-	  x->trk_ident,garmin_d108_color(x->color),
-	  (x->dspl) ? "true" : "false");
+  print_spaces(out,spaces);
+  print_format(out,"<track type=\"310\" ident=\"%s\" color=\"%s\" "
+	       "display=\"%s\"/>\n",
+	       x->trk_ident,garmin_d108_color(x->color),
+	       (x->dspl) ? "true" : "false");
 }
 
 
@@ -1105,10 +1558,12 @@ garmin_print_d310 ( D310 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d311 ( D311 * h, FILE * fp, int spaces )
+garmin_print_d311 ( D311 * h, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<track type=\"311\" index=\"%d\"/>\n",h->index);
+  print_spaces(out,spaces);
+  print_string(out,"<track type=\"311\" index=\"");
+  print_int(out,h->index);
+  print_string(out,"\"/>\n");
 }
 
 
@@ -1140,16 +1595,16 @@ GARMIN_ENUM_NAME(312,color) {
 
 
 static void
-garmin_print_d312 ( D312 * h,
-		    FILE *              fp,
-		    int                 spaces )
+garmin_print_d312 ( D312 *             h,
+		    garmin_printer *   out,
+		    int                spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<track type=\"312\" ident=\"%s\" color=\"%s\" "
-	  "display=\"%s\"/>\n",
-	  h->trk_ident,
-	  garmin_d312_color(h->color),
-	  (h->dspl) ? "true" : "false");
+  print_spaces(out,spaces);
+  print_format(out,"<track type=\"312\" ident=\"%s\" color=\"%s\" "
+	       "display=\"%s\"/>\n",
+	       h->trk_ident,
+	       garmin_d312_color(h->color),
+	       (h->dspl) ? "true" : "false");
 }
 
 
@@ -1158,12 +1613,12 @@ garmin_print_d312 ( D312 * h,
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d400 ( D400 * x, FILE * fp, int spaces )
+garmin_print_d400 ( D400 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("proximity_waypoint",400,fp,spaces);
-  garmin_print_d100(&x->wpt,fp,spaces+1);
+  open_tag_with_type("proximity_waypoint",400,out,spaces);
+  garmin_print_d100(&x->wpt,out,spaces+1);
   GARMIN_TAGF32(1,"distance",x->dst);
-  close_tag("proximity_waypoint",fp,spaces);
+  close_tag("proximity_waypoint",out,spaces);
 }
 
 
@@ -1172,12 +1627,12 @@ garmin_print_d400 ( D400 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d403 ( D403 * x, FILE * fp, int spaces )
+garmin_print_d403 ( D403 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("proximity_waypoint",403,fp,spaces);
-  garmin_print_d103(&x->wpt,fp,spaces+1);
+  open_tag_with_type("proximity_waypoint",403,out,spaces);
+  garmin_print_d103(&x->wpt,out,spaces+1);
   GARMIN_TAGF32(1,"distance",x->dst);
-  close_tag("proximity_waypoint",fp,spaces);
+  close_tag("proximity_waypoint",out,spaces);
 }
 
 
@@ -1186,13 +1641,13 @@ garmin_print_d403 ( D403 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d450 ( D450 * x, FILE * fp, int spaces )
+garmin_print_d450 ( D450 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("proximity_waypoint",450,fp,spaces);
+  open_tag_with_type("proximity_waypoint",450,out,spaces);
   GARMIN_TAGINT(1,"index",x->idx);
-  garmin_print_d150(&x->wpt,fp,spaces+1);
+  garmin_print_d150(&x->wpt,out,spaces+1);
   GARMIN_TAGF32(1,"distance",x->dst);
-  close_tag("proximity_waypoint",fp,spaces);
+  close_tag("proximity_waypoint",out,spaces);
 
 }
 
@@ -1202,9 +1657,9 @@ garmin_print_d450 ( D450 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d500 ( D500 * x, FILE * fp, int spaces )
+garmin_print_d500 ( D500 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("almanac",500,fp,spaces);
+  open_tag_with_type("almanac",500,out,spaces);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
   GARMIN_TAGF32(1,"afo",x->af0);
@@ -1216,7 +1671,7 @@ garmin_print_d500 ( D500 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"omg0",x->omg0);
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1225,9 +1680,9 @@ garmin_print_d500 ( D500 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d501 ( D501 * x, FILE * fp, int spaces )
+garmin_print_d501 ( D501 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("almanac",501,fp,spaces);
+  open_tag_with_type("almanac",501,out,spaces);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
   GARMIN_TAGF32(1,"afo",x->af0);
@@ -1240,7 +1695,7 @@ garmin_print_d501 ( D501 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
   GARMIN_TAGINT(1,"hlth",x->hlth);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1249,9 +1704,9 @@ garmin_print_d501 ( D501 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d550 ( D550 * x, FILE * fp, int spaces )
+garmin_print_d550 ( D550 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("almanac",550,fp,spaces);
+  open_tag_with_type("almanac",550,out,spaces);
   GARMIN_TAGINT(1,"svid",x->svid);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
@@ -1264,7 +1719,7 @@ garmin_print_d550 ( D550 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"omg0",x->omg0);
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1273,9 +1728,9 @@ garmin_print_d550 ( D550 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d551 ( D551 * x, FILE * fp, int spaces )
+garmin_print_d551 ( D551 * x, garmin_printer * out, int spaces )
 {
-  open_tag_with_type("almanac",551,fp,spaces);
+  open_tag_with_type("almanac",551,out,spaces);
   GARMIN_TAGINT(1,"svid",x->svid);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
@@ -1289,7 +1744,7 @@ garmin_print_d551 ( D551 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
   GARMIN_TAGINT(1,"hlth",x->hlth);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1298,12 +1753,12 @@ garmin_print_d551 ( D551 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d600 ( D600 * x, FILE * fp, int spaces )
+garmin_print_d600 ( D600 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<date_time type=\"600\">"
-	  "%04d-%02d-%02d %02d:%02d:%02d</date_time>\n",
-	  x->year,x->month,x->day,x->hour,x->minute,x->second);
+  print_spaces(out,spaces);
+  print_format(out,"<date_time type=\"600\">"
+	       "%04d-%02d-%02d %02d:%02d:%02d</date_time>\n",
+	       x->year,x->month,x->day,x->hour,x->minute,x->second);
 }
 
 
@@ -1312,9 +1767,9 @@ garmin_print_d600 ( D600 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d650 ( D650 * x, FILE * fp, int spaces )
+garmin_print_d650 ( D650 * x, garmin_printer * out, int spaces )
 {
-  open_tag("flightbook type=\"650\"",fp,spaces);
+  open_tag("flightbook type=\"650\"",out,spaces);
   GARMIN_TAGU32(1,"takeoff_time",x->takeoff_time + TIME_OFFSET);
   GARMIN_TAGU32(1,"landing_time",x->takeoff_time + TIME_OFFSET);
   GARMIN_TAGPOS(1,"takeoff_position",x->takeoff_posn);
@@ -1331,7 +1786,7 @@ garmin_print_d650 ( D650 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"arrival_name",x->arrival_name);
   GARMIN_TAGSTR(1,"arrival_ident",x->arrival_ident);
   GARMIN_TAGSTR(1,"ac_id",x->ac_id);
-  close_tag("flightbook",fp,spaces);
+  close_tag("flightbook",out,spaces);
 }
 
 
@@ -1340,11 +1795,11 @@ garmin_print_d650 ( D650 * x, FILE * fp, int spaces )
 /* ------------------------------------------------------------------------- */
 
 static void
-garmin_print_d700 ( D700 * x, FILE * fp, int spaces )
+garmin_print_d700 ( D700 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<position type=\"700\" lat=\"%f\" lon=\"%f\"/>\n",
-	  RAD2DEG(x->lat),RAD2DEG(x->lon));
+  print_spaces(out,spaces);
+  print_format(out,"<position type=\"700\" lat=\"%f\" lon=\"%f\"/>\n",
+	       RAD2DEG(x->lat),RAD2DEG(x->lon));
 }
 
 
@@ -1365,28 +1820,28 @@ GARMIN_ENUM_NAME(800,fix) {
 
 
 static void
-garmin_print_d800 ( D800 * x, FILE * fp, int spaces )
+garmin_print_d800 ( D800 * x, garmin_printer * out, int spaces )
 {
-  open_tag("pvt type=\"800\"",fp,spaces);
+  open_tag("pvt type=\"800\"",out,spaces);
   GARMIN_TAGF32(1,"alt",x->alt);
   GARMIN_TAGF32(1,"epe",x->epe);
   GARMIN_TAGF32(1,"eph",x->eph);
   GARMIN_TAGF32(1,"epv",x->epv);
   GARMIN_TAGSTR(1,"position_fix",garmin_d800_fix(x->fix));
-  garmin_print_d700(&x->posn,fp,spaces+1);
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<velocity east=\"");
-  garmin_print_float32(x->east,fp);
-  fprintf(fp,"\" north=\"");
-  garmin_print_float32(x->north,fp);
-  fprintf(fp,"\" up=\"");
-  garmin_print_float32(x->up,fp);
-  fprintf(fp,"\"/>\n");
+  garmin_print_d700(&x->posn,out,spaces+1);
+  print_spaces(out,spaces+1);
+  print_string(out,"<velocity east=\"");
+  garmin_print_float32(x->east,out);
+  print_string(out,"\" north=\"");
+  garmin_print_float32(x->north,out);
+  print_string(out,"\" up=\"");
+  garmin_print_float32(x->up,out);
+  print_string(out,"\"/>\n");
   GARMIN_TAGF32(1,"msl_height",x->msl_hght);
   GARMIN_TAGINT(1,"leap_seconds",x->leap_scnds);
   GARMIN_TAGU32(1,"week_number_days",x->wn_days);
   GARMIN_TAGF64(1,"time_of_week",x->tow);
-  close_tag("pvt",fp,spaces);
+  close_tag("pvt",out,spaces);
 }
 
 
@@ -1395,13 +1850,13 @@ garmin_print_d800 ( D800 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d906 ( D906 * x, FILE * fp, int spaces )
+garmin_print_d906 ( D906 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"906\"");
-  garmin_print_dtime(x->start_time,fp,"start");
-  garmin_print_ddist(x->total_time,x->total_distance,fp);
-  fprintf(fp,">\n");
+  print_spaces(out,spaces);
+  print_string(out,"<lap type=\"906\"");
+  garmin_print_dtime(x->start_time,out,"start");
+  garmin_print_ddist(x->total_time,x->total_distance,out);
+  print_string(out,">\n");
 
   if ( x->begin.lat != 0x7fffffff && x->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",x->begin);
@@ -1425,7 +1880,7 @@ garmin_print_d906 ( D906 * x, FILE * fp, int spaces )
     break;
   }
 
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
@@ -1434,7 +1889,7 @@ garmin_print_d906 ( D906 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 
-static void garmin_print_d1002 ( D1002 * x, FILE * fp, int spaces );
+static void garmin_print_d1002 ( D1002 * x, garmin_printer * out, int spaces );
 
 
 GARMIN_ENUM_NAME(1000,sport_type) {
@@ -1454,27 +1909,27 @@ GARMIN_ENUM_NAME(1000,program_type) {
 
 
 static void
-garmin_print_d1000 ( D1000 * x, FILE * fp, int spaces )
+garmin_print_d1000 ( D1000 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<run type=\"1000\" track=\"%d\" sport=\"%s\">\n",
-	  x->track_index,garmin_d1000_sport_type(x->sport_type));
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<laps first=\"%u\" last=\"%u\"/>\n",
-	  x->first_lap_index, x->last_lap_index);
+  print_spaces(out,spaces);
+  print_format(out,"<run type=\"1000\" track=\"%d\" sport=\"%s\">\n",
+	       x->track_index,garmin_d1000_sport_type(x->sport_type));
+  print_spaces(out,spaces+1);
+  print_format(out,"<laps first=\"%u\" last=\"%u\"/>\n",
+	       x->first_lap_index, x->last_lap_index);
   GARMIN_TAGSTR(1,"program_type",
 		garmin_d1000_program_type(x->program_type));
   if ( x->program_type == D1000_virtual_partner ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
-	    x->virtual_partner.time, x->virtual_partner.distance);
+    print_spaces(out,spaces+1);
+    print_format(out,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
+		 x->virtual_partner.time, x->virtual_partner.distance);
   }
   if ( x->program_type == D1000_workout ) {
-    garmin_print_d1002(&x->workout,fp,spaces+1);
+    garmin_print_d1002(&x->workout,out,spaces+1);
   }
-  close_tag("run",fp,spaces);
+  close_tag("run",out,spaces);
 
-  garmin_print_d1002(&x->workout,fp,spaces+1);
+  garmin_print_d1002(&x->workout,out,spaces+1);
 }
 
 
@@ -1491,13 +1946,13 @@ GARMIN_ENUM_NAME(1001,intensity) {
 
 
 static void
-garmin_print_d1001 ( D1001 * x, FILE * fp, int spaces )
+garmin_print_d1001 ( D1001 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"1001\" index=\"%d\"",x->index);
-  garmin_print_dtime(x->start_time,fp,"start");
-  garmin_print_ddist(x->total_time,x->total_dist,fp);
-  fprintf(fp,">\n");
+  print_spaces(out,spaces);
+  print_format(out,"<lap type=\"1001\" index=\"%d\"",x->index);
+  garmin_print_dtime(x->start_time,out,"start");
+  garmin_print_ddist(x->total_time,x->total_dist,out);
+  print_string(out,">\n");
   if ( x->begin.lat != 0x7fffffff && x->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",x->begin);
   }
@@ -1513,7 +1968,7 @@ garmin_print_d1001 ( D1001 * x, FILE * fp, int spaces )
     GARMIN_TAGINT(1,"max_hr",x->max_heart_rate);
   }
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(x->intensity));
-  close_tag("lap",fp,spaces);  
+  close_tag("lap",out,spaces);  
 }
 
 
@@ -1535,59 +1990,59 @@ GARMIN_ENUM_NAME(1002,duration_type) {
 
 
 static void
-garmin_print_d1002 ( D1002 * x, FILE * fp, int spaces )
+garmin_print_d1002 ( D1002 * x, garmin_printer * out, int spaces )
 {
   int i;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,"<workout type=\"1002\" name=\"%s\" steps=\"%d\" "
-	  "sport_type=\"%s\"",
-	  x->name,x->num_valid_steps,garmin_d1000_sport_type(x->sport_type));
+  print_spaces(out,spaces);
+  print_format(out,"<workout type=\"1002\" name=\"%s\" steps=\"%d\" "
+	       "sport_type=\"%s\"",
+	       x->name,x->num_valid_steps,garmin_d1000_sport_type(x->sport_type));
   if ( x->num_valid_steps > 0 ) {
-    fprintf(fp,">\n");
+    print_string(out,">\n");
     for ( i = 0; i < x->num_valid_steps; i++ ) {
-      print_spaces(fp,spaces+1);
-      fprintf(fp,"<step name=\"%s\">\n",x->steps[i].custom_name);
+      print_spaces(out,spaces+1);
+      print_format(out,"<step name=\"%s\">\n",x->steps[i].custom_name);
       GARMIN_TAGSTR(1,"intensity",
 		    garmin_d1001_intensity(x->steps[i].intensity));
-      print_spaces(fp,spaces+1);
-      fprintf(fp,"<duration type=\"%s\">%d</duration>\n",
-	      garmin_d1002_duration_type(x->steps[i].duration_type),
-	      x->steps[i].duration_value);
-      print_spaces(fp,spaces+1);
+      print_spaces(out,spaces+1);
+      print_format(out,"<duration type=\"%s\">%d</duration>\n",
+		   garmin_d1002_duration_type(x->steps[i].duration_type),
+		   x->steps[i].duration_value);
+      print_spaces(out,spaces+1);
       if ( x->steps[i].duration_type == D1002_repeat ) {
 	switch ( x->steps[i].target_type ) {
 	case 0:
-	  fprintf(fp,"<target type=\"speed_zone\" "
-		  "value=\"%d\" low=\"%f m/s\" high=\"%f m/s\"/>\n",
-		  x->steps[i].target_value,
-		  x->steps[i].target_custom_zone_low,
-		  x->steps[i].target_custom_zone_high);
+	  print_format(out,"<target type=\"speed_zone\" "
+		       "value=\"%d\" low=\"%f m/s\" high=\"%f m/s\"/>\n",
+		       x->steps[i].target_value,
+		       x->steps[i].target_custom_zone_low,
+		       x->steps[i].target_custom_zone_high);
 	  break;
 	case 1:
-	  fprintf(fp,"<target type=\"heart_rate_zone\" "
-		  "value=\"%d\" low=\"%f%s\" high=\"%f%s\"/>\n",
-		  x->steps[i].target_value,
-		  x->steps[i].target_custom_zone_low,
-		  (x->steps[i].target_custom_zone_low <= 100) ? "%" : " bpm",
-		  x->steps[i].target_custom_zone_high,
-		  (x->steps[i].target_custom_zone_high <= 100) ? "%" : " bpm");
+	  print_format(out,"<target type=\"heart_rate_zone\" "
+		       "value=\"%d\" low=\"%f%s\" high=\"%f%s\"/>\n",
+		       x->steps[i].target_value,
+		       x->steps[i].target_custom_zone_low,
+		       (x->steps[i].target_custom_zone_low <= 100) ? "%" : " bpm",
+		       x->steps[i].target_custom_zone_high,
+		       (x->steps[i].target_custom_zone_high <= 100) ? "%" : " bpm");
 	  break;
 	case 2:
-	  fprintf(fp,"<target type=\"open\"/>\n");
+	  print_string(out,"<target type=\"open\"/>\n");
 	  break;
 	default:
 	  break;
 	}
       } else {
-	fprintf(fp,"<target type=\"repetitions\" value=\"%d\"/>\n",
-		x->steps[i].target_value);
+	print_format(out,"<target type=\"repetitions\" value=\"%d\"/>\n",
+		     x->steps[i].target_value);
       }
-      close_tag("step",fp,spaces+1);
+      close_tag("step",out,spaces+1);
     }
-    close_tag("workout",fp,spaces);
+    close_tag("workout",out,spaces);
   } else {
-    fprintf(fp,"/>\n");
+    print_string(out,"/>\n");
   }
 }
 
@@ -1597,11 +2052,11 @@ garmin_print_d1002 ( D1002 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1003 ( D1003 * x, FILE * fp, int spaces )
+garmin_print_d1003 ( D1003 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<workout_occurrence type=\"1003\" name=\"%s\" day=\"%u\"/>\n",
-	  x->workout_name,x->day);
+  print_spaces(out,spaces);
+  print_format(out,"<workout_occurrence type=\"1003\" name=\"%s\" day=\"%u\"/>\n",
+	       x->workout_name,x->day);
 }
 
 
@@ -1610,47 +2065,47 @@ garmin_print_d1003 ( D1003 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1004 ( D1004 *  d, FILE * fp, int spaces )
+garmin_print_d1004 ( D1004 *  d, garmin_printer * out, int spaces )
 {
   int i;
   int j;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,
-	  "<fitness_user_profile type=\"1004\" weight=\"%f\" "
-	  "birth_date=\"%04d-%02d-%02d\" gender=\"%s\">\n",
-	  d->weight,
-	  d->birth_year,
-	  d->birth_month,
-	  d->birth_day,
-	  (d->gender == D1004_male) ? "male" : "female");
-  open_tag("activities",fp,spaces+1);
+  print_spaces(out,spaces);
+  print_format(out,
+	       "<fitness_user_profile type=\"1004\" weight=\"%f\" "
+	       "birth_date=\"%04d-%02d-%02d\" gender=\"%s\">\n",
+	       d->weight,
+	       d->birth_year,
+	       d->birth_month,
+	       d->birth_day,
+	       (d->gender == D1004_male) ? "male" : "female");
+  open_tag("activities",out,spaces+1);
   for ( i = 0; i < 3; i++ ) {
-    print_spaces(fp,spaces+2);
-    fprintf(fp,"<activity gear_weight=\"%f\" max_hr=\"%d\">\n",
-	    d->activities[i].gear_weight,
-	    d->activities[i].max_heart_rate);
-    open_tag("hr_zones",fp,spaces+3);
+    print_spaces(out,spaces+2);
+    print_format(out,"<activity gear_weight=\"%f\" max_hr=\"%d\">\n",
+		 d->activities[i].gear_weight,
+		 d->activities[i].max_heart_rate);
+    open_tag("hr_zones",out,spaces+3);
     for ( j = 0; j < 5; j++ ) {
-      print_spaces(fp,spaces+4);
-      fprintf(fp,"<hr_zone low=\"%d\" high=\"%d\"/>\n",
-	      d->activities[i].heart_rate_zones[j].low_heart_rate,
-	      d->activities[i].heart_rate_zones[j].high_heart_rate);
+      print_spaces(out,spaces+4);
+      print_format(out,"<hr_zone low=\"%d\" high=\"%d\"/>\n",
+		   d->activities[i].heart_rate_zones[j].low_heart_rate,
+		   d->activities[i].heart_rate_zones[j].high_heart_rate);
     }
-    close_tag("hr_zones",fp,spaces+3);
-    open_tag("speed_zones",fp,spaces+3);
+    close_tag("hr_zones",out,spaces+3);
+    open_tag("speed_zones",out,spaces+3);
     for ( j = 0; j < 10; j++ ) {
-      print_spaces(fp,spaces+4);
-      fprintf(fp,"<speed_zone low=\"%f\" high=\"%f\" name=\"%s\"/>\n",
-	      d->activities[i].speed_zones[j].low_speed,
-	      d->activities[i].speed_zones[j].high_speed,
-	      d->activities[i].speed_zones[j].name);
+      print_spaces(out,spaces+4);
+      print_format(out,"<speed_zone low=\"%f\" high=\"%f\" name=\"%s\"/>\n",
+		   d->activities[i].speed_zones[j].low_speed,
+		   d->activities[i].speed_zones[j].high_speed,
+		   d->activities[i].speed_zones[j].name);
     }
-    close_tag("speed_zones",fp,spaces+3);
-    close_tag("activity",fp,spaces+2);
+    close_tag("speed_zones",out,spaces+3);
+    close_tag("activity",out,spaces+2);
   }
-  close_tag("activities",fp,spaces+1);
-  close_tag("fitness_user_profile",fp,spaces);
+  close_tag("activities",out,spaces+1);
+  close_tag("fitness_user_profile",out,spaces);
 }
 
 
@@ -1659,15 +2114,15 @@ garmin_print_d1004 ( D1004 *  d, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1005 ( D1005 * limits, FILE * fp, int spaces )
+garmin_print_d1005 ( D1005 * limits, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,
-	  "<workout_limits type=\"1005\" workouts=\"%d\" unscheduled=\"%d\" "
-	  "occurrences=\"%d\"/>\n",
-	  limits->max_workouts,
-	  limits->max_unscheduled_workouts,
-	  limits->max_occurrences);
+  print_spaces(out,spaces);
+  print_format(out,
+	       "<workout_limits type=\"1005\" workouts=\"%d\" unscheduled=\"%d\" "
+	       "occurrences=\"%d\"/>\n",
+	       limits->max_workouts,
+	       limits->max_unscheduled_workouts,
+	       limits->max_occurrences);
 }
 
 
@@ -1676,14 +2131,14 @@ garmin_print_d1005 ( D1005 * limits, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1006 ( D1006 * x, FILE * fp, int spaces )
+garmin_print_d1006 ( D1006 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course type=\"1006\" index=\"%d\" name=\"%s\" "
-	  "track_index=\"%d\"/>\n",
-	  x->index,
-	  x->course_name,
-	  x->track_index);
+  print_spaces(out,spaces);
+  print_format(out,"<course type=\"1006\" index=\"%d\" name=\"%s\" "
+	       "track_index=\"%d\"/>\n",
+	       x->index,
+	       x->course_name,
+	       x->track_index);
 }
 
 
@@ -1692,14 +2147,14 @@ garmin_print_d1006 ( D1006 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1007 ( D1007 * x, FILE * fp, int spaces )
+garmin_print_d1007 ( D1007 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course_lap type=\"1007\" course_index=\"%d\" lap_index=\"%d\"",
-	  x->course_index,
-	  x->lap_index);
-  garmin_print_ddist(x->total_time,x->total_dist,fp);
-  fprintf(fp,">\n");
+  print_spaces(out,spaces);
+  print_format(out,"<course_lap type=\"1007\" course_index=\"%d\" lap_index=\"%d\"",
+	       x->course_index,
+	       x->lap_index);
+  garmin_print_ddist(x->total_time,x->total_dist,out);
+  print_string(out,">\n");
   if ( x->begin.lat != 0x7fffffff && x->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",x->begin);
   }
@@ -1711,7 +2166,7 @@ garmin_print_d1007 ( D1007 * x, FILE * fp, int spaces )
   if ( x->avg_cadence != 0xff ) GARMIN_TAGINT(1,"avg_cadence",x->avg_cadence);
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(x->intensity));
 
-  close_tag("course_lap",fp,spaces);
+  close_tag("course_lap",out,spaces);
 }
 
 
@@ -1721,11 +2176,11 @@ garmin_print_d1007 ( D1007 * x, FILE * fp, int spaces )
 
 
 static void
-garmin_print_d1008 ( D1008 * w, FILE * fp, int spaces )
+garmin_print_d1008 ( D1008 * w, garmin_printer * out, int spaces )
 {
   /* For some reason, D1008 is identical to D1002. */
 
-  garmin_print_d1002((D1002 *)w,fp,spaces);
+  garmin_print_d1002((D1002 *)w,out,spaces);
 }
 
 
@@ -1743,54 +2198,54 @@ GARMIN_ENUM_NAME(1009,multisport) {
 
 
 static void
-garmin_print_d1009 ( D1009 * run, FILE * fp, int spaces )
+garmin_print_d1009 ( D1009 * run, garmin_printer * out, int spaces )
 {
   int npt = 0;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,"<run type=\"1009\" track=\"%d\" sport=\"%s\" "
-	  "multisport=\"%s\">\n",
-	  run->track_index,garmin_d1000_sport_type(run->sport_type),
-	  garmin_d1009_multisport(run->multisport));
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<laps first=\"%u\" last=\"%u\"/>\n",
-	  run->first_lap_index, run->last_lap_index);
+  print_spaces(out,spaces);
+  print_format(out,"<run type=\"1009\" track=\"%d\" sport=\"%s\" "
+	       "multisport=\"%s\">\n",
+	       run->track_index,garmin_d1000_sport_type(run->sport_type),
+	       garmin_d1009_multisport(run->multisport));
+  print_spaces(out,spaces+1);
+  print_format(out,"<laps first=\"%u\" last=\"%u\"/>\n",
+	       run->first_lap_index, run->last_lap_index);
 
   if ( run->program_type != 0 ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<program_type>");
+    print_spaces(out,spaces+1);
+    print_string(out,"<program_type>");
     if ( run->program_type & 0x01 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "virtual_partner");
+      print_format(out,"%s%s",(npt++) ? ", " : "", "virtual_partner");
     }
     if ( run->program_type & 0x02 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "workout");
+      print_format(out,"%s%s",(npt++) ? ", " : "", "workout");
     }
     if ( run->program_type & 0x04 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "quick_workout");
+      print_format(out,"%s%s",(npt++) ? ", " : "", "quick_workout");
     } 
     if ( run->program_type & 0x08 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "course");
+      print_format(out,"%s%s",(npt++) ? ", " : "", "course");
     }
     if ( run->program_type & 0x10 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "interval_workout");
+      print_format(out,"%s%s",(npt++) ? ", " : "", "interval_workout");
     }
     if ( run->program_type & 0x20 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "auto_multisport");
+      print_format(out,"%s%s",(npt++) ? ", " : "", "auto_multisport");
     }
-    fprintf(fp,"</program_type>\n");
+    print_string(out,"</program_type>\n");
   }  
 
   if ( run->program_type & 0x02 ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<quick_workout time=\"%u\" distance=\"%f\"/>\n",
-	    run->quick_workout.time, run->quick_workout.distance);
+    print_spaces(out,spaces+1);
+    print_format(out,"<quick_workout time=\"%u\" distance=\"%f\"/>\n",
+		 run->quick_workout.time, run->quick_workout.distance);
   }
 
   if ( run->program_type & 0x01 ) {
-    garmin_print_d1008(&run->workout,fp,spaces+1);
+    garmin_print_d1008(&run->workout,out,spaces+1);
   }
 
-  close_tag("run",fp,spaces);
+  close_tag("run",out,spaces);
 }
 
 
@@ -1809,25 +2264,25 @@ GARMIN_ENUM_NAME(1010,program_type) {
 
 
 static void
-garmin_print_d1010 ( D1010 * x, FILE * fp, int spaces )
+garmin_print_d1010 ( D1010 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<run type=\"1010\" track=\"%d\" sport=\"%s\" "
-	  "multisport=\"%s\">\n",
-	  x->track_index,garmin_d1000_sport_type(x->sport_type),
-	  garmin_d1009_multisport(x->multisport));
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<laps first=\"%u\" last=\"%u\"/>\n",
-	  x->first_lap_index, x->last_lap_index);
+  print_spaces(out,spaces);
+  print_format(out,"<run type=\"1010\" track=\"%d\" sport=\"%s\" "
+	       "multisport=\"%s\">\n",
+	       x->track_index,garmin_d1000_sport_type(x->sport_type),
+	       garmin_d1009_multisport(x->multisport));
+  print_spaces(out,spaces+1);
+  print_format(out,"<laps first=\"%u\" last=\"%u\"/>\n",
+	       x->first_lap_index, x->last_lap_index);
   GARMIN_TAGSTR(1,"program_type",
 		garmin_d1010_program_type(x->program_type));
   if ( x->program_type == D1010_virtual_partner ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
-	    x->virtual_partner.time, x->virtual_partner.distance);
+    print_spaces(out,spaces+1);
+    print_format(out,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
+		 x->virtual_partner.time, x->virtual_partner.distance);
   }
-  garmin_print_d1002(&x->workout,fp,spaces+1);
-  close_tag("run",fp,spaces);
+  garmin_print_d1002(&x->workout,out,spaces+1);
+  close_tag("run",out,spaces);
 }
 
 
@@ -1847,14 +2302,14 @@ GARMIN_ENUM_NAME(1011,trigger_method) {
 
 
 static void
-garmin_print_d1011 ( D1011 * lap, FILE * fp, int spaces )
+garmin_print_d1011 ( D1011 * lap, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"1011\" index=\"%d\"",lap->index);
-  garmin_print_dtime(lap->start_time,fp,"start");
-  garmin_print_ddist(lap->total_time,lap->total_dist,fp);
-  fprintf(fp," trigger=\"%s\">\n",
-	  garmin_d1011_trigger_method(lap->trigger_method));
+  print_spaces(out,spaces);
+  print_format(out,"<lap type=\"1011\" index=\"%d\"",lap->index);
+  garmin_print_dtime(lap->start_time,out,"start");
+  garmin_print_ddist(lap->total_time,lap->total_dist,out);
+  print_format(out," trigger=\"%s\">\n",
+	       garmin_d1011_trigger_method(lap->trigger_method));
   if ( lap->begin.lat != 0x7fffffff && lap->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",lap->begin);
   }
@@ -1873,7 +2328,7 @@ garmin_print_d1011 ( D1011 * lap, FILE * fp, int spaces )
     GARMIN_TAGINT(1,"avg_cadence",lap->avg_cadence);
   }
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(lap->intensity));
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
@@ -1904,15 +2359,15 @@ GARMIN_ENUM_NAME(1012,point_type) {
 
 
 static void
-garmin_print_d1012 ( D1012 * x, FILE * fp, int spaces )
+garmin_print_d1012 ( D1012 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course_point type=\"1012\" course_index=\"%d\" "
-	  "name=\"%s\" type=\"%s\">\n",
-	  x->course_index,x->name,
-	  garmin_d1012_point_type(x->point_type));
+  print_spaces(out,spaces);
+  print_format(out,"<course_point type=\"1012\" course_index=\"%d\" "
+	       "name=\"%s\" type=\"%s\">\n",
+	       x->course_index,x->name,
+	       garmin_d1012_point_type(x->point_type));
   GARMIN_TAGU32(1,"track_point_time",x->track_point_time);
-  close_tag("course_point",fp,spaces);
+  close_tag("course_point",out,spaces);
 }
 
 
@@ -1921,15 +2376,15 @@ garmin_print_d1012 ( D1012 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1013 ( D1013 * x, FILE * fp, int spaces )
+garmin_print_d1013 ( D1013 * x, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course_limits type=\"1013\" courses=\"%d\" laps=\"%d\" "
-	  "points=\"%d\" track_points=\"%d\"/>\n",
-	  x->max_courses,
-	  x->max_course_laps,
-	  x->max_course_pnt,
-	  x->max_course_trk_pnt);
+  print_spaces(out,spaces);
+  print_format(out,"<course_limits type=\"1013\" courses=\"%d\" laps=\"%d\" "
+	       "points=\"%d\" track_points=\"%d\"/>\n",
+	       x->max_courses,
+	       x->max_course_laps,
+	       x->max_course_pnt,
+	       x->max_course_trk_pnt);
 }
 
 
@@ -1938,14 +2393,14 @@ garmin_print_d1013 ( D1013 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1015 ( D1015 * lap, FILE * fp, int spaces )
+garmin_print_d1015 ( D1015 * lap, garmin_printer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"1015\" index=\"%d\"",lap->index);
-  garmin_print_dtime(lap->start_time,fp,"start");
-  garmin_print_ddist(lap->total_time,lap->total_dist,fp);
-  fprintf(fp," trigger=\"%s\">\n",
-	  garmin_d1011_trigger_method(lap->trigger_method));
+  print_spaces(out,spaces);
+  print_format(out,"<lap type=\"1015\" index=\"%d\"",lap->index);
+  garmin_print_dtime(lap->start_time,out,"start");
+  garmin_print_ddist(lap->total_time,lap->total_dist,out);
+  print_format(out," trigger=\"%s\">\n",
+	       garmin_d1011_trigger_method(lap->trigger_method));
   if ( lap->begin.lat != 0x7fffffff && lap->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",lap->begin);
   }
@@ -1965,183 +2420,119 @@ garmin_print_d1015 ( D1015 * lap, FILE * fp, int spaces )
   }
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(lap->intensity));
   GARMIN_TAGU8B(1,"unknown",lap->unknown,5);  
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
-/* ========================================================================= */
-/* garmin_print_data                                                         */
-/* ========================================================================= */
-
-void
-garmin_print_data ( garmin_data * d, FILE * fp, int spaces )
+static void
+print_data ( garmin_data * d, garmin_printer * out, int spaces )
 {
-#define CASE_PRINT(x) \
-  case data_D##x: garmin_print_d##x(d->data,fp,spaces); break
-
   switch ( d->type ) {
-  CASE_PRINT(list);
-  CASE_PRINT(100);
-  CASE_PRINT(101);
-  CASE_PRINT(102);
-  CASE_PRINT(103);
-  CASE_PRINT(104);
-  CASE_PRINT(105);
-  CASE_PRINT(106);
-  CASE_PRINT(107);
-  CASE_PRINT(108);
-  CASE_PRINT(109);
-  CASE_PRINT(110);
-  CASE_PRINT(120);
-  CASE_PRINT(150);
-  CASE_PRINT(151);
-  CASE_PRINT(152);
-  CASE_PRINT(154);
-  CASE_PRINT(155);
-  CASE_PRINT(200);
-  CASE_PRINT(201);
-  CASE_PRINT(202);
-  CASE_PRINT(210);
-  CASE_PRINT(300);
-  CASE_PRINT(301);
-  CASE_PRINT(302);
-  CASE_PRINT(303);
-  CASE_PRINT(304);
-  CASE_PRINT(310);
-  CASE_PRINT(311);
-  CASE_PRINT(312);
-  CASE_PRINT(400);
-  CASE_PRINT(403);
-  CASE_PRINT(450);
-  CASE_PRINT(500);
-  CASE_PRINT(501);
-  CASE_PRINT(550);
-  CASE_PRINT(551);
-  CASE_PRINT(600);
-  CASE_PRINT(650);
-  CASE_PRINT(700);
-  CASE_PRINT(800);
-  CASE_PRINT(906);
-  CASE_PRINT(1000);
-  CASE_PRINT(1001);
-  CASE_PRINT(1002);
-  CASE_PRINT(1003);
-  CASE_PRINT(1004);
-  CASE_PRINT(1005);
-  CASE_PRINT(1006);
-  CASE_PRINT(1007);
-  CASE_PRINT(1008);
-  CASE_PRINT(1009);
-  CASE_PRINT(1010);
-  CASE_PRINT(1011);
-  CASE_PRINT(1012);
-  CASE_PRINT(1013);
-  CASE_PRINT(1015);
+  case data_Dlist:
+    garmin_print_dlist(d->data,out,spaces);
+    break;
+#define RECORD(x) \
+  case data_D##x: garmin_print_d##x(d->data,out,spaces); break;
+#include "schema.h"
   default:
-    print_spaces(fp,spaces);
-    fprintf(fp,"<data type=\"%d\"/>\n",d->type);
+    print_spaces(out,spaces);
+    print_format(out,"<data type=\"%d\"/>\n",d->type);
     break;
   }
-
-#undef CASE_PRINT
 }
 
 
-/* ========================================================================= */
-/* garmin_print_protocols                                                    */
-/* ========================================================================= */
-
-void
-garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
+static void
+print_protocols ( garmin_unit * garmin, garmin_printer * out, int spaces )
 {
 #define PROTO1_AND_DATA(x)                                                \
   do {                                                                    \
     if ( garmin->protocol.x != appl_Anil ) {                              \
-      print_spaces(fp,spaces+1);                                          \
-      fprintf(fp,"<garmin_" #x                                            \
-	      " protocol=\"A%03d\" " #x "=\"D%03d\"/>\n",                 \
-	      garmin->protocol.x, garmin->datatype.x);                    \
+      print_spaces(out,spaces+1);                                         \
+      print_format(out,"<garmin_" #x                                      \
+		   " protocol=\"A%03d\" " #x "=\"D%03d\"/>\n",            \
+		   garmin->protocol.x, garmin->datatype.x);               \
     }                                                                     \
   } while ( 0 )
 
 #define PROTO2_AND_DATA(x,y)                                              \
   do {                                                                    \
     if ( garmin->protocol.x.y != appl_Anil ) {                            \
-      print_spaces(fp,spaces+2);                                          \
-      fprintf(fp,"<garmin_" #x "_" #y                                     \
-	      " protocol=\"A%03d\" " #y "=\"D%03d\"/>\n",                 \
-	      garmin->protocol.x.y, garmin->datatype.x.y);                \
+      print_spaces(out,spaces+2);                                         \
+      print_format(out,"<garmin_" #x "_" #y                               \
+		   " protocol=\"A%03d\" " #y "=\"D%03d\"/>\n",            \
+		   garmin->protocol.x.y, garmin->datatype.x.y);           \
     }                                                                     \
   } while ( 0 )
 
-  open_tag("garmin_protocols",fp,spaces);
+  open_tag("garmin_protocols",out,spaces);
 
   /* Physical */
 
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_physical protocol=\"P%03d\"/>\n",
-	  garmin->protocol.physical);
+  print_spaces(out,spaces+1);
+  print_format(out,"<garmin_physical protocol=\"P%03d\"/>\n",
+	       garmin->protocol.physical);
 
   /* Link */
 
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_link protocol=\"L%03d\"/>\n",
-	  garmin->protocol.link);
+  print_spaces(out,spaces+1);
+  print_format(out,"<garmin_link protocol=\"L%03d\"/>\n",
+	       garmin->protocol.link);
 
   /* Command */
 
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_command protocol=\"A%03d\"/>\n",
-	  garmin->protocol.command);
+  print_spaces(out,spaces+1);
+  print_format(out,"<garmin_command protocol=\"A%03d\"/>\n",
+	       garmin->protocol.command);
 
   /* Waypoint */
 
   if ( garmin->protocol.waypoint.waypoint  != appl_Anil ||
        garmin->protocol.waypoint.category  != appl_Anil ||
        garmin->protocol.waypoint.proximity != appl_Anil ) {
-    open_tag("garmin_waypoint",fp,spaces+1);
+    open_tag("garmin_waypoint",out,spaces+1);
     PROTO2_AND_DATA(waypoint,waypoint);
     PROTO2_AND_DATA(waypoint,category);
     PROTO2_AND_DATA(waypoint,proximity);
-    close_tag("garmin_waypoint",fp,spaces+1);
+    close_tag("garmin_waypoint",out,spaces+1);
   }
 
   /* Route */
 
   if ( garmin->protocol.route != appl_Anil ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<garmin_route protocol=\"A%03d\"",
-	    garmin->protocol.route);
+    print_spaces(out,spaces+1);
+    print_format(out,"<garmin_route protocol=\"A%03d\"",
+		 garmin->protocol.route);
     if ( garmin->datatype.route.header != data_Dnil ) {
-      fprintf(fp," header=\"D%03d\"",
-	      garmin->datatype.route.header);
+      print_format(out," header=\"D%03d\"",
+		   garmin->datatype.route.header);
     }
     if ( garmin->datatype.route.waypoint != data_Dnil ) {
-      fprintf(fp," waypoint=\"D%03d\"",
-	      garmin->datatype.route.waypoint);
+      print_format(out," waypoint=\"D%03d\"",
+		   garmin->datatype.route.waypoint);
     }
     if ( garmin->datatype.route.link != data_Dnil ) {
-      fprintf(fp," link=\"D%03d\"",
-	      garmin->datatype.route.link);
+      print_format(out," link=\"D%03d\"",
+		   garmin->datatype.route.link);
     }
-    fprintf(fp,"/>\n");
+    print_string(out,"/>\n");
   }
 
   /* Track */
   
   if ( garmin->protocol.track != appl_Anil ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<garmin_track protocol=\"A%03d\"",
-	    garmin->protocol.track);
+    print_spaces(out,spaces+1);
+    print_format(out,"<garmin_track protocol=\"A%03d\"",
+		 garmin->protocol.track);
     if ( garmin->datatype.track.header != data_Dnil ) {
-      fprintf(fp," header=\"D%03d\"",
-	      garmin->datatype.track.header);
+      print_format(out," header=\"D%03d\"",
+		   garmin->datatype.track.header);
     }
     if ( garmin->datatype.track.data != data_Dnil ) {
-      fprintf(fp," data=\"D%03d\"",
-	      garmin->datatype.track.data);
+      print_format(out," data=\"D%03d\"",
+		   garmin->datatype.track.data);
     }
-    fprintf(fp,"/>\n");
+    print_string(out,"/>\n");
   }
   
   /* Almanac, Date/Time, FlightBook, Position, PVT, Lap, Run */
@@ -2159,11 +2550,11 @@ garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
   if ( garmin->protocol.workout.workout     != appl_Anil ||
        garmin->protocol.workout.occurrence  != appl_Anil ||
        garmin->protocol.workout.limits      != appl_Anil ) {
-    open_tag("garmin_workout",fp,spaces+1);
+    open_tag("garmin_workout",out,spaces+1);
     PROTO2_AND_DATA(workout,workout);
     PROTO2_AND_DATA(workout,occurrence);
     PROTO2_AND_DATA(workout,limits);
-    close_tag("garmin_workout",fp,spaces+1);
+    close_tag("garmin_workout",out,spaces+1);
   }
   
   /* Fitness user profile */
@@ -2177,66 +2568,106 @@ garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
        garmin->protocol.course.track  != appl_Anil ||
        garmin->protocol.course.point  != appl_Anil ||
        garmin->protocol.course.limits != appl_Anil ) {
-    open_tag("garmin_course",fp,spaces+1);
+    open_tag("garmin_course",out,spaces+1);
     PROTO2_AND_DATA(course,course);
     PROTO2_AND_DATA(course,lap);
     
     if ( garmin->protocol.course.track != appl_Anil ) {
-      print_spaces(fp,spaces+2);
-      fprintf(fp,"<garmin_course_track protocol=\"A%03d\"",
-	      garmin->protocol.course.track);
+      print_spaces(out,spaces+2);
+      print_format(out,"<garmin_course_track protocol=\"A%03d\"",
+		   garmin->protocol.course.track);
       if ( garmin->datatype.course.track.header != data_Dnil ) {
-	fprintf(fp," header=\"D%03d\"",
-		garmin->datatype.course.track.header);
+	print_format(out," header=\"D%03d\"",
+		     garmin->datatype.course.track.header);
       }
       if ( garmin->datatype.course.track.data != data_Dnil ) {
-	fprintf(fp," data=\"D%03d\"",
-		garmin->datatype.course.track.data);
+	print_format(out," data=\"D%03d\"",
+		     garmin->datatype.course.track.data);
       }
-      close_tag("garmin_course_track",fp,spaces+1);      
+      close_tag("garmin_course_track",out,spaces+1);      
     }
     
     PROTO2_AND_DATA(course,point);
     PROTO2_AND_DATA(course,limits);
-    close_tag("garmin_course",fp,spaces+1);
+    close_tag("garmin_course",out,spaces+1);
   }
   
   /* All done. */
   
-  close_tag("garmin_protocols",fp,spaces);
+  close_tag("garmin_protocols",out,spaces);
 
 #undef PROTO1_AND_DATA
 #undef PROTO2_AND_DATA
 }
 
 
-void
-garmin_print_info ( garmin_unit * unit, FILE * fp, int spaces )
+static void
+print_info ( garmin_unit * unit, garmin_printer * out, int spaces )
 {
   char ** s;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,"<garmin_unit id=\"%x\">\n",unit->id);
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_product id=\"%d\" software_version=\"%.2f\">\n",
-	  unit->product.product_id,unit->product.software_version/100.0);
+  print_spaces(out,spaces);
+  print_format(out,"<garmin_unit id=\"%x\">\n",unit->id);
+  print_spaces(out,spaces+1);
+  print_format(out,"<garmin_product id=\"%d\" software_version=\"%.2f\">\n",
+	       unit->product.product_id,unit->product.software_version/100.0);
   GARMIN_TAGSTR(2,"product_description",unit->product.product_description);
   if ( unit->product.additional_data != NULL ) {
-    open_tag("additional_data_list",fp,spaces+2);
+    open_tag("additional_data_list",out,spaces+2);
     for ( s = unit->product.additional_data; s != NULL && *s != NULL; s++ ) {
       GARMIN_TAGSTR(3,"additional_data",*s);
     }
-    close_tag("additional_data_list",fp,spaces+2);
+    close_tag("additional_data_list",out,spaces+2);
   }
-  close_tag("garmin_product",fp,spaces+1);
+  close_tag("garmin_product",out,spaces+1);
   if ( unit->extended.ext_data != NULL ) {
-    open_tag("extended_data_list",fp,spaces+1);
+    open_tag("extended_data_list",out,spaces+1);
     for ( s = unit->extended.ext_data; s != NULL && *s != NULL; s++ ) {
       GARMIN_TAGSTR(2,"extended_data",*s);
     }
-    close_tag("extended_data_list",fp,spaces+1);
+    close_tag("extended_data_list",out,spaces+1);
   }  
-  garmin_print_protocols(unit,fp,spaces+1);
-  close_tag("garmin_unit",fp,spaces);
+  print_protocols(unit,out,spaces+1);
+  close_tag("garmin_unit",out,spaces);
 }
 
+
+/* ========================================================================= */
+/* garmin_print_data                                                         */
+/* ========================================================================= */
+
+void
+garmin_print_data ( garmin_data * d, FILE * fp, int spaces )
+{
+  garmin_printer out;
+
+  print_start(&out,fp);
+  print_data(d,&out,spaces);
+  print_flush(&out);
+}
+
+
+/* ========================================================================= */
+/* garmin_print_protocols                                                    */
+/* ========================================================================= */
+
+void
+garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
+{
+  garmin_printer out;
+
+  print_start(&out,fp);
+  print_protocols(garmin,&out,spaces);
+  print_flush(&out);
+}
+
+
+void
+garmin_print_info ( garmin_unit * unit, FILE * fp, int spaces )
+{
+  garmin_printer out;
+
+  print_start(&out,fp);
+  print_info(unit,&out,spaces);
+  print_flush(&out);
+}
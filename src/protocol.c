@@ -18,9 +18,75 @@
 */
 
 #include "config.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "garmin.h"
+#include "byte_util.h"
+
+
+#define DECODE_DEPTH  64   /* packets in flight between reader and decoder */
+
+
+/* 
+   While garmin_get() is running, record packets are unpacked on a decoder
+   thread so that unpacking overlaps with the wait for the next packet.
+   The reading thread hands raw packets to the decoder through a single
+   producer, single consumer ring: the reader only ever advances 'head'
+   and the decoder only ever advances 'tail', so the ring needs no lock.
+   The two semaphores count free and filled slots, and only put a side to
+   sleep when the ring is full or empty.
+*/
+
+typedef enum {
+  DECODE_RECORD,    /* unpack the packet and append it to the list */
+  DECODE_FENCE,     /* post 'fenced' once everything before it is done */
+  DECODE_QUIT       /* exit the decoder thread */
+} garmin_decode_op;
+
+
+typedef struct garmin_decode_slot {
+  garmin_decode_op     op;
+  garmin_list *        list;
+  garmin_datatype      type;
+  int                  phase;    /* garmin_stats phase it was read in */
+  garmin_packet        packet;
+} garmin_decode_slot;
+
+
+typedef struct garmin_decoder {
+  pthread_t            thread;
+  sem_t                free;     /* slots the reader may fill   */
+  sem_t                filled;   /* slots the decoder may empty */
+  sem_t                fenced;   /* a DECODE_FENCE was reached  */
+  float64              unpack[GARMIN_STATS_PHASES];  /* not yet counted */
+  unsigned int         head;
+  unsigned int         tail;
+  garmin_decode_slot   slots[DECODE_DEPTH];
+} garmin_decoder;
+
+
+/* 
+   While garmin_get_new_runs() is running, lap and track packets are looked
+   at before they are unpacked, and the ones that belong to runs saved
+   before are dropped.  Only the index (and, for the last lap saved, the
+   start time) is read out of a packet to decide.
+*/
+
+typedef struct garmin_sync {
+  garmin_sync_state *  state;
+  int                  active;   /* filtering laps and tracks         */
+  uint32               runs;     /* runs that haven't been saved      */
+  uint32 *             tracks;   /* their track indices, sorted       */
+  uint32               ntracks;
+  uint32               seen;     /* of those tracks, how many were read */
+  int                  keep;     /* keep the points of this track     */
+  int                  matched;  /* the last lap saved is still there */
+  int                  done;     /* nothing wanted can follow          */
+} garmin_sync;
 
 
 /* ------------------------------------------------------------------------- */
@@ -209,6 +275,312 @@ merge_strings ( char ** one, char ** two )
 }
 
 
+/* 
+   Unpack a record packet.  If a stream callback is installed, the record
+   is handed to it and NULL is returned; otherwise the record is returned
+   to be kept by the caller.  Once the callback has asked us to stop, any
+   remaining packets in the transfer are read off the link but not
+   unpacked.  The time spent unpacking is added to 'unpack'.
+*/
+
+static garmin_data *
+garmin_stream_packet ( garmin_unit *     garmin,
+		       garmin_packet *   p,
+		       garmin_datatype   type,
+		       float64 *         unpack )
+{
+  garmin_stream *   s = &garmin->stream;
+  garmin_data *     d = NULL;
+  float64           start;
+
+  if ( s->callback == NULL || s->stopped == 0 ) {
+    start = garmin_stats_clock();
+    d = garmin_unpack_packet_arena(p,type,garmin->arena);
+    *unpack += garmin_stats_clock() - start;
+    if ( s->callback != NULL ) {
+      if ( s->callback(d,s->context) == 0 ) s->stopped = 1;
+      d = NULL;
+    }
+  }
+
+  return d;
+}
+
+
+/* 
+   The decoder thread: unpack record packets in the order they were read.
+   Unpacking time is kept in the decoder until the reading thread counts
+   it (see garmin_decoder_stats), so garmin->stats is never touched here.
+*/
+
+static void *
+garmin_decode_records ( void * arg )
+{
+  garmin_unit *        garmin  = arg;
+  garmin_decoder *     decoder = garmin->decoder;
+  garmin_decode_slot * slot;
+  int                  quit    = 0;
+
+  while ( !quit ) {
+    sem_wait(&decoder->filled);
+    slot = &decoder->slots[decoder->tail % DECODE_DEPTH];
+    switch ( slot->op ) {
+    case DECODE_RECORD:
+      garmin_list_append(slot->list,
+			 garmin_stream_packet(garmin,&slot->packet,slot->type,
+					      &decoder->unpack[slot->phase]));
+      break;
+    case DECODE_FENCE:
+      sem_post(&decoder->fenced);
+      break;
+    case DECODE_QUIT:
+      quit = 1;
+      break;
+    }
+    decoder->tail++;
+    sem_post(&decoder->free);
+  }
+
+  return NULL;
+}
+
+
+/* Hand a slot to the decoder thread.  The packet is copied if given. */
+
+static void
+garmin_decode_push ( garmin_decoder *  decoder,
+		     garmin_decode_op  op,
+		     garmin_list *     list,
+		     garmin_packet *   p,
+		     garmin_datatype   type,
+		     int               phase )
+{
+  garmin_decode_slot * slot;
+  uint32               size;
+
+  sem_wait(&decoder->free);
+  slot = &decoder->slots[decoder->head % DECODE_DEPTH];
+  slot->op    = op;
+  slot->list  = list;
+  slot->type  = type;
+  slot->phase = phase;
+  if ( p != NULL ) {
+    size = PACKET_HEADER_SIZE + garmin_packet_size(p);
+    if ( size > sizeof(slot->packet) ) size = sizeof(slot->packet);
+    memcpy(&slot->packet,p,size);
+  }
+  decoder->head++;
+  sem_post(&decoder->filled);
+}
+
+
+static int
+compare_uint32 ( const void * a, const void * b )
+{
+  uint32 x = *(const uint32 *)a;
+  uint32 y = *(const uint32 *)b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+
+/* Does garmin_get_new_runs want this record?  Runs are always wanted. */
+
+static int
+garmin_sync_wants ( garmin_unit * garmin, garmin_packet * p, garmin_datatype type )
+{
+  garmin_sync * s = garmin->sync;
+  uint8 *       b = p->packet.data;
+  uint32        index;
+
+  if ( s == NULL || s->active == 0 ) return 1;
+
+  switch ( type ) {
+  case data_D1001:
+    index = get_uint32(b);
+    break;
+  case data_D1011:
+  case data_D1015:
+    index = get_uint16(b);
+    break;
+  case data_D311:
+    index   = get_uint16(b);
+    s->keep = (bsearch(&index,s->tracks,s->ntracks,
+		       sizeof(uint32),compare_uint32) != NULL);
+    if ( s->keep ) {
+      s->seen++;
+    } else if ( s->seen == s->ntracks ) {
+      s->done = 1;
+    }
+    return s->keep;
+  case data_D300:
+  case data_D301:
+  case data_D302:
+  case data_D303:
+  case data_D304:
+    return s->keep;
+  default:
+    return 1;
+  }
+
+  /* A lap.  All the lap types start with the index and the start time. */
+
+  if ( index == s->state->last_lap ) {
+    s->matched = (get_uint32(b+4) + TIME_OFFSET == s->state->last_lap_time);
+  }
+
+  return (index > s->state->last_lap);
+}
+
+
+/* Unpack a record packet into a list, on the decoder thread if running. */
+
+static void
+garmin_decode_packet ( garmin_unit *     garmin,
+		       garmin_list *     list,
+		       garmin_packet *   p,
+		       garmin_datatype   type )
+{
+  garmin_phase_stats * s;
+
+  /* Drop records of runs saved before (see garmin_get_new_runs). */
+
+  if ( garmin->sync != NULL && garmin_sync_wants(garmin,p,type) == 0 ) return;
+
+  if ( garmin->decoder != NULL ) {
+    garmin_decode_push(garmin->decoder,DECODE_RECORD,list,p,type,
+		       garmin->stats.current);
+  } else {
+    s = &garmin->stats.phase[garmin->stats.current];
+    garmin_list_append(list,garmin_stream_packet(garmin,p,type,&s->unpack));
+  }
+}
+
+
+/* 
+   Count the time the decoder thread spent unpacking.  Only called once it
+   has finished everything handed to it, so it isn't touching 'unpack'.
+*/
+
+static void
+garmin_decoder_stats ( garmin_unit * garmin, garmin_decoder * decoder )
+{
+  int i;
+
+  for ( i = 0; i < GARMIN_STATS_PHASES; i++ ) {
+    garmin->stats.phase[i].unpack += decoder->unpack[i];
+    decoder->unpack[i] = 0;
+  }
+}
+
+
+/* Wait until the decoder thread has unpacked everything handed to it. */
+
+static void
+garmin_decode_wait ( garmin_unit * garmin )
+{
+  if ( garmin->decoder != NULL ) {
+    garmin_decode_push(garmin->decoder,DECODE_FENCE,NULL,NULL,data_Dnil,0);
+    sem_wait(&garmin->decoder->fenced);
+    garmin_decoder_stats(garmin,garmin->decoder);
+  }
+}
+
+
+/* Free a decoder whose first 'sems' semaphores were initialized. */
+
+static void
+garmin_free_decoder ( garmin_decoder * decoder, int sems )
+{
+  if ( sems > 2 ) sem_destroy(&decoder->fenced);
+  if ( sems > 1 ) sem_destroy(&decoder->filled);
+  if ( sems > 0 ) sem_destroy(&decoder->free);
+  free(decoder);
+}
+
+
+/* 
+   Start unpacking record packets on a decoder thread.  Without a thread,
+   or without unnamed semaphores (some systems don't have them), records
+   are just unpacked as they are read.
+*/
+
+static void
+garmin_start_decoder ( garmin_unit * garmin )
+{
+  garmin_decoder * decoder;
+  int              sems = 0;
+
+  if ( garmin->decoder != NULL ) return;
+  if ( (decoder = calloc(1,sizeof(garmin_decoder))) == NULL ) return;
+
+  if ( sem_init(&decoder->free,0,DECODE_DEPTH) == 0 ) sems++;
+  if ( sems == 1 && sem_init(&decoder->filled,0,0) == 0 ) sems++;
+  if ( sems == 2 && sem_init(&decoder->fenced,0,0) == 0 ) sems++;
+
+  if ( sems < 3 ) {
+    if ( garmin->verbose != 0 ) {
+      printf("[garmin] decoder semaphores: %s\n",strerror(errno));
+    }
+    garmin_free_decoder(decoder,sems);
+    return;
+  }
+
+  garmin->decoder = decoder;
+  if ( pthread_create(&decoder->thread,NULL,
+		      garmin_decode_records,garmin) != 0 ) {
+    if ( garmin->verbose != 0 ) {
+      printf("[garmin] decoder thread: %s\n",strerror(errno));
+    }
+    garmin->decoder = NULL;
+    garmin_free_decoder(decoder,sems);
+  }
+}
+
+
+/* Finish unpacking everything read so far, and stop the decoder thread. */
+
+static void
+garmin_stop_decoder ( garmin_unit * garmin )
+{
+  garmin_decoder * decoder = garmin->decoder;
+
+  if ( decoder != NULL ) {
+    garmin_decode_push(decoder,DECODE_QUIT,NULL,NULL,data_Dnil,0);
+    pthread_join(decoder->thread,NULL);
+    garmin_decoder_stats(garmin,decoder);
+
+    garmin->decoder = NULL;
+    garmin_free_decoder(decoder,3);
+  }
+}
+
+
+/* 
+   Stop a transfer that nothing more is wanted from, and read off whatever
+   the unit had already sent of it.
+*/
+
+static void
+garmin_abort_transfer ( garmin_unit * garmin )
+{
+  garmin_packet     p;
+  link_protocol     link    = garmin->protocol.link;
+  int               skipped = 0;
+
+  garmin_send_command(garmin,Cmnd_Abort_Transfer);
+
+  while ( garmin_read(garmin,&p) > 0 &&
+	  garmin_gpid(link,garmin_packet_id(&p)) != Pid_Xfer_Cmplt ) {
+    skipped++;
+  }
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] transfer aborted, %d packets skipped\n",skipped);
+  }
+}
+
+
 /* Read a single packet with an expected packet ID and data type. */
 
 static garmin_data *
@@ -216,15 +588,18 @@ garmin_read_singleton ( garmin_unit *     garmin,
 			garmin_pid        pid,
 			garmin_datatype   type )
 {
-  garmin_data *     d = NULL;
-  garmin_packet     p;
-  link_protocol     link = garmin->protocol.link;
-  garmin_pid        ppid;
+  garmin_data *         d = NULL;
+  garmin_packet         p;
+  link_protocol         link = garmin->protocol.link;
+  garmin_pid            ppid;
+  garmin_phase_stats *  s;
 
   if ( garmin_read(garmin,&p) > 0 ) {
     ppid = garmin_gpid(link,garmin_packet_id(&p));
     if ( ppid == pid ) {
-      d = garmin_unpack_packet(&p,type);
+      garmin_decode_wait(garmin);
+      s = &garmin->stats.phase[garmin->stats.current];
+      d = garmin_stream_packet(garmin,&p,type,&s->unpack);
     } else {
       /* Expected pid but got something else. */
       printf("garmin_read_singleton: expected %d, got %d\n",pid,ppid);
@@ -266,7 +641,7 @@ garmin_read_records ( garmin_unit *     garmin,
 
       /* Allocate a list for the records. */
 
-      d = garmin_alloc_data(data_Dlist);
+      d = garmin_arena_alloc_data(garmin->arena,data_Dlist);
       l = (garmin_list *)d->data;
 
       /* 
@@ -286,7 +661,7 @@ garmin_read_records ( garmin_unit *     garmin,
 	  }
 	  done = 1;
 	} else if ( ppid == pid ) {
-	  garmin_list_append(l,garmin_unpack_packet(&p,type));
+	  garmin_decode_packet(garmin,l,&p,type);
 	  got++;
 	} else {
 	  /* Unexpected packet ID! */
@@ -336,7 +711,7 @@ garmin_read_records2 ( garmin_unit *     garmin,
       
       /* Allocate a list for the records. */
 
-      d = garmin_alloc_data(data_Dlist);
+      d = garmin_arena_alloc_data(garmin->arena,data_Dlist);
       l = (garmin_list *)d->data;
 
       while ( state >= 0 && garmin_read(garmin,&p) > 0 ) {
@@ -355,7 +730,7 @@ garmin_read_records2 ( garmin_unit *     garmin,
 	switch ( state ) {
 	case 0:  /* want pid1 */
 	  if ( ppid == pid1 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type1));
+	    garmin_decode_packet(garmin,l,&p,type1);
 	    state = 1;
 	    got++;
 	  } else {
@@ -364,7 +739,7 @@ garmin_read_records2 ( garmin_unit *     garmin,
 	  break;
 	case 1:  /* want pid2 */
 	  if ( ppid == pid2 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type2));
+	    garmin_decode_packet(garmin,l,&p,type2);
 	    state = 2;
 	    got++;
 	  } else {
@@ -373,11 +748,11 @@ garmin_read_records2 ( garmin_unit *     garmin,
 	  break;
 	case 2: /* want pid2 or pid1 */
 	  if ( ppid == pid1 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type1));
+	    garmin_decode_packet(garmin,l,&p,type1);
 	    state = 1;
 	    got++;
 	  } else if ( ppid == pid2 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type2));
+	    garmin_decode_packet(garmin,l,&p,type2);
 	    state = 2;
 	    got++;
 	  } else {
@@ -388,6 +763,11 @@ garmin_read_records2 ( garmin_unit *     garmin,
 	  state = -1;
 	  break;
 	}
+	if ( garmin->sync != NULL && garmin->sync->done != 0 ) {
+	  /* We have every track we want (see garmin_get_new_runs). */
+	  garmin_abort_transfer(garmin);
+	  break;
+	}
       }
       if ( state < 0 ) {
 	/* Unexpected packet received. */
@@ -438,7 +818,7 @@ garmin_read_records3 ( garmin_unit *     garmin,
 
       /* Allocate a list for the records. */
 
-      d = garmin_alloc_data(data_Dlist);
+      d = garmin_arena_alloc_data(garmin->arena,data_Dlist);
       l = (garmin_list *)d->data;
 
       while ( state >= 0 && garmin_read(garmin,&p) > 0 ) {
@@ -457,7 +837,7 @@ garmin_read_records3 ( garmin_unit *     garmin,
 	switch ( state ) {
 	case 0:  /* want pid1 */
 	  if ( ppid == pid1 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type1));
+	    garmin_decode_packet(garmin,l,&p,type1);
 	    state = 1;
 	    got++;
 	  } else {
@@ -466,7 +846,7 @@ garmin_read_records3 ( garmin_unit *     garmin,
 	  break;
 	case 1:  /* want pid2 */
 	  if ( ppid == pid2 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type2));
+	    garmin_decode_packet(garmin,l,&p,type2);
 	    state = 2;
 	    got++;
 	  } else {
@@ -475,7 +855,7 @@ garmin_read_records3 ( garmin_unit *     garmin,
 	  break;
 	case 2: /* want pid3 */
 	  if ( ppid == pid3 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type3));
+	    garmin_decode_packet(garmin,l,&p,type3);
 	    state = 3;
 	    got++;
 	  } else {
@@ -484,11 +864,11 @@ garmin_read_records3 ( garmin_unit *     garmin,
 	  break;
 	case 3: /* want pid2 or pid1 */
 	  if ( ppid == pid1 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type1));
+	    garmin_decode_packet(garmin,l,&p,type1);
 	    state = 1;
 	    got++;
 	  } else if ( ppid == pid2 ) {
-	    garmin_list_append(l,garmin_unpack_packet(&p,type2));
+	    garmin_decode_packet(garmin,l,&p,type2);
 	    state = 2;
 	    got++;
 	  } else {
@@ -517,6 +897,24 @@ garmin_read_records3 ( garmin_unit *     garmin,
 }
 
 
+/* Run a protocol's read function, counting its traffic against it. */
+
+static garmin_data *
+garmin_read_counted ( garmin_unit *    garmin,
+		      appl_protocol    protocol,
+		      garmin_data *    (*read) ( garmin_unit * ) )
+{
+  garmin_data * data;
+  int           previous;
+
+  previous = garmin_stats_enter(garmin,protocol);
+  data     = read(garmin);
+  garmin_stats_leave(garmin,previous);
+
+  return data;
+}
+
+
 /* ------------------------------------------------------------------------- */
 /* 6.1  A000 - Product Data Protocol                                         */
 /* 6.2  A001 - Protocol Capability Protocol                                  */
@@ -540,7 +938,7 @@ garmin_read_a000_a001 ( garmin_unit * garmin )
   /* Send the product request */
   
   garmin_packetize(&p,L000_Pid_Product_Rqst,0,NULL);
-  garmin_write(garmin,&p);
+  if ( garmin_write(garmin,&p) < 0 ) return;
 
   /* Read the response. */
   
@@ -868,21 +1266,155 @@ garmin_read_a906 ( garmin_unit * garmin )
 /* 6.15  A1000 - Run Transfer Protocol                                       */
 /* ------------------------------------------------------------------------- */
 
+/* 
+   Work out which runs haven't been saved, and which tracks they need.
+   Returns 1 if the laps and tracks are to be filtered, or 0 if they must
+   all be read (and then the state is no longer valid, if it was).
+*/
+
+static int
+garmin_sync_select ( garmin_unit * garmin, garmin_data * runs )
+{
+  garmin_sync *        s  = garmin->sync;
+  garmin_sync_state *  st;
+  garmin_list *        l;
+  garmin_list_node *   n;
+  uint32               trk;
+  uint32               f_lap;
+  uint32               l_lap;
+  int                  found = 0;
+
+  if ( s == NULL || s->state->valid == 0 ) return 0;
+  st = s->state;
+
+  /* Laps and tracks can only be picked out by index with these types. */
+
+  switch ( garmin->datatype.lap ) {
+  case data_D1001:
+  case data_D1011:
+  case data_D1015:
+    break;
+  default:
+    st->valid = 0;
+    return 0;
+  }
+
+  if ( garmin->datatype.track.header != data_D311 || runs == NULL ) {
+    st->valid = 0;
+    return 0;
+  }
+
+  /* The runs may still be on the decoder thread. */
+
+  garmin_decode_wait(garmin);
+  l = runs->data;
+
+  if ( (s->tracks = malloc((l->elements + 1) * sizeof(uint32))) == NULL ) {
+    st->valid = 0;
+    return 0;
+  }
+
+  for ( n = l->head; n != NULL; n = n->next ) {
+    if ( get_run_track_lap_info(n->data,&trk,&f_lap,&l_lap) == 0 ) continue;
+    if ( trk == st->track && f_lap == st->first_lap && l_lap == st->last_lap ) {
+      found = 1;
+    } else if ( garmin_run_is_new(st,n->data) ) {
+      s->tracks[s->ntracks++] = trk;
+      s->runs++;
+    }
+  }
+
+  if ( found == 0 ) {
+    /* The newest run saved is gone, so we can't trust the indices. */
+    if ( garmin->verbose != 0 ) {
+      printf("[garmin] run [%d:%d] not found, reading everything\n",
+	     st->first_lap,st->last_lap);
+    }
+    st->valid = 0;
+    return 0;
+  }
+
+  qsort(s->tracks,s->ntracks,sizeof(uint32),compare_uint32);
+  s->active  = 1;
+  s->matched = (s->runs == 0);
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] %d new runs, %d tracks wanted\n",s->runs,s->ntracks);
+  }
+
+  return 1;
+}
+
+
+/* The laps of the new runs, if there are any. */
+
+static garmin_data *
+garmin_read_new_laps ( garmin_unit * garmin )
+{
+  if ( garmin->sync->runs == 0 ) {
+    return garmin_arena_alloc_data(garmin->arena,data_Dlist);
+  }
+
+  return garmin_read_a906(garmin);
+}
+
+
+/* The tracks of the new runs, up to the last of them. */
+
+static garmin_data *
+garmin_read_new_tracks ( garmin_unit * garmin )
+{
+  if ( garmin->sync->ntracks == 0 ) {
+    return garmin_arena_alloc_data(garmin->arena,data_Dlist);
+  }
+
+  return garmin_read_a302(garmin);
+}
+
+
 garmin_data *
 garmin_read_a1000 ( garmin_unit * garmin )
 {
   garmin_data * d  = NULL;
+  garmin_data * laps;
+  garmin_data * runs;
   garmin_list * l  = NULL;
 
   /* Read the runs, then the laps, then the track log. */
 
   if ( garmin_send_command(garmin,Cmnd_Transfer_Runs) != 0 ) {
-    d = garmin_alloc_data(data_Dlist);
+    d = garmin_arena_alloc_data(garmin->arena,data_Dlist);
     l = d->data;
-    garmin_list_append(l,garmin_read_records(garmin,Pid_Run,
-					     garmin->datatype.run));
-    garmin_list_append(l,garmin_read_a906(garmin));
-    garmin_list_append(l,garmin_read_a302(garmin));
+    runs = garmin_read_records(garmin,Pid_Run,garmin->datatype.run);
+    garmin_list_append(l,runs);
+
+    /* Only what the new runs need, if we know which ones they are. */
+
+    if ( garmin_sync_select(garmin,runs) != 0 ) {
+      laps = garmin_read_counted(garmin,appl_A906,garmin_read_new_laps);
+      if ( garmin->sync->matched != 0 ) {
+	garmin_list_append(l,laps);
+	garmin_list_append(l,garmin_read_counted(garmin,appl_A302,
+						 garmin_read_new_tracks));
+      } else {
+	/* The last lap saved has changed (was the unit reset?). */
+	if ( garmin->verbose != 0 ) {
+	  printf("[garmin] lap [%d] has changed, reading everything\n",
+		 garmin->sync->state->last_lap);
+	}
+	garmin->sync->active       = 0;
+	garmin->sync->state->valid = 0;
+	garmin_decode_wait(garmin);
+	if ( garmin->arena == NULL ) garmin_free_data(laps);
+      }
+    }
+
+    if ( l->elements == 1 ) {
+      garmin_list_append(l,garmin_read_counted(garmin,appl_A906,
+					       garmin_read_a906));
+      garmin_list_append(l,garmin_read_counted(garmin,appl_A302,
+					       garmin_read_a302));
+    }
   }
 
   return d;
@@ -902,13 +1434,14 @@ garmin_read_a1002 ( garmin_unit * garmin )
   /* Read the workouts, then the workout occurrences */
 
   if ( garmin_send_command(garmin,Cmnd_Transfer_Workouts) != 0 ) {
-    d = garmin_alloc_data(data_Dlist);
+    d = garmin_arena_alloc_data(garmin->arena,data_Dlist);
     l = d->data;
     garmin_list_append(l,
 		       garmin_read_records(garmin,
 					   Pid_Workout,
 					   garmin->datatype.workout.workout));
-    garmin_list_append(l,garmin_read_a1003(garmin));
+    garmin_list_append(l,garmin_read_counted(garmin,appl_A1003,
+						 garmin_read_a1003));
   }
 
   return d;
@@ -985,14 +1518,17 @@ garmin_read_a1006 ( garmin_unit * garmin )
   garmin_list * l  = NULL;
 
   if ( garmin_send_command(garmin,Cmnd_Transfer_Courses) != 0 ) {
-    d = garmin_alloc_data(data_Dlist);
+    d = garmin_arena_alloc_data(garmin->arena,data_Dlist);
     l = d->data;
     garmin_list_append(l,garmin_read_records(garmin,
 					     Pid_Course,
 					     garmin->datatype.course.course));
-    garmin_list_append(l,garmin_read_a1007(garmin));
-    garmin_list_append(l,garmin_read_a1012(garmin));
-    garmin_list_append(l,garmin_read_a1008(garmin));
+    garmin_list_append(l,garmin_read_counted(garmin,appl_A1007,
+						 garmin_read_a1007));
+    garmin_list_append(l,garmin_read_counted(garmin,appl_A1012,
+						 garmin_read_a1012));
+    garmin_list_append(l,garmin_read_counted(garmin,appl_A1008,
+						 garmin_read_a1008));
   }
 
   return d;
@@ -1108,7 +1644,7 @@ garmin_read_via ( garmin_unit * garmin, appl_protocol protocol )
     if ( garmin->verbose != 0 ) {                                             \
       printf("[garmin] -> garmin_read_a" #x "\n");                            \
     }                                                                         \
-    data = garmin_read_a##x(garmin);                                          \
+    data = garmin_read_counted(garmin,appl_A##x,garmin_read_a##x);            \
     if ( garmin->verbose != 0 ) {                                             \
       printf("[garmin] <- garmin_read_a" #x "\n");                            \
     }                                                                         \
@@ -1149,6 +1685,10 @@ garmin_get ( garmin_unit * garmin, garmin_get_type what )
 {
   garmin_data * data = NULL;
 
+  /* An arena is not shared between threads, so unpack as we read. */
+
+  if ( garmin->arena == NULL ) garmin_start_decoder(garmin);
+
 #define CASE_WHAT(x,y) \
   case GET_##x: data = garmin_read_via(garmin,garmin->protocol.y); break
 
@@ -1171,18 +1711,103 @@ garmin_get ( garmin_unit * garmin, garmin_get_type what )
     break;
   }
 
+  garmin_stop_decoder(garmin);
+
   return data;
 }
 
 
-/* Initialize a connection with a Garmin unit. */
+/* 
+   Get data from the Garmin unit, allocating all of it from an arena.  The
+   data must be released with garmin_arena_free(), not garmin_free_data().
+*/
+
+garmin_data *
+garmin_get_arena ( garmin_unit *    garmin,
+		   garmin_get_type  what,
+		   garmin_arena *   arena )
+{
+  garmin_data * data;
+
+  garmin->arena = arena;
+  data = garmin_get(garmin,what);
+  garmin->arena = NULL;
+
+  return data;
+}
+
+
+/* 
+   Get data from the Garmin unit, handing each record to the callback as
+   soon as it has been unpacked instead of collecting them all in a list.
+   The callback owns each record it is given, and may return 0 to ignore
+   the rest of the transfer.  It is called one record at a time and in
+   the order the records were sent, but not always on the same thread:
+   the records of a transfer are normally handed over on the decoder
+   thread, while single records, and everything when there is no decoder
+   thread (no threads, or an arena in use), come on the calling thread.
+   Returns 1 if the callback saw every record, 0 if it stopped early.
+*/
 
 int
-garmin_init ( garmin_unit * garmin, int verbose )
+garmin_get_stream ( garmin_unit *       garmin,
+		    garmin_get_type     what,
+		    garmin_record_cb    callback,
+		    void *              context )
 {
-  memset(garmin,0,sizeof(garmin_unit));
-  garmin->verbose = verbose;
+  garmin_data * skeleton;
+  int           stopped;
+
+  garmin->stream.callback = callback;
+  garmin->stream.context  = context;
+  garmin->stream.stopped  = 0;
 
+  /* Whatever comes back is only the (empty) list structure. */
+
+  skeleton = garmin_get(garmin,what);
+  garmin_free_data(skeleton);
+
+  stopped = garmin->stream.stopped;
+  memset(&garmin->stream,0,sizeof(garmin->stream));
+
+  return !stopped;
+}
+
+
+/* 
+   Get the runs from the unit, as garmin_get(garmin,GET_RUNS) does, but
+   leave out the laps and tracks of runs saved before the one in 'state'
+   (see garmin_run_is_new).  Laps and tracks aren't asked for at all if
+   there are no new runs, and the track log transfer is stopped once the
+   tracks of the new runs are in.  If the unit doesn't have that run any
+   more, or it has changed, everything is read and state->valid is set
+   to 0.
+*/
+
+garmin_data *
+garmin_get_new_runs ( garmin_unit * garmin, garmin_sync_state * state )
+{
+  garmin_sync   sync;
+  garmin_data * data;
+
+  memset(&sync,0,sizeof(sync));
+  sync.state   = state;
+  garmin->sync = &sync;
+
+  data = garmin_get(garmin,GET_RUNS);
+
+  garmin->sync = NULL;
+  if ( sync.tracks != NULL ) free(sync.tracks);
+
+  return data;
+}
+
+
+/* Open the connection, start a session, and learn what the unit can do. */
+
+static int
+garmin_init_session ( garmin_unit * garmin )
+{
   if ( garmin_open(garmin) != 0 ) {
     garmin_start_session(garmin);
     garmin_read_a000_a001(garmin);
@@ -1192,3 +1817,50 @@ garmin_init ( garmin_unit * garmin, int verbose )
   }
 }
 
+
+/* Initialize a connection with a Garmin unit. */
+
+int
+garmin_init ( garmin_unit * garmin, int verbose )
+{
+  return garmin_init_device(garmin,NULL,verbose);
+}
+
+
+/* 
+   Initialize a connection with a particular Garmin unit (as returned by
+   garmin_enumerate), or with the first one found if device is NULL.
+*/
+
+int
+garmin_init_device ( garmin_unit *       garmin,
+		     struct usb_device * device,
+		     int                 verbose )
+{
+  memset(garmin,0,sizeof(garmin_unit));
+  garmin->verbose    = verbose;
+  garmin->usb.device = device;
+
+  return garmin_init_session(garmin);
+}
+
+
+/* 
+   Initialize a "connection" with a session captured by garmin_capture,
+   played back with 'latency' microseconds per packet (see garmin_replay).
+*/
+
+int
+garmin_init_replay ( garmin_unit * garmin,
+		     const char *  filename,
+		     int           latency,
+		     int           verbose )
+{
+  memset(garmin,0,sizeof(garmin_unit));
+  garmin->verbose = verbose;
+
+  if ( garmin_replay(garmin,filename,latency) == 0 ) return 0;
+
+  return garmin_init_session(garmin);
+}
+
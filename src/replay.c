@@ -0,0 +1,342 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "garmin.h"
+#include "byte_util.h"
+
+
+/*
+   A transport that plays back a session captured by garmin_capture, so
+   that the protocol code can be run (and timed) without a unit attached.
+
+   Each packet read in the capture is released once as many packets have
+   been written as were written before it in the capture.  Reads that
+   would come too early wait for the write, or time out just like reads
+   from a unit that has nothing to say.  Packets written are compared
+   with the ones in the capture, and differences reported when verbose.
+*/
+
+typedef struct garmin_replay_packet {
+  uint32             offset;   /* where its bytes start */
+  uint32             gate;     /* writes that must come before it */
+} garmin_replay_packet;
+
+
+typedef struct garmin_replay_list {
+  garmin_replay_packet *  packets;
+  uint32                  count;
+  uint32                  capacity;
+} garmin_replay_list;
+
+
+typedef struct garmin_replay_state {
+  pthread_mutex_t         lock;
+  pthread_cond_t          written;
+  uint8 *                 bytes;
+  uint32                  size;
+  uint32                  capacity;
+  garmin_replay_list      reads;
+  garmin_replay_list      writes;
+  uint32                  next_read;
+  uint32                  next_write;
+  int                     latency;     /* microseconds per packet read */
+} garmin_replay_state;
+
+
+static void
+garmin_replay_free ( garmin_replay_state * rp )
+{
+  if ( rp->reads.packets  != NULL ) free(rp->reads.packets);
+  if ( rp->writes.packets != NULL ) free(rp->writes.packets);
+  if ( rp->bytes          != NULL ) free(rp->bytes);
+  free(rp);
+}
+
+
+/* Append a packet's bytes, and note where they are in one of the lists. */
+
+static int
+garmin_replay_add ( garmin_replay_state * rp,
+		    garmin_replay_list *  list,
+		    garmin_packet *       p )
+{
+  uint32   s = garmin_packet_size(p) + PACKET_HEADER_SIZE;
+  uint32   c;
+  void *   m;
+
+  if ( rp->size + s > rp->capacity ) {
+    for ( c = (rp->capacity) ? rp->capacity : 65536; rp->size + s > c; c *= 2 );
+    if ( (m = realloc(rp->bytes,c)) == NULL ) return 0;
+    rp->bytes    = m;
+    rp->capacity = c;
+  }
+
+  if ( list->count == list->capacity ) {
+    c = (list->capacity) ? 2 * list->capacity : 256;
+    if ( (m = realloc(list->packets,c * sizeof(garmin_replay_packet)))
+	 == NULL ) {
+      return 0;
+    }
+    list->packets  = m;
+    list->capacity = c;
+  }
+
+  list->packets[list->count].offset = rp->size;
+  list->packets[list->count].gate   = rp->writes.count;
+  list->count++;
+
+  memcpy(rp->bytes + rp->size,p->data,s);
+  rp->size += s;
+
+  return 1;
+}
+
+
+/*
+   Load a capture.  Anything that isn't a <read> or <write> packet (such
+   as the diagnostics of a verbose run) is skipped.
+*/
+
+static int
+garmin_replay_load ( garmin_replay_state * rp, const char * filename )
+{
+  FILE *          fp;
+  char            line[256];
+  char            dir[8];
+  char *          c;
+  char *          e;
+  unsigned int    type;
+  unsigned int    id;
+  unsigned int    size = 0;
+  unsigned int    have = 0;
+  unsigned long   b;
+  int             i;
+  int             in   = GARMIN_DIR_NONE;
+  int             n    = 0;
+  int             ok   = 1;
+  garmin_packet   p;
+
+  if ( (fp = fopen(filename,"r")) == NULL ) {
+    printf("garmin_replay: %s: %s\n",filename,strerror(errno));
+    return 0;
+  }
+
+  while ( ok && fgets(line,sizeof(line),fp) != NULL ) {
+    n++;
+    if ( line[0] == '<' && line[1] != '/' ) {
+      if ( sscanf(line,"<%7[a-z] type=\"0x%x\" id=\"0x%x\" size=\"%u\"",
+		  dir,&type,&id,&size) != 4 ) {
+	continue;
+      }
+      if ( strcmp(dir,"read") == 0 ) {
+	in = GARMIN_DIR_READ;
+      } else if ( strcmp(dir,"write") == 0 ) {
+	in = GARMIN_DIR_WRITE;
+      } else {
+	continue;
+      }
+      if ( garmin_packetize(&p,id,size,NULL) == 0 ) {
+	ok = 0;
+	break;
+      }
+      p.packet.type = type;
+      have = 0;
+      if ( strstr(line,"/>") == NULL ) continue;
+    } else if ( line[0] == '[' && in != GARMIN_DIR_NONE ) {
+
+      /* A line of up to 16 bytes in hex, after the "[offset]". */
+
+      for ( i = 0, c = line + 7; i < 16 && have < size; i++, c = e ) {
+	b = strtoul(c,&e,16);
+	if ( e == c || b > 0xff ) break;
+	p.packet.data[have++] = b;
+      }
+      continue;
+    } else if ( strncmp(line,"</",2) != 0 || in == GARMIN_DIR_NONE ) {
+      continue;
+    }
+
+    /* The end of a packet. */
+
+    if ( have != size ) {
+      ok = 0;
+    } else if ( in == GARMIN_DIR_READ ) {
+      ok = garmin_replay_add(rp,&rp->reads,&p);
+    } else {
+      ok = garmin_replay_add(rp,&rp->writes,&p);
+    }
+    in = GARMIN_DIR_NONE;
+  }
+
+  if ( ok && in != GARMIN_DIR_NONE ) ok = 0;
+  if ( !ok ) {
+    printf("garmin_replay: %s: bad packet at line %d\n",filename,n);
+  }
+
+  fclose(fp);
+
+  return ok;
+}
+
+
+static int
+garmin_replay_open ( garmin_unit * garmin )
+{
+  /* The capture was loaded by garmin_replay; there's nothing else to do. */
+
+  return (garmin->usb.context != NULL);
+}
+
+
+static int
+garmin_replay_read ( garmin_unit * garmin, garmin_packet * p, int timeout )
+{
+  garmin_replay_state *  rp = garmin->usb.context;
+  garmin_replay_packet * rd;
+  struct timeval         now;
+  struct timespec        until;
+  int                    r  = -ETIMEDOUT;
+
+  gettimeofday(&now,NULL);
+  until.tv_sec  = now.tv_sec + timeout / 1000;
+  until.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
+  if ( until.tv_nsec >= 1000000000 ) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&rp->lock);
+  for ( ;; ) {
+    if ( rp->next_read < rp->reads.count ) {
+      rd = &rp->reads.packets[rp->next_read];
+      if ( rd->gate <= rp->next_write ) {
+	r = get_uint32(rp->bytes + rd->offset + 8) + PACKET_HEADER_SIZE;
+	memcpy(p->data,rp->bytes + rd->offset,r);
+	rp->next_read++;
+	break;
+      }
+    }
+    if ( pthread_cond_timedwait(&rp->written,&rp->lock,&until) == ETIMEDOUT ) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&rp->lock);
+
+  if ( r > 0 && rp->latency > 0 ) usleep(rp->latency);
+
+  return r;
+}
+
+
+static int
+garmin_replay_write ( garmin_unit * garmin, garmin_packet * p, int size )
+{
+  garmin_replay_state *  rp     = garmin->usb.context;
+  uint32                 i;
+  int                    differ = 0;
+
+  pthread_mutex_lock(&rp->lock);
+  i = rp->next_write++;
+  if ( i < rp->writes.count ) {
+    differ = memcmp(p->data,rp->bytes + rp->writes.packets[i].offset,size);
+  } else {
+    differ = 1;
+  }
+  pthread_cond_broadcast(&rp->written);
+  pthread_mutex_unlock(&rp->lock);
+
+  if ( differ != 0 && garmin->verbose != 0 ) {
+    printf("[garmin] replay: write %u is not the one captured\n",i);
+  }
+
+  return size;
+}
+
+
+static void
+garmin_replay_close ( garmin_unit * garmin )
+{
+  garmin_replay_state * rp = garmin->usb.context;
+
+  if ( rp != NULL ) {
+    pthread_cond_destroy(&rp->written);
+    pthread_mutex_destroy(&rp->lock);
+    garmin_replay_free(rp);
+    garmin->usb.context = NULL;
+  }
+}
+
+
+static const garmin_transport garmin_replay_transport = {
+  "replay",
+  garmin_replay_open,
+  garmin_replay_read,
+  garmin_replay_write,
+  garmin_replay_close
+};
+
+
+/* ========================================================================= */
+/* garmin_replay                                                             */
+/* ========================================================================= */
+
+/*
+   Talk to a captured session (see garmin_capture) instead of a unit.  Any
+   open connection is closed first.  Each packet read is delayed by
+   'latency' microseconds, to stand in for the time a unit would take to
+   send it.  Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_replay ( garmin_unit * garmin, const char * filename, int latency )
+{
+  garmin_replay_state * rp;
+
+  if ( (rp = calloc(1,sizeof(garmin_replay_state))) == NULL ) return 0;
+
+  if ( garmin_replay_load(rp,filename) == 0 ) {
+    garmin_replay_free(rp);
+    return 0;
+  }
+
+  pthread_mutex_init(&rp->lock,NULL);
+  pthread_cond_init(&rp->written,NULL);
+  rp->latency = (latency > 0) ? latency : 0;
+
+  garmin_close(garmin);
+  garmin->usb.transport = &garmin_replay_transport;
+  garmin->usb.context   = rp;
+  garmin->usb.open      = 1;
+  garmin->usb.error     = 0;
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] replaying %u reads and %u writes from %s\n",
+	   rp->reads.count,rp->writes.count,filename);
+  }
+
+  return 1;
+}
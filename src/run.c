@@ -18,12 +18,42 @@
 */
 
 #include "config.h"
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "garmin.h"
 
 
+#define SAVE_THREADS  4    /* run files packed and written at once */
+#define SAVE_QUEUE    16   /* runs waiting for a writer */
+
+
+/* 
+   Laps and tracks sorted by their index, so that the ones belonging to a
+   run can be found with a binary search rather than a scan of the whole
+   list.  'order' is the position in the original list, which keeps the
+   sort stable.
+*/
+
+typedef struct lap_entry {
+  uint32              index;
+  uint32              order;
+  garmin_data *       lap;
+} lap_entry;
+
+
+typedef struct track_entry {
+  uint32              index;
+  uint32              order;
+  garmin_list_node *  header;
+} track_entry;
+
+
 int
 get_run_track_lap_info ( garmin_data * run,
 			 uint32 *      track_index,
@@ -176,8 +206,396 @@ get_track ( garmin_list * points, uint32 trk_index )
 }
 
 
-void
-garmin_save_runs ( garmin_unit * garmin )
+static int
+compare_lap_entries ( const void * a, const void * b )
+{
+  const lap_entry * x = a;
+  const lap_entry * y = b;
+
+  if ( x->index != y->index ) return (x->index < y->index) ? -1 : 1;
+  return (x->order < y->order) ? -1 : (x->order > y->order);
+}
+
+
+static int
+compare_track_entries ( const void * a, const void * b )
+{
+  const track_entry * x = a;
+  const track_entry * y = b;
+
+  if ( x->index != y->index ) return (x->index < y->index) ? -1 : 1;
+  return (x->order < y->order) ? -1 : (x->order > y->order);
+}
+
+
+/* Sort the laps by index in one pass over the list.  NULL if out of memory. */
+
+static lap_entry *
+map_laps ( garmin_list * laps, uint32 * count )
+{
+  lap_entry *         map;
+  garmin_list_node *  m;
+  uint32              i = 0;
+
+  if ( (map = malloc((laps->elements + 1) * sizeof(lap_entry))) == NULL ) {
+    return NULL;
+  }
+  for ( m = laps->head; m != NULL; m = m->next ) {
+    if ( get_lap_index(m->data,&map[i].index) != 0 ) {
+      map[i].order = i;
+      map[i].lap   = m->data;
+      i++;
+    }
+  }
+  qsort(map,i,sizeof(lap_entry),compare_lap_entries);
+  *count = i;
+
+  return map;
+}
+
+
+/* 
+   Sort the track headers (D311) by index in one pass over the points.
+   Returns NULL if out of memory.
+*/
+
+static track_entry *
+map_tracks ( garmin_list * points, uint32 * count )
+{
+  track_entry *       map;
+  garmin_list_node *  n;
+  D311 *              d311;
+  uint32              i = 0;
+
+  if ( (map = malloc((points->elements + 1) * sizeof(track_entry)))
+       == NULL ) {
+    return NULL;
+  }
+  for ( n = points->head; n != NULL; n = n->next ) {
+    if ( n->data != NULL && n->data->type == data_D311 ) {
+      d311          = n->data->data;
+      map[i].index  = d311->index;
+      map[i].order  = i;
+      map[i].header = n;
+      i++;
+    }
+  }
+  qsort(map,i,sizeof(track_entry),compare_track_entries);
+  *count = i;
+
+  return map;
+}
+
+
+/* The first lap in the map with an index of at least 'index'. */
+
+static uint32
+find_lap ( lap_entry * map, uint32 count, uint32 index )
+{
+  uint32 lo = 0;
+  uint32 hi = count;
+  uint32 mid;
+
+  while ( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if ( map[mid].index < index ) lo = mid + 1;
+    else                          hi = mid;
+  }
+
+  return lo;
+}
+
+
+/* 
+   The track with a given index: its header and the points following it,
+   up to the next header.  Same result as get_track(), without the scan.
+*/
+
+static garmin_data *
+find_track ( track_entry * map, uint32 count, uint32 trk_index )
+{
+  garmin_list_node * n;
+  garmin_data *      track = NULL;
+  uint32             lo    = 0;
+  uint32             hi    = count;
+  uint32             mid;
+
+  while ( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if ( map[mid].index < trk_index ) lo = mid + 1;
+    else                              hi = mid;
+  }
+
+  if ( lo < count && map[lo].index == trk_index ) {
+    track = garmin_alloc_data(data_Dlist);
+    garmin_list_append(track->data,map[lo].header->data);
+    for ( n = map[lo].header->next; n != NULL; n = n->next ) {
+      if ( n->data == NULL ) continue;
+      if ( n->data->type == data_D311 ) break;
+      switch ( n->data->type ) {
+      case data_D300:
+      case data_D301:
+      case data_D302:
+      case data_D303:
+      case data_D304:
+	garmin_list_append(track->data,n->data);
+	break;
+      default:
+	printf("get_track: point type %d invalid!\n",n->data->type);
+	break;
+      }
+    }
+  }
+
+  return track;
+}
+
+
+/* 
+   Run files are packed and written by a small pool of threads, since the
+   create/chown/write sequence is slow on network filesystems.  Jobs are
+   reported in run order by the calling thread, whatever order the writes
+   finish in.
+*/
+
+typedef enum {
+  SAVE_PENDING,
+  SAVE_DONE,
+  SAVE_NO_START,     /* no start time, so no filename */
+  SAVE_DUPLICATE     /* an earlier run has the same filename */
+} save_status;
+
+
+typedef struct save_job {
+  garmin_data *       rlist;
+  garmin_data *       rlaps;
+  garmin_data *       rtracks;
+  char                filename[32];
+  char                filepath[PATH_MAX];
+  save_status         status;
+  uint32              result;
+  garmin_sync_state   run;      /* the run, for the unit's sync state */
+  int                 saved;    /* its file is there (or it can't have one) */
+} save_job;
+
+
+typedef struct save_pool {
+  pthread_mutex_t     lock;
+  pthread_cond_t      queued;   /* a job was queued, or we're closing */
+  pthread_cond_t      space;    /* a job was taken off the queue      */
+  pthread_cond_t      done;     /* a job has been written             */
+  save_job *          queue[SAVE_QUEUE];
+  int                 head;
+  int                 count;
+  int                 closing;
+  int                 threads;
+  pthread_t           thread[SAVE_THREADS];
+} save_pool;
+
+
+static void *
+save_worker ( void * arg )
+{
+  save_pool * pool = arg;
+  save_job *  job;
+  uint32      result;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while ( pool->count == 0 && !pool->closing ) {
+      pthread_cond_wait(&pool->queued,&pool->lock);
+    }
+    if ( pool->count == 0 ) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    job = pool->queue[pool->head];
+    pool->head = (pool->head + 1) % SAVE_QUEUE;
+    pool->count--;
+    pthread_cond_signal(&pool->space);
+    pthread_mutex_unlock(&pool->lock);
+
+    result = garmin_save(job->rlist,job->filename,job->filepath);
+
+    pthread_mutex_lock(&pool->lock);
+    job->result = result;
+    job->status = SAVE_DONE;
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+
+static void
+save_pool_start ( save_pool * pool )
+{
+  memset(pool,0,sizeof(save_pool));
+  pthread_mutex_init(&pool->lock,NULL);
+  pthread_cond_init(&pool->queued,NULL);
+  pthread_cond_init(&pool->space,NULL);
+  pthread_cond_init(&pool->done,NULL);
+
+  while ( pool->threads < SAVE_THREADS &&
+	  pthread_create(&pool->thread[pool->threads],NULL,
+			 save_worker,pool) == 0 ) {
+    pool->threads++;
+  }
+}
+
+
+/* Queue a job, waiting for room.  Without any threads, save it now. */
+
+static void
+save_pool_submit ( save_pool * pool, save_job * job )
+{
+  if ( pool->threads == 0 ) {
+    job->result = garmin_save(job->rlist,job->filename,job->filepath);
+    job->status = SAVE_DONE;
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while ( pool->count == SAVE_QUEUE ) {
+    pthread_cond_wait(&pool->space,&pool->lock);
+  }
+  pool->queue[(pool->head + pool->count) % SAVE_QUEUE] = job;
+  pool->count++;
+  pthread_cond_signal(&pool->queued);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+/* Is the job finished?  If 'wait' is set, wait until it is. */
+
+static int
+save_pool_finished ( save_pool * pool, save_job * job, int wait )
+{
+  int finished;
+
+  pthread_mutex_lock(&pool->lock);
+  while ( wait && job->status == SAVE_PENDING ) {
+    pthread_cond_wait(&pool->done,&pool->lock);
+  }
+  finished = (job->status != SAVE_PENDING);
+  pthread_mutex_unlock(&pool->lock);
+
+  return finished;
+}
+
+
+static void
+save_pool_stop ( save_pool * pool )
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->closing = 1;
+  pthread_cond_broadcast(&pool->queued);
+  pthread_mutex_unlock(&pool->lock);
+
+  for ( i = 0; i < pool->threads; i++ ) {
+    pthread_join(pool->thread[i],NULL);
+  }
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->space);
+  pthread_cond_destroy(&pool->queued);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+
+/* Report how a job went, and free the temporary lists it was using. */
+
+static void
+save_job_report ( save_job * job )
+{
+  char        path[PATH_MAX + 32];
+  struct stat sb;
+
+  switch ( job->status ) {
+  case SAVE_NO_START:
+    printf("Start time of first lap not found!\n");
+    job->saved = 1;
+    break;
+  case SAVE_DONE:
+    if ( job->result != 0 ) {
+      printf("Wrote:   %s/%s\n",job->filepath,job->filename);
+      job->saved = 1;
+      break;
+    }
+    /* fall through */
+  default:
+    printf("Skipped: %s/%s\n",job->filepath,job->filename);
+    snprintf(path,sizeof(path),"%s/%s",job->filepath,job->filename);
+    job->saved = (stat(path,&sb) != -1);
+    break;
+  }
+
+  if ( job->rlaps != NULL ) {
+    garmin_free_list_only(job->rlaps->data);
+    free(job->rlaps);
+  }
+
+  if ( job->rtracks != NULL ) {
+    garmin_free_list_only(job->rtracks->data);
+    free(job->rtracks);
+  }
+
+  if ( job->rlist != NULL ) {
+    garmin_free_list_only(job->rlist->data);
+    free(job->rlist);
+  }
+}
+
+
+/* 
+   Move the sync state up to the newest run that has been saved, as long
+   as no run older than it failed to save.  Returns 1 if it moved.
+*/
+
+static int
+update_sync_state ( garmin_sync_state * state, save_job * jobs, uint32 count )
+{
+  save_job *  newest = NULL;
+  uint32      limit  = UINT_MAX;
+  uint32      i;
+
+  for ( i = 0; i < count; i++ ) {
+    if ( jobs[i].saved == 0 && jobs[i].run.last_lap < limit ) {
+      limit = jobs[i].run.last_lap;
+    }
+  }
+
+  for ( i = 0; i < count; i++ ) {
+    if ( jobs[i].saved != 0 && jobs[i].run.last_lap < limit &&
+	 (newest == NULL || jobs[i].run.last_lap > newest->run.last_lap) ) {
+      newest = &jobs[i];
+    }
+  }
+
+  if ( newest == NULL ) return 0;
+  if ( state->valid != 0 && newest->run.last_lap <= state->last_lap ) return 0;
+
+  state->track         = newest->run.track;
+  state->first_lap     = newest->run.first_lap;
+  state->last_lap      = newest->run.last_lap;
+  state->start_time    = newest->run.start_time;
+  state->last_lap_time = newest->run.last_lap_time;
+  state->valid         = 1;
+
+  return 1;
+}
+
+
+/* 
+   Save the runs on the unit.  If 'incremental' is set, only the runs newer
+   than the newest one saved last time are read and saved.
+*/
+
+static void
+save_runs ( garmin_unit * garmin, int incremental )
 {
   garmin_data *       data;
   garmin_data *       data0;
@@ -191,17 +609,30 @@ garmin_save_runs ( garmin_unit * garmin )
   garmin_data *       rlist;
   garmin_list_node *  n;
   garmin_list_node *  m;
+  lap_entry *         lap_map;
+  track_entry *       track_map;
+  uint32              lap_count   = 0;
+  uint32              track_count = 0;
+  save_pool           pool;
+  save_job *          jobs;
+  save_job *          job;
+  uint32              submitted;
+  uint32              reported;
+  uint32              i;
   uint32              trk;
   uint32              f_lap;
   uint32              l_lap;
   uint32              l_idx;
   time_type           start;
   time_t              start_time;
-  char                filename[BUFSIZ];
   char *              filedir = NULL;
+  const char *        format  = "%Y%m%dT%H%M%S.gmn";
   char                path[PATH_MAX];
-  char                filepath[BUFSIZ];
-  struct tm *         tbuf;
+  struct tm           tbuf;
+  char                when[32];
+  garmin_sync_state   state;
+  int                 known  = 0;
+  uint32              old    = 0;
 
   if ( (filedir = getenv("GARMIN_SAVE_RUNS")) != NULL ) {
     filedir = realpath(filedir,path);
@@ -214,11 +645,39 @@ garmin_save_runs ( garmin_unit * garmin )
     filedir = getcwd(path,sizeof(path));
   }
 
+  /* Save in the compact .gmnz format if GARMIN_SAVE_GMNZ is set. */
+
+  if ( getenv("GARMIN_SAVE_GMNZ") != NULL ) {
+    format = "%Y%m%dT%H%M%S.gmnz";
+  }
+
   printf("Extracting data from Garmin %s\n",
 	 garmin->product.product_description);
   printf("Files will be saved in '%s'\n",filedir);
 
-  if ( (data = garmin_get(garmin,GET_RUNS)) != NULL ) {
+  /* Find out which run we saved last, and read only the ones after it. */
+
+  if ( incremental ) {
+    known = garmin_load_sync_state(filedir,garmin->id,&state);
+    if ( known ) {
+      start_time = state.start_time;
+      localtime_r(&start_time,&tbuf);
+      strftime(when,sizeof(when),"%Y-%m-%d %H:%M:%S",&tbuf);
+      printf("Saving runs newer than the one of %s\n",when);
+    }
+    data = garmin_get_new_runs(garmin,&state);
+    if ( known && state.valid == 0 ) {
+      printf("Unit has changed since the last sync; saving every run\n");
+    }
+  } else {
+    data = garmin_get(garmin,GET_RUNS);
+  }
+
+  if ( garmin->usb.error != 0 ) {
+    /* The unit stopped answering; what we have may be cut short. */
+    printf("Transfer failed: %s\n",strerror(-garmin->usb.error));
+    if ( data != NULL ) garmin_free_data(data);
+  } else if ( data != NULL ) {
 
     /* 
        We should have a list with three elements:
@@ -248,91 +707,141 @@ garmin_save_runs ( garmin_unit * garmin )
 	}
       }
       
-      /* For each run, get its laps and track points. */
+      /* Sort the laps and the tracks by index, once. */
 
-      for ( n = runs->head; n != NULL; n = n->next ) {
-	if ( get_run_track_lap_info(n->data,&trk,&f_lap,&l_lap) != 0 ) {
+      lap_map   = map_laps(laps,&lap_count);
+      track_map = map_tracks(tracks,&track_count);
 
-	  if ( garmin->verbose != 0 ) {
-	    printf("[garmin] run: track [%d], laps [%d:%d]\n",trk,f_lap,l_lap);
-	  }
+      jobs      = calloc(runs->elements + 1,sizeof(save_job));
 
-	  start = 0;
+      if ( lap_map != NULL && track_map != NULL && jobs != NULL ) {
+	submitted = 0;
+	reported  = 0;
+	save_pool_start(&pool);
 
-	  /* Get the laps. */
+	/* For each run, get its laps and track points. */
 
-	  rlaps = garmin_alloc_data(data_Dlist);
-	  for ( m = laps->head; m != NULL; m = m->next ) {
-	    if ( get_lap_index(m->data,&l_idx) != 0 ) {
-	      if ( l_idx >= f_lap && l_idx <= l_lap ) {
-		if ( garmin->verbose != 0 ) {
-		  printf("[garmin] lap [%d] falls within laps [%d:%d]\n",
-			 l_idx,f_lap,l_lap);
-		}
+	for ( n = runs->head; n != NULL; n = n->next ) {
+	  if ( incremental && !garmin_run_is_new(&state,n->data) ) {
+	    /* Saved before, and its laps and tracks weren't even read. */
+	    old++;
+	  } else if ( get_run_track_lap_info(n->data,&trk,&f_lap,&l_lap) != 0 ) {
 
-		garmin_list_append(rlaps->data,m->data);
+	    job = &jobs[submitted++];
+	    job->run.track     = trk;
+	    job->run.first_lap = f_lap;
+	    job->run.last_lap  = l_lap;
 
-		if ( l_idx == f_lap ) {
-		  get_lap_start_time(m->data,&start);
-		  if ( garmin->verbose != 0 ) {
-		    printf("[garmin] first lap [%d] has start time [%d]\n",
-			   l_idx,(int)start);
-		  }
-		}
-	      }
+	    if ( garmin->verbose != 0 ) {
+	      printf("[garmin] run: track [%d], laps [%d:%d]\n",trk,f_lap,l_lap);
 	    }
-	  }
 
-	  /* Get the track points. */
-	  
-	  rtracks = get_track(tracks,trk);
+	    start = 0;
 
-	  /* Now make a three-element list for this run. */
+	    /* Get the laps. */
 
-	  rlist = garmin_alloc_data(data_Dlist);
-	  garmin_list_append(rlist->data,n->data);
-	  garmin_list_append(rlist->data,rlaps);
-	  garmin_list_append(rlist->data,rtracks);
+	    rlaps = garmin_alloc_data(data_Dlist);
+	    for ( i = find_lap(lap_map,lap_count,f_lap);
+		  i < lap_count && lap_map[i].index <= l_lap; i++ ) {
+	      l_idx = lap_map[i].index;
+	      if ( garmin->verbose != 0 ) {
+		printf("[garmin] lap [%d] falls within laps [%d:%d]\n",
+		       l_idx,f_lap,l_lap);
+	      }
 
-	  /* 
-	     Determine the filename based on the start time of the first lap. 
-	  */
+	      garmin_list_append(rlaps->data,lap_map[i].lap);
 
-	  if ( (start_time = start) != 0 ) {
-	    tbuf = localtime(&start_time);
-	    snprintf(filepath,sizeof(filepath)-1,"%s/%d/%02d",
-		    filedir,tbuf->tm_year+1900,tbuf->tm_mon+1);
-	    strftime(filename,sizeof(filename),"%Y%m%dT%H%M%S.gmn",tbuf);
+	      if ( l_idx == f_lap ) {
+		get_lap_start_time(lap_map[i].lap,&start);
+		if ( garmin->verbose != 0 ) {
+		  printf("[garmin] first lap [%d] has start time [%d]\n",
+			 l_idx,(int)start);
+		}
+	      }
+	      if ( l_idx == l_lap ) {
+		get_lap_start_time(lap_map[i].lap,&job->run.last_lap_time);
+	      }
+	    }
 
-	    /* Save rlist to the file. */
+	    job->run.start_time = start;
 
-	    if ( garmin_save(rlist,filename,filepath) != 0 ) {
-	      printf("Wrote:   %s/%s\n",filepath,filename);
+	    /* Get the track points. */
+	  
+	    rtracks = find_track(track_map,track_count,trk);
+
+	    /* Now make a three-element list for this run. */
+
+	    rlist = garmin_alloc_data(data_Dlist);
+	    garmin_list_append(rlist->data,n->data);
+	    garmin_list_append(rlist->data,rlaps);
+	    garmin_list_append(rlist->data,rtracks);
+
+	    job->rlist   = rlist;
+	    job->rlaps   = rlaps;
+	    job->rtracks = rtracks;
+
+	    /* 
+	       Determine the filename based on the start time of the first lap. 
+	    */
+
+	    if ( (start_time = start) != 0 ) {
+	      localtime_r(&start_time,&tbuf);
+	      snprintf(job->filepath,sizeof(job->filepath)-1,"%s/%d/%02d",
+		      filedir,tbuf.tm_year+1900,tbuf.tm_mon+1);
+	      strftime(job->filename,sizeof(job->filename),format,&tbuf);
+
+	      /* 
+		 Save rlist to the file, unless an earlier run in this batch
+		 is going to (it would have been saved first, one at a time).
+	      */
+
+	      for ( i = 0; i < submitted - 1; i++ ) {
+		if ( strcmp(jobs[i].filename,job->filename) == 0 &&
+		     strcmp(jobs[i].filepath,job->filepath) == 0 ) {
+		  job->status = SAVE_DUPLICATE;
+		  break;
+		}
+	      }
+	      if ( job->status == SAVE_PENDING ) {
+		save_pool_submit(&pool,job);
+	      }
 	    } else {
-	      printf("Skipped: %s/%s\n",filepath,filename);
+	      job->status = SAVE_NO_START;
 	    }
-	  } else {
-	    printf("Start time of first lap not found!\n");
 	  }
 
-	  /* Free the temporary lists we were using. */
+	  /* Report whatever has finished, in order. */
 
-	  if ( rlaps != NULL ) {
-	    garmin_free_list_only(rlaps->data);
-	    free(rlaps);
+	  while ( reported < submitted &&
+		  save_pool_finished(&pool,&jobs[reported],0) ) {
+	    save_job_report(&jobs[reported++]);
 	  }
+	}
 
-	  if ( rtracks != NULL ) {
-	    garmin_free_list_only(rtracks->data);
-	    free(rtracks);
-	  }
+	/* Wait for the rest of the writes. */
 
-	  if ( rlist != NULL ) {
-	    garmin_free_list_only(rlist->data);
-	    free(rlist);
+	while ( reported < submitted ) {
+	  save_pool_finished(&pool,&jobs[reported],1);
+	  save_job_report(&jobs[reported++]);
+	}
+
+	save_pool_stop(&pool);
+
+	if ( incremental ) {
+	  if ( old > 0 ) {
+	    printf("Already saved: %d run%s\n",old,(old == 1) ? "" : "s");
+	  }
+	  if ( update_sync_state(&state,jobs,submitted) != 0 ) {
+	    garmin_save_sync_state(filedir,&state);
 	  }
 	}
+      } else {
+	printf("garmin_save_runs: out of memory\n");
       }
+
+      free(jobs);
+      free(lap_map);
+      free(track_map);
     } else {
       if ( data0 == NULL ) {
 	printf("Toplevel data missing element 0 (runs)\n");
@@ -355,3 +864,25 @@ garmin_save_runs ( garmin_unit * garmin )
     printf("Unable to extract any data!\n");
   }
 }
+
+
+/* Save every run on the unit. */
+
+void
+garmin_save_runs ( garmin_unit * garmin )
+{
+  save_runs(garmin,0);
+}
+
+
+/* 
+   Save the runs that are newer than the ones saved by the last call, for
+   this unit and directory.  The newest run saved is remembered in the
+   directory (see garmin_save_sync_state).
+*/
+
+void
+garmin_save_new_runs ( garmin_unit * garmin )
+{
+  save_runs(garmin,1);
+}
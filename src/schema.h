@@ -0,0 +1,1040 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+   The packed layout of every Garmin data type, field by field, in the
+   order the fields appear on the wire.  This is the only place where a
+   record layout is written down: unpack.c, pack.c and datatype.c
+   generate their per-type code from it, and every switch over the data
+   types (including the one in print.c) is generated from the list of
+   records here.
+
+   This file has no include guard.  Define the macros for the code you
+   want, then include it; any macro left undefined expands to nothing,
+   and all of them are undefined again at the end.
+
+     RECORD(x)     start the record for data type D<x>
+     END_RECORD    end it
+
+     F_U8(f)       uint8                F_S16(f)      sint16
+     F_U16(f)      uint16               F_S32(f)      sint32
+     F_U32(f)      uint32               F_F32(f)      float32
+     F_F64(f)      float64              F_POS(f)      position_type
+     F_RPT(f)      radian_position_type
+     F_CNT(f,n)    uint32 count of at most n (F_U32 unless defined; the
+                   unpacker clamps it so a bad file can't overrun arrays)
+     F_STR(f)      fixed size character array (always NUL-terminated)
+     F_VST(f)      variable length, NUL-terminated string (char *)
+     F_PAD(n)      n bytes that are not stored (zero when packed)
+     F_REC(x,f)    a nested D<x> record
+     F_LOOP(i,n)   repeat the following fields n times, with index i
+     F_END_LOOP    end of the repeated fields
+
+   A field 'f' is written as a member designator starting with '.', so
+   (*r)f names it in a record 'r' (e.g. '.posn', '.steps[i].intensity').
+   An empty 'f' means the record itself (D200 is a single uint8).
+*/
+
+#ifndef RECORD
+#define RECORD(x)
+#endif
+#ifndef END_RECORD
+#define END_RECORD
+#endif
+#ifndef F_U8
+#define F_U8(f)
+#endif
+#ifndef F_U16
+#define F_U16(f)
+#endif
+#ifndef F_S16
+#define F_S16(f)
+#endif
+#ifndef F_U32
+#define F_U32(f)
+#endif
+#ifndef F_CNT
+#define F_CNT(f,n) F_U32(f)
+#endif
+#ifndef F_S32
+#define F_S32(f)
+#endif
+#ifndef F_F32
+#define F_F32(f)
+#endif
+#ifndef F_F64
+#define F_F64(f)
+#endif
+#ifndef F_POS
+#define F_POS(f)
+#endif
+#ifndef F_RPT
+#define F_RPT(f)
+#endif
+#ifndef F_STR
+#define F_STR(f)
+#endif
+#ifndef F_VST
+#define F_VST(f)
+#endif
+#ifndef F_PAD
+#define F_PAD(n)
+#endif
+#ifndef F_REC
+#define F_REC(x,f)
+#endif
+#ifndef F_LOOP
+#define F_LOOP(i,n)
+#endif
+#ifndef F_END_LOOP
+#define F_END_LOOP
+#endif
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.1   D100                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(100)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.2   D101                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(101)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_U8(.smbl)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.3   D102                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(102)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_U16(.smbl)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.4   D103                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(103)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_U8(.smbl)
+  F_U8(.dspl)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.5   D104                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(104)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_U16(.smbl)
+  F_U8(.dspl)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.6   D105                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(105)
+  F_POS(.posn)
+  F_U16(.smbl)
+  F_VST(.wpt_ident)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.7   D106                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(106)
+  F_U8(.wpt_class)
+  F_STR(.subclass)
+  F_POS(.posn)
+  F_U16(.smbl)
+  F_VST(.wpt_ident)
+  F_VST(.lnk_ident)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.8   D107                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(107)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_U8(.smbl)
+  F_U8(.dspl)
+  F_F32(.dst)
+  F_U8(.color)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.9   D108                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(108)
+  F_U8(.wpt_class)
+  F_U8(.color)
+  F_U8(.dspl)
+  F_U8(.attr)
+  F_U16(.smbl)
+  F_STR(.subclass)
+  F_POS(.posn)
+  F_F32(.alt)
+  F_F32(.dpth)
+  F_F32(.dist)
+  F_STR(.state)
+  F_STR(.cc)
+  F_VST(.ident)
+  F_VST(.comment)
+  F_VST(.facility)
+  F_VST(.city)
+  F_VST(.addr)
+  F_VST(.cross_road)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.10  D109                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(109)
+  F_U8(.dtyp)
+  F_U8(.wpt_class)
+  F_U8(.dspl_color)
+  F_U8(.attr)
+  F_U16(.smbl)
+  F_STR(.subclass)
+  F_POS(.posn)
+  F_F32(.alt)
+  F_F32(.dpth)
+  F_F32(.dist)
+  F_STR(.state)
+  F_STR(.cc)
+  F_U32(.ete)
+  F_VST(.ident)
+  F_VST(.comment)
+  F_VST(.facility)
+  F_VST(.city)
+  F_VST(.addr)
+  F_VST(.cross_road)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.11  D110                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(110)
+  F_U8(.dtyp)
+  F_U8(.wpt_class)
+  F_U8(.dspl_color)
+  F_U8(.attr)
+  F_U16(.smbl)
+  F_STR(.subclass)
+  F_POS(.posn)
+  F_F32(.alt)
+  F_F32(.dpth)
+  F_F32(.dist)
+  F_STR(.state)
+  F_STR(.cc)
+  F_U32(.ete)
+  F_F32(.temp)
+  F_U32(.time)
+  F_U16(.wpt_cat)
+  F_VST(.ident)
+  F_VST(.comment)
+  F_VST(.facility)
+  F_VST(.city)
+  F_VST(.addr)
+  F_VST(.cross_road)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.12  D120                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(120)
+  F_STR(.name)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.13  D150                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(150)
+  F_STR(.ident)
+  F_STR(.cc)
+  F_U8(.wpt_class)
+  F_POS(.posn)
+  F_S16(.alt)
+  F_STR(.city)
+  F_STR(.state)
+  F_STR(.name)
+  F_STR(.cmnt)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.14  D151                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(151)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_STR(.name)
+  F_STR(.city)
+  F_STR(.state)
+  F_S16(.alt)
+  F_STR(.cc)
+  F_PAD(1)
+  F_U8(.wpt_class)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.15  D152                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(152)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_STR(.name)
+  F_STR(.city)
+  F_STR(.state)
+  F_S16(.alt)
+  F_STR(.cc)
+  F_PAD(1)
+  F_U8(.wpt_class)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.16  D154                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(154)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_STR(.name)
+  F_STR(.city)
+  F_STR(.state)
+  F_S16(.alt)
+  F_STR(.cc)
+  F_PAD(1)
+  F_U8(.wpt_class)
+  F_U16(.smbl)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.17  D155                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(155)
+  F_STR(.ident)
+  F_POS(.posn)
+  F_PAD(4)
+  F_STR(.cmnt)
+  F_F32(.dst)
+  F_STR(.name)
+  F_STR(.city)
+  F_STR(.state)
+  F_S16(.alt)
+  F_STR(.cc)
+  F_PAD(1)
+  F_U8(.wpt_class)
+  F_U16(.smbl)
+  F_U8(.dspl)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.18  D200                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(200)
+  F_U8()
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.19  D201                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(201)
+  F_U8(.nmbr)
+  F_STR(.cmnt)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.20  D202                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(202)
+  F_VST(.rte_ident)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.21  D210                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(210)
+  F_U16(.link_class)
+  F_STR(.subclass)
+  F_VST(.ident)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.22  D300                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(300)
+  F_POS(.posn)
+  F_U32(.time)
+  F_U8(.new_trk)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.23  D301                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(301)
+  F_POS(.posn)
+  F_U32(.time)
+  F_F32(.alt)
+  F_F32(.dpth)
+  F_U8(.new_trk)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.24  D302                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(302)
+  F_POS(.posn)
+  F_U32(.time)
+  F_F32(.alt)
+  F_F32(.dpth)
+  F_F32(.temp)
+  F_U8(.new_trk)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.25  D303                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(303)
+  F_POS(.posn)
+  F_U32(.time)
+  F_F32(.alt)
+  F_U8(.heart_rate)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.26  D304                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(304)
+  F_POS(.posn)
+  F_U32(.time)
+  F_F32(.alt)
+  F_F32(.distance)
+  F_U8(.heart_rate)
+  F_U8(.cadence)
+  F_U8(.sensor)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.27  D310                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(310)
+  F_U8(.dspl)
+  F_U8(.color)
+  F_VST(.trk_ident)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.28  D311                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(311)
+  F_U16(.index)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.29  D312                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(312)
+  F_U8(.dspl)
+  F_U8(.color)
+  F_VST(.trk_ident)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.30  D400                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(400)
+  F_REC(100,.wpt)
+  F_PAD(sizeof(D100))
+  F_F32(.dst)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.31  D403                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(403)
+  F_REC(103,.wpt)
+  F_PAD(sizeof(D103))
+  F_F32(.dst)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.32  D450                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(450)
+  F_U32(.idx)
+  F_REC(150,.wpt)
+  F_PAD(sizeof(D150))
+  F_F32(.dst)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.33  D500                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(500)
+  F_U16(.wn)
+  F_F32(.toa)
+  F_F32(.af0)
+  F_F32(.af1)
+  F_F32(.e)
+  F_F32(.sqrta)
+  F_F32(.m0)
+  F_F32(.w)
+  F_F32(.omg0)
+  F_F32(.odot)
+  F_F32(.i)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.34  D501                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(501)
+  F_U16(.wn)
+  F_F32(.toa)
+  F_F32(.af0)
+  F_F32(.af1)
+  F_F32(.e)
+  F_F32(.sqrta)
+  F_F32(.m0)
+  F_F32(.w)
+  F_F32(.omg0)
+  F_F32(.odot)
+  F_F32(.i)
+  F_U8(.hlth)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.35  D550                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(550)
+  F_U8(.svid)
+  F_U16(.wn)
+  F_F32(.toa)
+  F_F32(.af0)
+  F_F32(.af1)
+  F_F32(.e)
+  F_F32(.sqrta)
+  F_F32(.m0)
+  F_F32(.w)
+  F_F32(.omg0)
+  F_F32(.odot)
+  F_F32(.i)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.36  D551                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(551)
+  F_U8(.svid)
+  F_U16(.wn)
+  F_F32(.toa)
+  F_F32(.af0)
+  F_F32(.af1)
+  F_F32(.e)
+  F_F32(.sqrta)
+  F_F32(.m0)
+  F_F32(.w)
+  F_F32(.omg0)
+  F_F32(.odot)
+  F_F32(.i)
+  F_U8(.hlth)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.37  D600                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(600)
+  F_U8(.month)
+  F_U8(.day)
+  F_U16(.year)
+  F_U16(.hour)
+  F_U8(.minute)
+  F_U8(.second)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.38  D650                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(650)
+  F_U32(.takeoff_time)
+  F_U32(.landing_time)
+  F_POS(.takeoff_posn)
+  F_POS(.landing_posn)
+  F_U32(.night_time)
+  F_U32(.num_landings)
+  F_F32(.max_speed)
+  F_F32(.max_alt)
+  F_F32(.distance)
+  F_U8(.cross_country_flag)
+  F_VST(.departure_name)
+  F_VST(.departure_ident)
+  F_VST(.arrival_name)
+  F_VST(.arrival_ident)
+  F_VST(.ac_id)
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.39  D700                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(700)
+  F_RPT()
+END_RECORD
+
+
+/* ------------------------------------------------------------------------- */
+/* 7.4.40  D800                                                              */
+/* ------------------------------------------------------------------------- */
+
+RECORD(800)
+  F_F32(.alt)
+  F_F32(.epe)
+  F_F32(.eph)
+  F_F32(.epv)
+  F_U16(.fix)
+  F_F64(.tow)
+  F_RPT(.posn)
+  F_F32(.east)
+  F_F32(.north)
+  F_F32(.up)
+  F_F32(.msl_hght)
+  F_S16(.leap_scnds)
+  F_U32(.wn_days)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.41  D906                                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(906)
+  F_U32(.start_time)
+  F_U32(.total_time)
+  F_F32(.total_distance)
+  F_POS(.begin)
+  F_POS(.end)
+  F_U16(.calories)
+  F_U8(.track_index)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.42  D1000                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1000)
+  F_U32(.track_index)
+  F_U32(.first_lap_index)
+  F_U32(.last_lap_index)
+  F_U8(.sport_type)
+  F_U8(.program_type)
+  F_PAD(2)
+  F_U32(.virtual_partner.time)
+  F_F32(.virtual_partner.distance)
+  F_REC(1002,.workout)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.43  D1001                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1001)
+  F_U32(.index)
+  F_U32(.start_time)
+  F_U32(.total_time)
+  F_F32(.total_dist)
+  F_F32(.max_speed)
+  F_POS(.begin)
+  F_POS(.end)
+  F_U16(.calories)
+  F_U8(.avg_heart_rate)
+  F_U8(.max_heart_rate)
+  F_U8(.intensity)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.44  D1002                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1002)
+  F_CNT(.num_valid_steps,20)
+  F_LOOP(i,20)
+    F_STR(.steps[i].custom_name)
+    F_F32(.steps[i].target_custom_zone_low)
+    F_F32(.steps[i].target_custom_zone_high)
+    F_U16(.steps[i].duration_value)
+    F_U8(.steps[i].intensity)
+    F_U8(.steps[i].duration_type)
+    F_U8(.steps[i].target_type)
+    F_U8(.steps[i].target_value)
+    F_PAD(2)
+  F_END_LOOP
+  F_STR(.name)
+  F_U8(.sport_type)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.45  D1003                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1003)
+  F_STR(.workout_name)
+  F_U32(.day)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.46  D1004                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1004)
+  F_LOOP(i,3)
+    F_LOOP(j,5)
+      F_U8(.activities[i].heart_rate_zones[j].low_heart_rate)
+      F_U8(.activities[i].heart_rate_zones[j].high_heart_rate)
+      F_PAD(2)
+    F_END_LOOP
+    F_LOOP(j,10)
+      F_F32(.activities[i].speed_zones[j].low_speed)
+      F_F32(.activities[i].speed_zones[j].high_speed)
+      F_STR(.activities[i].speed_zones[j].name)
+    F_END_LOOP
+    F_F32(.activities[i].gear_weight)
+    F_U8(.activities[i].max_heart_rate)
+    F_PAD(3)
+  F_END_LOOP
+  F_F32(.weight)
+  F_U16(.birth_year)
+  F_U8(.birth_month)
+  F_U8(.birth_day)
+  F_U8(.gender)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.47  D1005                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1005)
+  F_U32(.max_workouts)
+  F_U32(.max_unscheduled_workouts)
+  F_U32(.max_occurrences)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.48  D1006                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1006)
+  F_U16(.index)
+  F_PAD(2)
+  F_STR(.course_name)
+  F_U16(.track_index)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.49  D1007                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1007)
+  F_U16(.course_index)
+  F_U16(.lap_index)
+  F_U32(.total_time)
+  F_F32(.total_dist)
+  F_POS(.begin)
+  F_POS(.end)
+  F_U8(.avg_heart_rate)
+  F_U8(.max_heart_rate)
+  F_U8(.intensity)
+  F_U8(.avg_cadence)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.50  D1008                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1008)
+  F_CNT(.num_valid_steps,20)
+  F_LOOP(i,20)
+    F_STR(.steps[i].custom_name)
+    F_F32(.steps[i].target_custom_zone_low)
+    F_F32(.steps[i].target_custom_zone_high)
+    F_U16(.steps[i].duration_value)
+    F_U8(.steps[i].intensity)
+    F_U8(.steps[i].duration_type)
+    F_U8(.steps[i].target_type)
+    F_U8(.steps[i].target_value)
+    F_PAD(2)
+  F_END_LOOP
+  F_STR(.name)
+  F_U8(.sport_type)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.51  D1009                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1009)
+  F_U16(.track_index)
+  F_U16(.first_lap_index)
+  F_U16(.last_lap_index)
+  F_U8(.sport_type)
+  F_U8(.program_type)
+  F_U8(.multisport)
+  F_PAD(3)
+  F_U32(.quick_workout.time)
+  F_F32(.quick_workout.distance)
+  F_REC(1008,.workout)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.52  D1010                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1010)
+  F_U32(.track_index)
+  F_U32(.first_lap_index)
+  F_U32(.last_lap_index)
+  F_U8(.sport_type)
+  F_U8(.program_type)
+  F_U8(.multisport)
+  F_PAD(1)
+  F_U32(.virtual_partner.time)
+  F_F32(.virtual_partner.distance)
+  F_REC(1002,.workout)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.53  D1011                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1011)
+  F_U16(.index)
+  F_PAD(2)
+  F_U32(.start_time)
+  F_U32(.total_time)
+  F_F32(.total_dist)
+  F_F32(.max_speed)
+  F_POS(.begin)
+  F_POS(.end)
+  F_U16(.calories)
+  F_U8(.avg_heart_rate)
+  F_U8(.max_heart_rate)
+  F_U8(.intensity)
+  F_U8(.avg_cadence)
+  F_U8(.trigger_method)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.54  D1012                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1012)
+  F_STR(.name)
+  F_PAD(1)
+  F_U16(.course_index)
+  F_PAD(2)
+  F_U32(.track_point_time)
+  F_U8(.point_type)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.55  D1013                                                             */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1013)
+  F_U32(.max_courses)
+  F_U32(.max_course_laps)
+  F_U32(.max_course_pnt)
+  F_U32(.max_course_trk_pnt)
+END_RECORD
+
+
+/* --------------------------------------------------------------------------*/
+/* 7.4.XX  D1015 (Undocumented)                                              */
+/* --------------------------------------------------------------------------*/
+
+RECORD(1015)
+  F_U16(.index)
+  F_PAD(2)
+  F_U32(.start_time)
+  F_U32(.total_time)
+  F_F32(.total_dist)
+  F_F32(.max_speed)
+  F_POS(.begin)
+  F_POS(.end)
+  F_U16(.calories)
+  F_U8(.avg_heart_rate)
+  F_U8(.max_heart_rate)
+  F_U8(.intensity)
+  F_U8(.avg_cadence)
+  F_U8(.trigger_method)
+
+  /* 
+     Garmin has not gotten back to me about what these fields mean, and
+     whether all of the bytes are needed or just, say, three of them.
+     This is annoying, because it means we may end up with .gmn files
+     that have oversized D1015 elements, but it shouldn't affect our
+     ability to read those files.  We don't make any assumptions about
+     the size of each element.
+  */
+
+  F_U8(.unknown[0])
+  F_U8(.unknown[1])
+  F_U8(.unknown[2])
+  F_U8(.unknown[3])
+  F_U8(.unknown[4])
+END_RECORD
+
+
+#undef RECORD
+#undef END_RECORD
+#undef F_U8
+#undef F_U16
+#undef F_S16
+#undef F_U32
+#undef F_CNT
+#undef F_S32
+#undef F_F32
+#undef F_F64
+#undef F_POS
+#undef F_RPT
+#undef F_STR
+#undef F_VST
+#undef F_PAD
+#undef F_REC
+#undef F_LOOP
+#undef F_END_LOOP
@@ -0,0 +1,247 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "garmin.h"
+
+
+/* Seconds since some fixed point, for timing things. */
+
+float64
+garmin_stats_clock ( void )
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,NULL);
+
+  return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+
+/* Count a call that took 'seconds' in a latency histogram. */
+
+void
+garmin_stats_latency ( uint32 * histogram, float64 seconds )
+{
+  float64 us = seconds * 1.0e6;
+  int     i  = 0;
+
+  while ( i < GARMIN_STATS_BUCKETS - 1 && us >= (float64)(1 << i) ) i++;
+  histogram[i]++;
+}
+
+
+void
+garmin_stats_reset ( garmin_unit * garmin )
+{
+  memset(&garmin->stats,0,sizeof(garmin->stats));
+}
+
+
+/*
+   Start counting traffic against an application protocol.  Returns the
+   phase that was being counted before, for garmin_stats_leave.  If there
+   are too many protocols, the rest are counted with protocol 0.
+*/
+
+int
+garmin_stats_enter ( garmin_unit * garmin, appl_protocol protocol )
+{
+  garmin_stats * s        = &garmin->stats;
+  int            previous = s->current;
+  int            i;
+
+  for ( i = 1; i <= s->phases; i++ ) {
+    if ( s->phase[i].protocol == protocol ) break;
+  }
+  if ( i > s->phases ) {
+    if ( protocol == appl_Anil || i == GARMIN_STATS_PHASES ) {
+      i = 0;
+    } else {
+      s->phases = i;
+      s->phase[i].protocol = protocol;
+    }
+  }
+  s->current = i;
+
+  return previous;
+}
+
+
+void
+garmin_stats_leave ( garmin_unit * garmin, int previous )
+{
+  garmin->stats.current = previous;
+}
+
+
+/* The counters for one protocol, or NULL if it hasn't been used. */
+
+garmin_phase_stats *
+garmin_stats_phase ( garmin_unit * garmin, appl_protocol protocol )
+{
+  garmin_stats * s = &garmin->stats;
+  int            i;
+
+  if ( protocol == appl_Anil ) return &s->phase[0];
+
+  for ( i = 1; i <= s->phases; i++ ) {
+    if ( s->phase[i].protocol == protocol ) return &s->phase[i];
+  }
+
+  return NULL;
+}
+
+
+/* Add up the counters of every protocol. */
+
+void
+garmin_stats_total ( garmin_unit * garmin, garmin_phase_stats * total )
+{
+  garmin_phase_stats * p;
+  int                  i;
+  int                  j;
+
+  memset(total,0,sizeof(garmin_phase_stats));
+
+  for ( i = 0; i <= garmin->stats.phases; i++ ) {
+    p = &garmin->stats.phase[i];
+    total->packets_read    += p->packets_read;
+    total->packets_written += p->packets_written;
+    total->bytes_read      += p->bytes_read;
+    total->bytes_written   += p->bytes_written;
+    total->timeouts        += p->timeouts;
+    total->errors          += p->errors;
+    total->retries         += p->retries;
+    total->read_wait       += p->read_wait;
+    total->write_wait      += p->write_wait;
+    total->unpack          += p->unpack;
+    for ( j = 0; j < GARMIN_STATS_BUCKETS; j++ ) {
+      total->read_latency[j]  += p->read_latency[j];
+      total->write_latency[j] += p->write_latency[j];
+    }
+  }
+}
+
+
+static void
+garmin_print_histogram ( const char * name, uint32 * h, FILE * fp )
+{
+  int i;
+
+  fprintf(fp,"\"%s\": [",name);
+  for ( i = 0; i < GARMIN_STATS_BUCKETS; i++ ) {
+    fprintf(fp,"%s%u",(i) ? "," : "",h[i]);
+  }
+  fprintf(fp,"]");
+}
+
+
+static void
+garmin_print_phase ( const char *         name,
+		     garmin_phase_stats * p,
+		     FILE *               fp,
+		     int                  spaces )
+{
+  fprintf(fp,"%*s\"%s\": {\n",spaces,"",name);
+  fprintf(fp,"%*s\"packets_read\": %u, \"bytes_read\": %u, "
+	  "\"packets_written\": %u, \"bytes_written\": %u,\n",spaces+2,"",
+	  p->packets_read,p->bytes_read,p->packets_written,p->bytes_written);
+  fprintf(fp,"%*s\"timeouts\": %u, \"errors\": %u, \"retries\": %u,\n",
+	  spaces+2,"",p->timeouts,p->errors,p->retries);
+  fprintf(fp,"%*s\"read_wait\": %.6f, \"write_wait\": %.6f, "
+	  "\"unpack\": %.6f,\n",spaces+2,"",
+	  p->read_wait,p->write_wait,p->unpack);
+  fprintf(fp,"%*s",spaces+2,"");
+  garmin_print_histogram("read_latency",p->read_latency,fp);
+  fprintf(fp,",\n%*s",spaces+2,"");
+  garmin_print_histogram("write_latency",p->write_latency,fp);
+  fprintf(fp,"\n%*s}",spaces,"");
+}
+
+
+/* ========================================================================= */
+/* garmin_print_stats                                                        */
+/*                                                                           */
+/* Print the counters as a JSON object: the total, and then each protocol    */
+/* ("session" for the traffic outside any transfer).                         */
+/* ========================================================================= */
+
+void
+garmin_print_stats ( garmin_unit * garmin, FILE * fp, int spaces )
+{
+  garmin_phase_stats   total;
+  garmin_phase_stats * p;
+  char                 name[16];
+  int                  i;
+
+  garmin_stats_total(garmin,&total);
+
+  fprintf(fp,"%*s{\n",spaces,"");
+  fprintf(fp,"%*s\"unit\": \"%x\",\n",spaces+2,"",garmin->id);
+  fprintf(fp,"%*s\"latency_limits_us\": [",spaces+2,"");
+  for ( i = 0; i < GARMIN_STATS_BUCKETS - 1; i++ ) {
+    fprintf(fp,"%s%u",(i) ? "," : "",1 << i);
+  }
+  fprintf(fp,",null],\n");
+  garmin_print_phase("total",&total,fp,spaces+2);
+  fprintf(fp,",\n%*s\"protocols\": {\n",spaces+2,"");
+  for ( i = 0; i <= garmin->stats.phases; i++ ) {
+    p = &garmin->stats.phase[i];
+    if ( i == 0 ) {
+      strcpy(name,"session");
+    } else {
+      snprintf(name,sizeof(name),"A%03d",p->protocol);
+    }
+    garmin_print_phase(name,p,fp,spaces+4);
+    fprintf(fp,"%s\n",(i < garmin->stats.phases) ? "," : "");
+  }
+  fprintf(fp,"%*s}\n",spaces+2,"");
+  fprintf(fp,"%*s}\n",spaces,"");
+}
+
+
+/* 
+   Write the counters as JSON to a file, or to stdout if the filename is
+   "-".  Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_save_stats ( garmin_unit * garmin, const char * filename )
+{
+  FILE * fp;
+
+  if ( strcmp(filename,"-") == 0 ) {
+    garmin_print_stats(garmin,stdout,0);
+    return 1;
+  }
+
+  if ( (fp = fopen(filename,"w")) == NULL ) {
+    printf("%s: %s\n",filename,strerror(errno));
+    return 0;
+  }
+
+  garmin_print_stats(garmin,fp,0);
+
+  return (fclose(fp) == 0);
+}
@@ -0,0 +1,161 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "garmin.h"
+#include "byte_util.h"
+
+
+/*
+   The sync state of a unit is kept in the directory its runs are saved
+   in, as 'sync-<unit id>.gms':
+
+     GARMIN_S_MAGIC (12 bytes), GARMIN_VERSION, unit id
+     track, first_lap, last_lap, start_time, last_lap_time
+
+   all little-endian, 4 bytes each.
+*/
+
+#define SYNC_FILE_SIZE  (GARMIN_HEADER + 20)
+
+
+static void
+garmin_sync_filename ( const char * dir, uint32 id, char * path, int size )
+{
+  snprintf(path,size,"%s/sync-%08x.gms",dir,id);
+}
+
+
+/* ========================================================================= */
+/* garmin_load_sync_state                                                    */
+/*                                                                           */
+/* Load the sync state of unit 'id' from 'dir'.  Returns 1 if there was one. */
+/* Otherwise returns 0, with the state cleared (every run is new).           */
+/* ========================================================================= */
+
+int
+garmin_load_sync_state ( const char *        dir,
+			 uint32              id,
+			 garmin_sync_state * state )
+{
+  FILE *  fp;
+  uint8   buf[SYNC_FILE_SIZE];
+  char    path[PATH_MAX];
+  int     ok = 0;
+
+  memset(state,0,sizeof(garmin_sync_state));
+  state->id = id;
+
+  garmin_sync_filename(dir,id,path,sizeof(path));
+
+  if ( (fp = fopen(path,"r")) == NULL ) {
+    if ( errno != ENOENT ) printf("%s: %s\n",path,strerror(errno));
+    return 0;
+  }
+
+  if ( fread(buf,1,sizeof(buf),fp) == sizeof(buf) &&
+       memcmp(buf,GARMIN_S_MAGIC,strlen(GARMIN_S_MAGIC)) == 0 &&
+       get_uint32(buf+12) <= GARMIN_VERSION &&
+       get_uint32(buf+16) == id ) {
+    state->track         = get_uint32(buf+20);
+    state->first_lap     = get_uint32(buf+24);
+    state->last_lap      = get_uint32(buf+28);
+    state->start_time    = get_uint32(buf+32);
+    state->last_lap_time = get_uint32(buf+36);
+    state->valid         = 1;
+    ok = 1;
+  } else {
+    printf("%s: not a sync state file for unit %x\n",path,id);
+  }
+
+  fclose(fp);
+
+  return ok;
+}
+
+
+/* ========================================================================= */
+/* garmin_save_sync_state                                                    */
+/*                                                                           */
+/* Save the sync state of a unit in 'dir', replacing the old one.  Returns   */
+/* 1 on success and 0 on failure.                                            */
+/* ========================================================================= */
+
+int
+garmin_save_sync_state ( const char * dir, garmin_sync_state * state )
+{
+  FILE *  fp;
+  uint8   buf[SYNC_FILE_SIZE];
+  char    path[PATH_MAX];
+  char    tmp[PATH_MAX + 8];
+  int     ok = 0;
+
+  memset(buf,0,sizeof(buf));
+  strncpy((char *)buf,GARMIN_S_MAGIC,11);
+  put_uint32(buf+12,GARMIN_VERSION);
+  put_uint32(buf+16,state->id);
+  put_uint32(buf+20,state->track);
+  put_uint32(buf+24,state->first_lap);
+  put_uint32(buf+28,state->last_lap);
+  put_uint32(buf+32,state->start_time);
+  put_uint32(buf+36,state->last_lap_time);
+
+  garmin_sync_filename(dir,state->id,path,sizeof(path));
+  snprintf(tmp,sizeof(tmp),"%s.new",path);
+
+  if ( (fp = fopen(tmp,"w")) == NULL ) {
+    printf("%s: %s\n",tmp,strerror(errno));
+    return 0;
+  }
+
+  if ( fwrite(buf,1,sizeof(buf),fp) != sizeof(buf) ) {
+    printf("%s: write: %s\n",tmp,strerror(errno));
+    fclose(fp);
+  } else if ( fclose(fp) != 0 ) {
+    printf("%s: close: %s\n",tmp,strerror(errno));
+  } else if ( rename(tmp,path) == -1 ) {
+    printf("rename: %s: %s\n",path,strerror(errno));
+  } else {
+    ok = 1;
+  }
+  if ( !ok ) unlink(tmp);
+
+  return ok;
+}
+
+
+/* Is this run newer than the newest one saved? */
+
+int
+garmin_run_is_new ( garmin_sync_state * state, garmin_data * run )
+{
+  uint32 trk;
+  uint32 f_lap;
+  uint32 l_lap;
+
+  if ( state == NULL || state->valid == 0 ) return 1;
+  if ( get_run_track_lap_info(run,&trk,&f_lap,&l_lap) == 0 ) return 1;
+
+  return (f_lap > state->last_lap);
+}
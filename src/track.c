@@ -0,0 +1,433 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "garmin.h"
+#include "byte_util.h"
+
+
+#define TRACK_MIN_POINTS  256
+
+/* Values stored for fields that a track point type does not have. */
+
+#define NO_POSITION  0x7fffffff
+#define NO_FLOAT     1.0e25
+#define NO_CADENCE   0xff
+
+
+/* Is this one of the track point types we can put into columns? */
+
+static int
+garmin_is_track_point ( garmin_datatype type )
+{
+  switch ( type ) {
+  case data_D300:
+  case data_D301:
+  case data_D302:
+  case data_D303:
+  case data_D304:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/* Packed size of each track point type, or 0 if it isn't one. */
+
+static uint32
+garmin_track_point_size ( uint32 type )
+{
+  switch ( type ) {
+  case data_D300: return 13;
+  case data_D301: return 21;
+  case data_D302: return 25;
+  case data_D303: return 17;
+  case data_D304: return 23;
+  default:        return 0;
+  }
+}
+
+
+/*
+   Count the track points in a (possibly nested) list.  Elements of a
+   lazily unpacked list are counted from their type alone.
+*/
+
+static uint32
+garmin_count_track_points ( garmin_data * data )
+{
+  garmin_list *      l;
+  garmin_list_node * n;
+  uint32             count = 0;
+
+  if ( data != NULL ) {
+    if ( data->type == data_Dlist ) {
+      l = data->data;
+      for ( n = l->head; n != NULL; n = n->next ) {
+	if ( n->packed != NULL && n->packed_type != data_Dlist ) {
+	  count += garmin_is_track_point(n->packed_type);
+	} else {
+	  count += garmin_count_track_points(garmin_list_node_data(l,n));
+	}
+      }
+    } else if ( garmin_is_track_point(data->type) ) {
+      count = 1;
+    }
+  }
+
+  return count;
+}
+
+
+/*
+   Make room for at least 'points' points.  All of the columns live in one
+   block, one after the other, so the block is laid out again on growth.
+*/
+
+static int
+garmin_track_columns_reserve ( garmin_track_columns * c, uint32 points )
+{
+  garmin_track_columns  old = *c;
+  char *                block;
+  size_t                per_point;
+
+  if ( points <= c->capacity ) return 1;
+  if ( points < TRACK_MIN_POINTS ) points = TRACK_MIN_POINTS;
+
+  /* Widest columns first, so that every column stays aligned. */
+
+  per_point = 2 * sizeof(sint32) + sizeof(uint32) + 2 * sizeof(float32) + 4;
+
+  if ( (block = malloc(points * per_point)) == NULL ) return 0;
+
+  c->lat        = (sint32 *)block;
+  c->lon        = c->lat + points;
+  c->time       = (uint32 *)(c->lon + points);
+  c->alt        = (float32 *)(c->time + points);
+  c->distance   = c->alt + points;
+  c->heart_rate = (uint8 *)(c->distance + points);
+  c->cadence    = c->heart_rate + points;
+  c->sensor     = c->cadence + points;
+  c->new_trk    = c->sensor + points;
+  c->capacity   = points;
+
+  if ( old.lat != NULL ) {
+    memcpy(c->lat,old.lat,c->count * sizeof(sint32));
+    memcpy(c->lon,old.lon,c->count * sizeof(sint32));
+    memcpy(c->time,old.time,c->count * sizeof(uint32));
+    memcpy(c->alt,old.alt,c->count * sizeof(float32));
+    memcpy(c->distance,old.distance,c->count * sizeof(float32));
+    memcpy(c->heart_rate,old.heart_rate,c->count);
+    memcpy(c->cadence,old.cadence,c->count);
+    memcpy(c->sensor,old.sensor,c->count);
+    memcpy(c->new_trk,old.new_trk,c->count);
+    free(old.lat);
+  }
+
+  return 1;
+}
+
+
+/*
+   Start a new point at the end of the columns, with every field set to
+   its invalid value.  Returns 0 if there was no room for it.
+*/
+
+static int
+garmin_track_columns_next ( garmin_track_columns * c, uint32 * index )
+{
+  uint32 i;
+
+  if ( c->count == c->capacity &&
+       garmin_track_columns_reserve(c,2 * c->capacity) == 0 ) {
+    return 0;
+  }
+
+  i = c->count++;
+
+  c->lat[i]        = NO_POSITION;
+  c->lon[i]        = NO_POSITION;
+  c->time[i]       = 0;
+  c->alt[i]        = NO_FLOAT;
+  c->distance[i]   = NO_FLOAT;
+  c->heart_rate[i] = 0;
+  c->cadence[i]    = NO_CADENCE;
+  c->sensor[i]     = 0;
+  c->new_trk[i]    = c->header;
+  c->header        = 0;
+
+  *index = i;
+
+  return 1;
+}
+
+
+/*
+   Append one record to the columns.  Track points are stored; a track
+   header means the next point starts a new track.  Anything else is
+   ignored.
+*/
+
+static void
+garmin_track_columns_add ( garmin_track_columns * c, garmin_data * data )
+{
+  D300 *   d300;
+  D301 *   d301;
+  D302 *   d302;
+  D303 *   d303;
+  D304 *   d304;
+  uint32   i;
+
+  switch ( data->type ) {
+  case data_D310:
+  case data_D311:
+  case data_D312:
+    c->header = 1;
+    return;
+  default:
+    if ( !garmin_is_track_point(data->type) ) return;
+    break;
+  }
+
+  if ( garmin_track_columns_next(c,&i) == 0 ) return;
+
+  switch ( data->type ) {
+  case data_D300:
+    d300 = data->data;
+    c->lat[i]      = d300->posn.lat;
+    c->lon[i]      = d300->posn.lon;
+    c->time[i]     = d300->time;
+    c->new_trk[i] |= d300->new_trk;
+    break;
+  case data_D301:
+    d301 = data->data;
+    c->lat[i]      = d301->posn.lat;
+    c->lon[i]      = d301->posn.lon;
+    c->time[i]     = d301->time;
+    c->alt[i]      = d301->alt;
+    c->new_trk[i] |= d301->new_trk;
+    break;
+  case data_D302:
+    d302 = data->data;
+    c->lat[i]      = d302->posn.lat;
+    c->lon[i]      = d302->posn.lon;
+    c->time[i]     = d302->time;
+    c->alt[i]      = d302->alt;
+    c->new_trk[i] |= d302->new_trk;
+    break;
+  case data_D303:
+    d303 = data->data;
+    c->lat[i]        = d303->posn.lat;
+    c->lon[i]        = d303->posn.lon;
+    c->time[i]       = d303->time;
+    c->alt[i]        = d303->alt;
+    c->heart_rate[i] = d303->heart_rate;
+    break;
+  case data_D304:
+    d304 = data->data;
+    c->lat[i]        = d304->posn.lat;
+    c->lon[i]        = d304->posn.lon;
+    c->time[i]       = d304->time;
+    c->alt[i]        = d304->alt;
+    c->distance[i]   = d304->distance;
+    c->heart_rate[i] = d304->heart_rate;
+    c->cadence[i]    = d304->cadence;
+    c->sensor[i]     = d304->sensor;
+    break;
+  default:
+    break;
+  }
+}
+
+
+/*
+   Decode a run of consecutive still-packed track points of the same type
+   straight from the packed bytes into the columns, without unpacking
+   them into garmin_data records first.  Returns the first node that was
+   not decoded.
+*/
+
+static garmin_list_node *
+garmin_track_columns_run ( garmin_track_columns * c, garmin_list_node * n )
+{
+  uint32        type = n->packed_type;
+  uint32        need = garmin_track_point_size(type);
+  const uint8 * p;
+  uint8         flag;
+  uint32        i;
+
+  for ( ; n != NULL && n->packed != NULL && n->packed_type == type &&
+	  n->packed_size >= need; n = n->next ) {
+    if ( garmin_track_columns_next(c,&i) == 0 ) break;
+    p = n->packed;
+    c->lat[i]  = get_sint32(p);
+    c->lon[i]  = get_sint32(p+4);
+    c->time[i] = get_uint32(p+8);
+    switch ( type ) {
+    case data_D300:
+      flag = p[12];
+      break;
+    case data_D301:
+      c->alt[i] = get_float32(p+12);
+      flag      = p[20];
+      break;
+    case data_D302:
+      c->alt[i] = get_float32(p+12);
+      flag      = p[24];
+      break;
+    case data_D303:
+      c->alt[i]        = get_float32(p+12);
+      c->heart_rate[i] = p[16];
+      flag             = 0;
+      break;
+    default: /* D304 */
+      c->alt[i]        = get_float32(p+12);
+      c->distance[i]   = get_float32(p+16);
+      c->heart_rate[i] = p[20];
+      c->cadence[i]    = p[21];
+      c->sensor[i]     = p[22];
+      flag             = 0;
+      break;
+    }
+    c->new_trk[i] |= flag;
+  }
+
+  return n;
+}
+
+
+static void
+garmin_track_columns_walk ( garmin_track_columns * c, garmin_data * data )
+{
+  garmin_list *      l;
+  garmin_list_node * n;
+  garmin_list_node * m;
+
+  if ( data != NULL ) {
+    if ( data->type == data_Dlist ) {
+      l = data->data;
+      for ( n = l->head; n != NULL; n = m ) {
+	if ( n->packed != NULL && garmin_is_track_point(n->packed_type) &&
+	     (m = garmin_track_columns_run(c,n)) != n ) {
+	  continue;
+	}
+	garmin_track_columns_walk(c,garmin_list_node_data(l,n));
+	m = n->next;
+      }
+    } else {
+      garmin_track_columns_add(c,data);
+    }
+  }
+}
+
+
+/* ========================================================================= */
+/* garmin_track_columns                                                      */
+/* ========================================================================= */
+
+/*
+   Copy every track point found in the data (a run file, a track log, or
+   any list containing them) into contiguous per-field arrays.  Fields a
+   point type does not have are stored as invalid values (0x7fffffff for
+   positions, 1.0e25 for floats, 0xff for cadence, 0 otherwise).
+*/
+
+garmin_track_columns *
+garmin_track_columns_new ( garmin_data * data )
+{
+  garmin_track_columns * c;
+
+  if ( (c = calloc(1,sizeof(garmin_track_columns))) != NULL ) {
+    if ( garmin_track_columns_reserve(c,garmin_count_track_points(data)) ) {
+      garmin_track_columns_walk(c,data);
+    } else {
+      free(c);
+      c = NULL;
+    }
+  }
+
+  return c;
+}
+
+
+/*
+   Build the columns from a .gmn file.  The file is unpacked lazily, so
+   track points are decoded straight from the file into the columns.
+*/
+
+garmin_track_columns *
+garmin_track_columns_load ( const char * filename )
+{
+  garmin_track_columns * c = NULL;
+  garmin_map *           map;
+
+  if ( (map = garmin_map_file(filename,GARMIN_MAP_STRINGS | GARMIN_MAP_LAZY))
+       != NULL ) {
+    c = garmin_track_columns_new(map->data);
+    garmin_unmap(map);
+  }
+
+  return c;
+}
+
+
+static int
+garmin_track_columns_stream ( garmin_data * data, void * context )
+{
+  garmin_track_columns_add(context,data);
+  garmin_free_data(data);
+
+  return 1;
+}
+
+
+/*
+   Build the columns straight from a device transfer (GET_RUNS or
+   GET_TRACKLOG), without keeping the records themselves around.
+*/
+
+garmin_track_columns *
+garmin_track_columns_get ( garmin_unit * garmin, garmin_get_type what )
+{
+  garmin_track_columns * c;
+
+  if ( (c = calloc(1,sizeof(garmin_track_columns))) != NULL ) {
+    if ( garmin_track_columns_reserve(c,TRACK_MIN_POINTS) ) {
+      garmin_get_stream(garmin,what,garmin_track_columns_stream,c);
+    } else {
+      free(c);
+      c = NULL;
+    }
+  }
+
+  return c;
+}
+
+
+void
+garmin_track_columns_free ( garmin_track_columns * c )
+{
+  if ( c != NULL ) {
+    if ( c->lat != NULL ) free(c->lat);
+    free(c);
+  }
+}
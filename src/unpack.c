@@ -18,1204 +18,707 @@
 */
 
 #include "config.h"
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include "garmin.h"
+#include "byte_util.h"
 
-
-#define GETU16(x) do { x = get_uint16(*pos);  *pos += 2; } while ( 0 )
-#define GETS16(x) do { x = get_sint16(*pos);  *pos += 2; } while ( 0 )
-#define GETU32(x) do { x = get_uint32(*pos);  *pos += 4; } while ( 0 )
-#define GETS32(x) do { x = get_sint32(*pos);  *pos += 4; } while ( 0 )
-#define GETF32(x) do { x = get_float32(*pos); *pos += 4; } while ( 0 )
-#define GETF64(x) do { x = get_float64(*pos); *pos += 8; } while ( 0 )
-#define GETPOS(x) do { GETS32((x).lat); GETS32((x).lon); } while ( 0 )
-#define GETRPT(x) do { GETF64((x).lat); GETF64((x).lon); } while ( 0 )
-#define GETVST(x) x = get_vstring(pos)
-#define GETU8(x)  x = *(*pos)++
-#define SKIP(x)   do { memset(*pos,0,x); *pos += x; }      while ( 0 )
-
-#define GETSTR(x)                                                      \
-  do {                                                                 \
-    memcpy(x,*pos,sizeof(x)-1); x[sizeof(x)-1] = 0; *pos += sizeof(x); \
-  } while ( 0 )
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.1   D100                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d100 ( D100 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.2   D101                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d101 ( D101 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETU8(wpt->smbl);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.3   D102                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d102 ( D102 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETU16(wpt->smbl);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.4   D103                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d103 ( D103 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETU8(wpt->smbl);
-  GETU8(wpt->dspl);
-}
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.5   D104                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d104 ( D104 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETU16(wpt->smbl);
-  GETU8(wpt->dspl);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.6   D105                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d105 ( D105 * wpt, uint8 ** pos )
-{
-  GETPOS(wpt->posn);
-  GETU16(wpt->smbl);
-  GETVST(wpt->wpt_ident);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.7   D106                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d106 ( D106 * wpt, uint8 ** pos )
-{
-  GETU8(wpt->wpt_class);
-  GETSTR(wpt->subclass);
-  GETPOS(wpt->posn);
-  GETU16(wpt->smbl);
-  GETVST(wpt->wpt_ident);
-  GETVST(wpt->lnk_ident);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.8   D107                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d107 ( D107 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETU8(wpt->smbl);
-  GETU8(wpt->dspl);
-  GETF32(wpt->dst);
-  GETU8(wpt->color);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.9   D108                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d108 ( D108 * wpt, uint8 ** pos )
-{
-  GETU8(wpt->wpt_class);
-  GETU8(wpt->color);
-  GETU8(wpt->dspl);
-  GETU8(wpt->attr);
-  GETU16(wpt->smbl);
-  GETSTR(wpt->subclass);
-  GETPOS(wpt->posn);
-  GETF32(wpt->alt);
-  GETF32(wpt->dpth);
-  GETF32(wpt->dist);
-  GETSTR(wpt->state);
-  GETSTR(wpt->cc);
-  GETVST(wpt->ident);
-  GETVST(wpt->comment);
-  GETVST(wpt->facility);
-  GETVST(wpt->city);
-  GETVST(wpt->addr);
-  GETVST(wpt->cross_road);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.10  D109                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d109 ( D109 * wpt, uint8 ** pos )
-{
-  GETU8(wpt->dtyp);
-  GETU8(wpt->wpt_class);
-  GETU8(wpt->dspl_color);
-  GETU8(wpt->attr);
-  GETU16(wpt->smbl);
-  GETSTR(wpt->subclass);
-  GETPOS(wpt->posn);
-  GETF32(wpt->alt);
-  GETF32(wpt->dpth);
-  GETF32(wpt->dist);
-  GETSTR(wpt->state);
-  GETSTR(wpt->cc);
-  GETU32(wpt->ete);
-  GETVST(wpt->ident);
-  GETVST(wpt->comment);
-  GETVST(wpt->facility);
-  GETVST(wpt->city);
-  GETVST(wpt->addr);
-  GETVST(wpt->cross_road);
-}
+/* 
+   The state of an unpack in progress: where we are in the buffer and
+   where it ends, how the caller wants the data handed back (GARMIN_MAP_*
+   flags), and the arena to allocate from (NULL for the heap).  Nothing
+   is ever read at or past 'end'.  A field that does not fit is set to
+   zero, the position moves to the end, and 'truncated' is set, so the
+   rest of the record unpacks as zeros and the caller can tell.
+*/
 
+typedef struct garmin_unpacker {
+  uint8 *            pos;
+  uint8 *            end;
+  int                flags;
+  garmin_arena *     arena;
+  int                truncated;
+} garmin_unpacker;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.11  D110                                                              */
-/* --------------------------------------------------------------------------*/
 
-static void
-garmin_unpack_d110 ( D110 * wpt, uint8 ** pos )
+static int
+garmin_unpack_need ( garmin_unpacker * u, uint32 bytes )
 {
-  GETU8(wpt->dtyp);
-  GETU8(wpt->wpt_class);
-  GETU8(wpt->dspl_color);
-  GETU8(wpt->attr);
-  GETU16(wpt->smbl);
-  GETSTR(wpt->subclass);
-  GETPOS(wpt->posn);
-  GETF32(wpt->alt);
-  GETF32(wpt->dpth);
-  GETF32(wpt->dist);
-  GETSTR(wpt->state);
-  GETSTR(wpt->cc);
-  GETU32(wpt->ete);
-  GETF32(wpt->temp);
-  GETU32(wpt->time);
-  GETU16(wpt->wpt_cat);
-  GETVST(wpt->ident);
-  GETVST(wpt->comment);
-  GETVST(wpt->facility);
-  GETVST(wpt->city);
-  GETVST(wpt->addr);
-  GETVST(wpt->cross_road);
-}
+  if ( (uint32)(u->end - u->pos) >= bytes ) return 1;
 
+  u->pos       = u->end;
+  u->truncated = 1;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.12  D120                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d120 ( D120 * cat, uint8 ** pos )
-{
-  GETSTR(cat->name);
+  return 0;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.13  D150                                                              */
-/* --------------------------------------------------------------------------*/
+#define NEED(n) garmin_unpack_need(u,n)
 
-static void
-garmin_unpack_d150 ( D150 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETSTR(wpt->cc);
-  GETU8(wpt->wpt_class);
-  GETPOS(wpt->posn);
-  GETS16(wpt->alt);
-  GETSTR(wpt->city);
-  GETSTR(wpt->state);
-  GETSTR(wpt->name);
-  GETSTR(wpt->cmnt);
-}
+#define GETX(x,get,n)                                                     \
+  do {                                                                    \
+    if ( NEED(n) ) {                                                      \
+      x = get(u->pos);                                                    \
+      u->pos += n;                                                        \
+    } else {                                                              \
+      x = 0;                                                              \
+    }                                                                     \
+  } while ( 0 )
 
+#define GETU16(x) GETX(x,get_uint16,2)
+#define GETS16(x) GETX(x,get_sint16,2)
+#define GETU32(x) GETX(x,get_uint32,4)
+#define GETS32(x) GETX(x,get_sint32,4)
+#define GETF32(x) GETX(x,get_float32,4)
+#define GETF64(x) GETX(x,get_float64,8)
+#define GETPOS(x) do { GETS32((x).lat); GETS32((x).lon); } while ( 0 )
+#define GETRPT(x) do { GETF64((x).lat); GETF64((x).lon); } while ( 0 )
+#define GETVST(x) x = garmin_unpack_vstring(u)
+#define GETU8(x)  do { if ( NEED(1) ) x = *u->pos++; else x = 0; } while ( 0 )
+#define SKIP(x)   do { if ( NEED(x) ) u->pos += x; } while ( 0 )
+
+#define GETSTR(x)                                                         \
+  do {                                                                    \
+    if ( NEED(sizeof(x)) ) {                                              \
+      memcpy(x,u->pos,sizeof(x)-1);                                       \
+      x[sizeof(x)-1] = 0;                                                 \
+      u->pos += sizeof(x);                                                \
+    } else {                                                              \
+      x[0] = 0;                                                           \
+    }                                                                     \
+  } while ( 0 )
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.14  D151                                                              */
-/* --------------------------------------------------------------------------*/
 
-static void
-garmin_unpack_d151 ( D151 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETSTR(wpt->name);
-  GETSTR(wpt->city);
-  GETSTR(wpt->state);
-  GETS16(wpt->alt);
-  GETSTR(wpt->cc);
-  SKIP(1);
-  GETU8(wpt->wpt_class);
-}
+static garmin_data * garmin_unpack_data ( garmin_unpacker * u,
+					  garmin_datatype   type );
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.15  D152                                                              */
-/* --------------------------------------------------------------------------*/
+/* 
+   Unpack a variable length string.  If the caller asked for it, hand back
+   a pointer to the string where it sits in the buffer instead of a copy.
+*/
 
-static void
-garmin_unpack_d152 ( D152 * wpt, uint8 ** pos )
+static char *
+garmin_unpack_vstring ( garmin_unpacker * u )
 {
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETSTR(wpt->name);
-  GETSTR(wpt->city);
-  GETSTR(wpt->state);
-  GETS16(wpt->alt);
-  GETSTR(wpt->cc);
-  SKIP(1);
-  GETU8(wpt->wpt_class);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.16  D154                                                              */
-/* --------------------------------------------------------------------------*/
+  char *  ret;
+  uint8 * nul;
+  int     bytes;
 
-static void
-garmin_unpack_d154 ( D154 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETSTR(wpt->name);
-  GETSTR(wpt->city);
-  GETSTR(wpt->state);
-  GETS16(wpt->alt);
-  GETSTR(wpt->cc);
-  SKIP(1);
-  GETU8(wpt->wpt_class);
-  GETU16(wpt->smbl);
-}
+  if ( (nul = memchr(u->pos,0,u->end - u->pos)) == NULL ) {
+    /* The string runs off the end of the buffer. */
+    u->pos       = u->end;
+    u->truncated = 1;
+    if ( u->flags & GARMIN_MAP_STRINGS ) return "";
+    ret = (u->arena != NULL) ? garmin_arena_alloc(u->arena,1) : calloc(1,1);
+    return ret;
+  }
 
+  bytes = nul - u->pos + 1;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.17  D155                                                              */
-/* --------------------------------------------------------------------------*/
+  if ( u->flags & GARMIN_MAP_STRINGS ) {
+    ret     = (char *)u->pos;
+  } else {
+    if ( u->arena != NULL ) ret = garmin_arena_alloc(u->arena,bytes);
+    else                    ret = malloc(bytes);
+    memcpy(ret,u->pos,bytes);
+  }
+  u->pos += bytes;
 
-static void
-garmin_unpack_d155 ( D155 * wpt, uint8 ** pos )
-{
-  GETSTR(wpt->ident);
-  GETPOS(wpt->posn);
-  SKIP(4);
-  GETSTR(wpt->cmnt);
-  GETF32(wpt->dst);
-  GETSTR(wpt->name);
-  GETSTR(wpt->city);
-  GETSTR(wpt->state);
-  GETS16(wpt->alt);
-  GETSTR(wpt->cc);
-  SKIP(1);
-  GETU8(wpt->wpt_class);
-  GETU16(wpt->smbl);  
-  GETU8(wpt->dspl);
+  return ret;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.18  D200                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d200 ( D200 * hdr, uint8 ** pos )
-{
-  GETU8(*hdr);
-}
+/*
+   The record unpackers, generated from the layouts in schema.h.  Each
+   one is 'garmin_unpack_d<x> ( D<x> * r, garmin_unpacker * u )'.
+*/
 
+#define RECORD(x) \
+  static void garmin_unpack_d##x ( D##x * r, garmin_unpacker * u );
+#include "schema.h"
+
+#define RECORD(x)                                                        \
+  static void                                                            \
+  garmin_unpack_d##x ( D##x * r, garmin_unpacker * u )                   \
+  {
+#define END_RECORD   }
+#define F_U8(f)      GETU8((*r)f);
+#define F_U16(f)     GETU16((*r)f);
+#define F_S16(f)     GETS16((*r)f);
+#define F_U32(f)     GETU32((*r)f);
+#define F_CNT(f,n)   GETU32((*r)f); if ( (*r)f > (n) ) (*r)f = (n);
+#define F_S32(f)     GETS32((*r)f);
+#define F_F32(f)     GETF32((*r)f);
+#define F_F64(f)     GETF64((*r)f);
+#define F_POS(f)     GETPOS((*r)f);
+#define F_RPT(f)     GETRPT((*r)f);
+#define F_STR(f)     GETSTR((*r)f);
+#define F_VST(f)     GETVST((*r)f);
+#define F_PAD(n)     SKIP(n);
+#define F_REC(x,f)   garmin_unpack_d##x(&(*r)f,u);
+#define F_LOOP(i,n)  { int i; for ( i = 0; i < (n); i++ ) {
+#define F_END_LOOP   } }
+#include "schema.h"
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.19  D201                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d201 ( D201 * hdr, uint8 ** pos )
-{
-  GETU8(hdr->nmbr);
-  GETSTR(hdr->cmnt);
-}
 
+/* List */
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.20  D202                                                              */
-/* --------------------------------------------------------------------------*/
+/*
+   Unpack one list element, reading no more than its size and leaving the
+   buffer at the end of the element even if not all of it was understood.
+   An element that is shorter than its type needs does not stop the rest
+   of the list from being unpacked.
+*/
 
-static void
-garmin_unpack_d202 ( D202 * hdr, uint8 ** pos )
+static garmin_data *
+garmin_unpack_element ( garmin_unpacker * u, uint32 type, uint32 size )
 {
-  GETVST(hdr->rte_ident);
-}
-
+  garmin_data * data;
+  uint8 *       end       = u->end;
+  uint8 *       start     = u->pos;
+  int           truncated = u->truncated;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.21  D210                                                              */
-/* --------------------------------------------------------------------------*/
+  u->end       = start + size;
+  data         = garmin_unpack_data(u,type);
+  u->pos       = u->end;
+  u->end       = end;
+  u->truncated = truncated;
 
-static void
-garmin_unpack_d210 ( D210 * link, uint8 ** pos )
-{
-  GETU16(link->link_class);
-  GETSTR(link->subclass);
-  GETVST(link->ident);
+  return data;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.22  D300                                                              */
-/* --------------------------------------------------------------------------*/
-
 static void
-garmin_unpack_d300 ( D300 * point, uint8 ** pos )
+garmin_unpack_dlist ( garmin_list * list, garmin_unpacker * u )
 {
-  GETPOS(point->posn);
-  GETU32(point->time);
-  GETU8(point->new_trk);
-}
+  uint32             id;
+  uint32             elements;
+  uint32             type;
+  uint32             size;
+  uint32             i;
 
+  GETU32(list->id);
+  GETU32(elements);
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.23  D301                                                              */
-/* --------------------------------------------------------------------------*/
+  list->flags = u->flags;
 
-static void
-garmin_unpack_d301 ( D301 * point, uint8 ** pos )
-{ 
-  GETPOS(point->posn);
-  GETU32(point->time);
-  GETF32(point->alt);
-  GETF32(point->dpth);
-  GETU8(point->new_trk);
+  for ( i = 0; i < elements && !u->truncated; i++ ) {
+    GETU32(id);
+    GETU32(type);
+    GETU32(size);
+    if ( !NEED(size) ) {
+      /* the element runs off the end of the buffer */
+      break;
+    } else if ( id != list->id ) {
+      /* list element has wrong list ID; skip it using its size */
+      printf("garmin_unpack_dlist: list element had ID %d, expected ID %d\n",
+	     id,list->id);
+      SKIP(size);
+    } else if ( u->flags & GARMIN_MAP_LAZY ) {
+      /* Leave it packed, and skip it using its size. */
+      garmin_list_append_packed(list,type,u->pos,size);
+      SKIP(size);
+    } else {
+      garmin_list_append(list,garmin_unpack_element(u,type,size));
+    }
+  }
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.24  D302                                                              */
-/* --------------------------------------------------------------------------*/
+/*
+   Read a chunk header: check the magic and version, and return the size
+   of the packed data after the header, the type of the data, and the
+   size of the chunk.  Leaves the buffer pointing at the chunk itself.
+*/
 
-static void
-garmin_unpack_d302 ( D302 * point, uint8 ** pos )
+static int
+garmin_unpack_header ( garmin_unpacker * u,
+		       uint32 *          size,
+		       uint32 *          type,
+		       uint32 *          chunk )
 {
-  GETPOS(point->posn);
-  GETU32(point->time);
-  GETF32(point->alt);
-  GETF32(point->dpth);
-  GETF32(point->temp);
-  GETU8(point->new_trk);
-}
+  uint32 version;
 
+  if ( !NEED(GARMIN_HEADER + 8) ) {
+    /* not enough left for a chunk header */
+    printf("garmin_unpack_chunk: truncated header\n");
+    return 0;
+  }
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.25  D303                                                              */
-/* --------------------------------------------------------------------------*/
+  if ( memcmp(u->pos,GARMIN_MAGIC,strlen(GARMIN_MAGIC)) != 0 ) {
+    /* unknown file format */
+    printf("garmin_unpack_chunk: not a .gmn file\n");
+    return 0;
+  }
 
-static void
-garmin_unpack_d303 ( D303 * point, uint8 ** pos )
-{
-  GETPOS(point->posn);
-  GETU32(point->time);
-  GETF32(point->alt);
-  GETU8(point->heart_rate);
-}
+  SKIP(12);
+  GETU32(version);
 
+  if ( version > GARMIN_VERSION ) {
+    /* warning: version is more recent than supported. */
+    printf("garmin_unpack_chunk: version %.2f supported, %.2f found\n",
+	   GARMIN_VERSION/100.0, version/100.0);
+  }
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.26  D304                                                              */
-/* --------------------------------------------------------------------------*/
+  /* This is the size of the packed data (not including the header) */
 
-static void
-garmin_unpack_d304 ( D304 * point, uint8 ** pos )
-{
-  GETPOS(point->posn);
-  GETU32(point->time);
-  GETF32(point->alt);
-  GETF32(point->distance);
-  GETU8(point->heart_rate);
-  GETU8(point->cadence);
-  GETU8(point->sensor);
-}
+  GETU32(*size);
 
+  /* Now let's get the type of the data, and the size of the chunk. */
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.27  D310                                                              */
-/* --------------------------------------------------------------------------*/
+  GETU32(*type);
+  GETU32(*chunk);
 
-static void
-garmin_unpack_d310 ( D310 * hdr, uint8 ** pos )
-{
-  GETU8(hdr->dspl);
-  GETU8(hdr->color);
-  GETVST(hdr->trk_ident);
+  return 1;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.28  D311                                                              */
-/* --------------------------------------------------------------------------*/
+/* Unpack the chunk starting at the current position. */
 
-static void
-garmin_unpack_d311 ( D311 * hdr, uint8 ** pos )
+static garmin_data *
+garmin_unpack_chunk_data ( garmin_unpacker * u, uint32 type, uint32 chunk )
 {
-  GETU16(hdr->index);
-}
+  garmin_data * data;
+  uint8 *       start;
+  uint8 *       end;
+  uint32        unpacked;
 
+  /* Never read past the chunk, even if the file goes on. */
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.29  D312                                                              */
-/* --------------------------------------------------------------------------*/
+  start = u->pos;
+  end   = u->end;
+  if ( (uint32)(end - start) > chunk ) u->end = start + chunk;
 
-static void
-garmin_unpack_d312 ( D312 * hdr, uint8 ** pos )
-{
-  GETU8(hdr->dspl);
-  GETU8(hdr->color);
-  GETVST(hdr->trk_ident);
-}
+  data     = garmin_unpack_data(u,type);
+  unpacked = u->pos - start;
+  u->end   = end;
 
+  /* Double check - did we unpack the number of bytes we were supposed to? */
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.30  D400                                                              */
-/* ------------------------------------------------------------------------- */
+  if ( u->truncated ) {
+    /* ran out of data */
+    printf("garmin_unpack_chunk: truncated after %d bytes (expecting %d)\n",
+	   unpacked,chunk);
+  } else if ( unpacked != chunk ) {
+    /* unpacked the wrong number of bytes! */
+    printf("garmin_unpack_chunk: unpacked %d bytes (expecting %d)\n",
+	   unpacked,chunk);
+  }
 
-static void
-garmin_unpack_d400 ( D400 * prx, uint8 ** pos )
-{
-  garmin_unpack_d100(&prx->wpt,pos);
-  SKIP(sizeof(D100));
-  GETF32(prx->dst);
+  return data;
 }
 
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.31  D403                                                              */
-/* ------------------------------------------------------------------------- */
+/* Unpack a chunk of data. */
 
-static void
-garmin_unpack_d403 ( D403 * prx, uint8 ** pos )
+static garmin_data *
+garmin_unpack_chunk ( garmin_unpacker * u )
 {
-  garmin_unpack_d103(&prx->wpt,pos);
-  SKIP(sizeof(D103));
-  GETF32(prx->dst);
-}
-
+  garmin_data * data = NULL;
+  uint32        size;
+  uint32        type;
+  uint32        chunk;
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.32  D450                                                              */
-/* ------------------------------------------------------------------------- */
+  if ( garmin_unpack_header(u,&size,&type,&chunk) ) {
+    data = garmin_unpack_chunk_data(u,type,chunk);
+  }
 
-static void
-garmin_unpack_d450 ( D450 * prx, uint8 ** pos )
-{
-  GETU32(prx->idx);
-  garmin_unpack_d150(&prx->wpt,pos);
-  SKIP(sizeof(D150));
-  GETF32(prx->dst);
+  return data;
 }
 
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.33  D500                                                              */
-/* ------------------------------------------------------------------------- */
+/* Unpack every chunk in a buffer holding the contents of a .gmn file. */
 
-static void
-garmin_unpack_d500 ( D500 * alm, uint8 ** pos )
-{
-  GETU16(alm->wn);
-  GETF32(alm->toa);
-  GETF32(alm->af0);
-  GETF32(alm->af1);
-  GETF32(alm->e);
-  GETF32(alm->sqrta);
-  GETF32(alm->m0);
-  GETF32(alm->w);
-  GETF32(alm->omg0);
-  GETF32(alm->odot);
-  GETF32(alm->i);
-}
+static garmin_data *
+garmin_unpack_file ( const char *   filename,
+		     uint8 *        buf,
+		     uint32         bytes,
+		     int            flags,
+		     garmin_arena * arena )
+{
+  garmin_data *    data   = NULL;
+  garmin_data *    data_l = NULL;
+  garmin_list *    list;
+  garmin_unpacker  u;
+  uint8 *          start;
+
+  data_l  = garmin_arena_alloc_data(arena,data_Dlist);
+  list    = data_l->data;
+  u.pos       = buf;
+  u.end       = buf + bytes;
+  u.flags     = flags;
+  u.arena     = arena;
+  u.truncated = 0;
+  while ( u.pos < u.end && !u.truncated ) {
+    start = u.pos;
+    garmin_list_append(list,garmin_unpack_chunk(&u));
+    if ( u.pos == start ) {
+      /* did not unpack anything! */
+      printf("garmin_load:  %s: nothing unpacked!\n",filename);
+      break;
+    }
+  }
 
+  /* 
+     If we unpacked only a single element, return it.  Otherwise,
+     return the list.
+  */
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.34  D501                                                              */
-/* ------------------------------------------------------------------------- */
+  if ( list->elements == 1 ) {
+    data = list->head->data;
+    list->head->data = NULL;
+    if ( arena == NULL ) garmin_free_data(data_l);
+  } else {
+    data = data_l;
+  }	     
 
-static void
-garmin_unpack_d501 ( D501 * alm, uint8 ** pos )
-{
-  GETU16(alm->wn);
-  GETF32(alm->toa);
-  GETF32(alm->af0);
-  GETF32(alm->af1);
-  GETF32(alm->e);
-  GETF32(alm->sqrta);
-  GETF32(alm->m0);
-  GETF32(alm->w);
-  GETF32(alm->omg0);
-  GETF32(alm->odot);
-  GETF32(alm->i);
-  GETU8(alm->hlth);
+  return data;
 }
 
+  
+/* ========================================================================= */
+/* garmin_map                                                                */
+/* ========================================================================= */
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.35  D550                                                              */
-/* ------------------------------------------------------------------------- */
-
-static void
-garmin_unpack_d550 ( D550 * alm, uint8 ** pos )
-{
-  GETU8(alm->svid);
-  GETU16(alm->wn);
-  GETF32(alm->toa);
-  GETF32(alm->af0);
-  GETF32(alm->af1);
-  GETF32(alm->e);
-  GETF32(alm->sqrta);
-  GETF32(alm->m0);
-  GETF32(alm->w);
-  GETF32(alm->omg0);
-  GETF32(alm->odot);
-  GETF32(alm->i);
-}
-
+/* 
+   Map a .gmn file into memory and unpack it straight from the mapping.
+   With GARMIN_MAP_STRINGS, string fields point into the mapping instead
+   of being copied; they are then read-only and only valid until the
+   file is unmapped with garmin_unmap().  With GARMIN_MAP_LAZY, list
+   elements are left packed in the mapping and only unpacked when they
+   are asked for with garmin_list_node_data() or garmin_list_data().
+*/
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.36  D551                                                              */
-/* ------------------------------------------------------------------------- */
+/*
+   If a mapped file is a .gmnz file, replace the mapping with an anonymous
+   one holding the .gmn bytes it decodes to, so that everything after
+   this (including munmap) works the same for both formats.
+*/
 
-static void
-garmin_unpack_d551 ( D551 * alm, uint8 ** pos )
+static int
+garmin_map_gmnz ( const char * filename, void ** addr, size_t * length )
 {
-  GETU8(alm->svid);
-  GETU16(alm->wn);
-  GETF32(alm->toa);
-  GETF32(alm->af0);
-  GETF32(alm->af1);
-  GETF32(alm->e);
-  GETF32(alm->sqrta);
-  GETF32(alm->m0);
-  GETF32(alm->w);
-  GETF32(alm->omg0);
-  GETF32(alm->odot);
-  GETF32(alm->i);
-  GETU8(alm->hlth);
-}
+  void *  gmn;
+  uint32  size;
+  int     ok = 0;
 
+  if ( !garmin_is_gmnz(*addr,*length) ) return 1;
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.37  D600                                                              */
-/* ------------------------------------------------------------------------- */
-
-static void
-garmin_unpack_d600 ( D600 * dt, uint8 ** pos )
-{
-  GETU8(dt->month);
-  GETU8(dt->day);
-  GETU16(dt->year);
-  GETU16(dt->hour);
-  GETU8(dt->minute);
-  GETU8(dt->second);
-}
-
+  if ( (size = garmin_gmnz_size(*addr,*length)) == 0 ) {
+    gmn = NULL;
+    ok  = 1;
+  } else if ( (gmn = mmap(NULL,size,PROT_READ|PROT_WRITE,
+			  MAP_PRIVATE|MAP_ANONYMOUS,-1,0)) != MAP_FAILED ) {
+    if ( garmin_gmnz_decode(*addr,*length,gmn,size) ) {
+      ok = 1;
+    } else {
+      printf("%s: cannot decode .gmnz file\n",filename);
+      munmap(gmn,size);
+    }
+  } else {
+    /* mmap failed */
+    printf("%s: mmap: %s\n",filename,strerror(errno));
+  }
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.38  D650                                                              */
-/* ------------------------------------------------------------------------- */
+  munmap(*addr,*length);
+  *addr   = ok ? gmn : NULL;
+  *length = ok ? size : 0;
 
-static void
-garmin_unpack_d650 ( D650 * fbr, uint8 ** pos )
-{
-  GETU32(fbr->takeoff_time);
-  GETU32(fbr->landing_time);
-  GETPOS(fbr->takeoff_posn);
-  GETPOS(fbr->landing_posn);
-  GETU32(fbr->night_time);
-  GETU32(fbr->num_landings);
-  GETF32(fbr->max_speed);
-  GETF32(fbr->max_alt);
-  GETF32(fbr->distance);
-  GETU8(fbr->cross_country_flag);
-  GETVST(fbr->departure_name);
-  GETVST(fbr->departure_ident);
-  GETVST(fbr->arrival_name);
-  GETVST(fbr->arrival_ident);
-  GETVST(fbr->ac_id);
+  return ok;
 }
 
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.39  D700                                                              */
-/* ------------------------------------------------------------------------- */
+/*
+   Map a whole file read-only.  An empty file maps to a NULL address and
+   a zero length.  A .gmnz file maps to the .gmn bytes it holds.
+*/
 
-static void
-garmin_unpack_d700 ( D700 * pt, uint8 ** pos )
+static int
+garmin_map_bytes ( const char * filename, void ** addr, size_t * length )
 {
-  GETRPT(*pt);
-}
-
+  struct stat   sb;
+  int           fd;
+  int           ok = 0;
 
-/* ------------------------------------------------------------------------- */
-/* 7.4.40  D800                                                              */
-/* ------------------------------------------------------------------------- */
+  if ( (fd = open(filename,O_RDONLY)) != -1 ) {
+    if ( fstat(fd,&sb) != -1 ) {
+      *length = sb.st_size;
+      if ( sb.st_size == 0 ) {
+	*addr = NULL;
+	ok    = 1;
+      } else if ( (*addr = mmap(NULL,sb.st_size,PROT_READ,MAP_PRIVATE,fd,0))
+		  != MAP_FAILED ) {
+	madvise(*addr,sb.st_size,MADV_SEQUENTIAL);
+	ok = garmin_map_gmnz(filename,addr,length);
+      } else {
+	/* mmap failed */
+	printf("%s: mmap: %s\n",filename,strerror(errno));
+      }
+    } else {
+      /* fstat failed */
+      printf("%s: fstat: %s\n",filename,strerror(errno));
+    }
+    close(fd);
+  } else {
+    /* open failed */
+    printf("%s: open: %s\n",filename,strerror(errno));
+  }
 
-static void
-garmin_unpack_d800 ( D800 * pvt, uint8 ** pos )
-{
-  GETF32(pvt->alt);
-  GETF32(pvt->epe);
-  GETF32(pvt->eph);
-  GETF32(pvt->epv);
-  GETU16(pvt->fix);
-  GETF64(pvt->tow);
-  GETRPT(pvt->posn);
-  GETF32(pvt->east);
-  GETF32(pvt->north);
-  GETF32(pvt->up);
-  GETF32(pvt->msl_hght);
-  GETS16(pvt->leap_scnds);
-  GETU32(pvt->wn_days);
+  return ok;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.41  D906                                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d906 ( D906 * lap, uint8 ** pos )
+static garmin_map *
+garmin_map_into ( const char *   filename,
+		  int            flags,
+		  garmin_arena * arena )
 {
-  GETU32(lap->start_time);
-  GETU32(lap->total_time);
-  GETF32(lap->total_distance);
-  GETPOS(lap->begin);
-  GETPOS(lap->end);
-  GETU16(lap->calories);
-  GETU8(lap->track_index);
-}
-
-
-/* --------------------------------------------------------------------------*/
-/* 7.4.42  D1000                                                             */
-/* --------------------------------------------------------------------------*/
-
-
-static void garmin_unpack_d1002 ( D1002 * wkt, uint8 ** pos );
+  garmin_map *  map = NULL;
+  void *        addr;
+  size_t        length;
 
+  if ( garmin_map_bytes(filename,&addr,&length) ) {
+    if ( (map = calloc(1,sizeof(garmin_map))) != NULL ) {
+      map->addr   = addr;
+      map->length = length;
+      map->flags  = flags;
+      map->data   = garmin_unpack_file(filename,addr,length,flags,arena);
+      if ( !(flags & (GARMIN_MAP_STRINGS | GARMIN_MAP_LAZY)) && addr != NULL ) {
+	/* Nothing points into the mapping, so let it go now. */
+	munmap(addr,length);
+	map->addr = NULL;
+      }
+    } else {
+      /* calloc failed */
+      printf("%s: calloc: %s\n",filename,strerror(errno));
+      if ( addr != NULL ) munmap(addr,length);
+    }
+  }
 
-static void
-garmin_unpack_d1000 ( D1000 * run, uint8 ** pos )
-{
-  GETU32(run->track_index);
-  GETU32(run->first_lap_index);
-  GETU32(run->last_lap_index);
-  GETU8(run->sport_type);
-  GETU8(run->program_type);
-  SKIP(2);
-  GETU32(run->virtual_partner.time);
-  GETF32(run->virtual_partner.distance);
-  garmin_unpack_d1002(&run->workout,pos);
+  return map;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.43  D1001                                                             */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d1001 ( D1001 * lap, uint8 ** pos )
+garmin_map *
+garmin_map_file ( const char * filename, int flags )
 {
-  GETU32(lap->index);
-  GETU32(lap->start_time);
-  GETU32(lap->total_time);
-  GETF32(lap->total_dist);
-  GETF32(lap->max_speed);
-  GETPOS(lap->begin);
-  GETPOS(lap->end);
-  GETU16(lap->calories);
-  GETU8(lap->avg_heart_rate);
-  GETU8(lap->max_heart_rate);
-  GETU8(lap->intensity);
+  return garmin_map_into(filename,flags,NULL);
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.44  D1002                                                             */
-/* --------------------------------------------------------------------------*/
+/* Free the data unpacked by garmin_map_file(), and unmap the file. */
 
-static void
-garmin_unpack_d1002 ( D1002 * wkt, uint8 ** pos )
+void
+garmin_unmap ( garmin_map * map )
 {
-  int i;
-
-  GETU32(wkt->num_valid_steps);
-  for ( i = 0; i < 20; i++ ) {
-    GETSTR(wkt->steps[i].custom_name);
-    GETF32(wkt->steps[i].target_custom_zone_low);
-    GETF32(wkt->steps[i].target_custom_zone_high);
-    GETU16(wkt->steps[i].duration_value);
-    GETU8(wkt->steps[i].intensity);
-    GETU8(wkt->steps[i].duration_type);
-    GETU8(wkt->steps[i].target_type);
-    GETU8(wkt->steps[i].target_value);
-    SKIP(2);
+  if ( map != NULL ) {
+    if ( map->flags & GARMIN_MAP_STRINGS ) {
+      garmin_free_data_borrowed(map->data);
+    } else {
+      garmin_free_data(map->data);
+    }
+    if ( map->addr != NULL ) munmap(map->addr,map->length);
+    free(map);
   }
-  GETSTR(wkt->name);
-  GETU8(wkt->sport_type);
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.45  D1003                                                             */
-/* --------------------------------------------------------------------------*/
+/*
+   Return the data held by a list node, unpacking it first if the list was
+   loaded with GARMIN_MAP_LAZY and this element has not been needed yet.
+   Lists in lazily unpacked data must be read through this function (or
+   garmin_list_data()): n->data is NULL until the element is unpacked,
+   and stays NULL for an element of an unknown type.
+*/
 
-static void
-garmin_unpack_d1003 ( D1003 * occ, uint8 ** pos )
+garmin_data *
+garmin_list_node_data ( garmin_list * l, garmin_list_node * n )
 {
-  GETSTR(occ->workout_name);
-  GETU32(occ->day);
-}
+  garmin_unpacker  u;
 
+  if ( n->packed != NULL ) {
+    u.pos       = n->packed;
+    u.end       = n->packed + n->packed_size;
+    u.flags     = l->flags;
+    u.arena     = l->arena;
+    u.truncated = 0;
+    n->data     = garmin_unpack_data(&u,n->packed_type);
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.46  D1004                                                             */
-/* --------------------------------------------------------------------------*/
+    /* Keep the bytes of a type we don't know, so they can be saved again. */
 
-static void
-garmin_unpack_d1004 ( D1004 * prof, uint8 ** pos )
-{
-  int i;
-  int j;
-
-  for ( i = 0; i < 3; i++ ) {
-    for ( j = 0; j < 5; j++ ) {
-      GETU8(prof->activities[i].heart_rate_zones[j].low_heart_rate);
-      GETU8(prof->activities[i].heart_rate_zones[j].high_heart_rate);
-      SKIP(2);
-    }
-    for ( j = 0; j < 10; j++ ) {
-      GETF32(prof->activities[i].speed_zones[j].low_speed);
-      GETF32(prof->activities[i].speed_zones[j].high_speed);
-      GETSTR(prof->activities[i].speed_zones[j].name);
-    }
-    GETF32(prof->activities[i].gear_weight);
-    GETU8(prof->activities[i].max_heart_rate);
-    SKIP(3);
+    if ( n->data != NULL ) n->packed = NULL;
   }
-  GETF32(prof->weight);
-  GETU16(prof->birth_year);
-  GETU8(prof->birth_month);
-  GETU8(prof->birth_day);
-  GETU8(prof->gender);
-}
-
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.47  D1005                                                             */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d1005 ( D1005 * limits, uint8 ** pos )
-{
-  GETU32(limits->max_workouts);
-  GETU32(limits->max_unscheduled_workouts);
-  GETU32(limits->max_occurrences);
+  return n->data;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.48  D1006                                                             */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d1006 ( D1006 * course, uint8 ** pos )
-{
-  GETU16(course->index);
-  SKIP(2);
-  GETSTR(course->course_name);
-  GETU16(course->track_index);
-}
-
+/* ========================================================================= */
+/* garmin_chunk_reader                                                       */
+/* ========================================================================= */
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.49  D1007                                                             */
-/* --------------------------------------------------------------------------*/
+/*
+   Open a .gmn file for reading one chunk at a time.  Nothing is unpacked
+   until garmin_chunk_data() is called, so chunks of unwanted types can be
+   skipped using only their headers.  flags are as for garmin_map_file().
+*/
 
-static void
-garmin_unpack_d1007 ( D1007 * lap, uint8 ** pos )
+garmin_chunk_reader *
+garmin_chunk_open ( const char * filename, int flags )
 {
-  GETU16(lap->course_index);
-  GETU16(lap->lap_index);
-  GETU32(lap->total_time);
-  GETF32(lap->total_dist);
-  GETPOS(lap->begin);
-  GETPOS(lap->end);
-  GETU8(lap->avg_heart_rate);
-  GETU8(lap->max_heart_rate);
-  GETU8(lap->intensity);
-  GETU8(lap->avg_cadence);
-}
-
+  garmin_chunk_reader * r = NULL;
+  void *                addr;
+  size_t                length;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.50  D1008                                                             */
-/* --------------------------------------------------------------------------*/
+  if ( garmin_map_bytes(filename,&addr,&length) ) {
+    if ( (r = calloc(1,sizeof(garmin_chunk_reader))) != NULL ) {
+      r->addr     = addr;
+      r->length   = length;
+      r->flags    = flags;
+      r->filename = strdup(filename);
+    } else {
+      /* calloc failed */
+      printf("%s: calloc: %s\n",filename,strerror(errno));
+      if ( addr != NULL ) munmap(addr,length);
+    }
+  }
 
-static void
-garmin_unpack_d1008 ( D1008 * wkt, uint8 ** pos )
-{
-  garmin_unpack_d1002((D1002 *)wkt,pos);
+  return r;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.51  D1009                                                             */
-/* --------------------------------------------------------------------------*/
+/*
+   Move to the next chunk and read its header into r->type and r->chunk.
+   Returns 1 if there is a chunk, 0 at the end of the file or if the file
+   is damaged.
+*/
 
-static void
-garmin_unpack_d1009 ( D1009 * run, uint8 ** pos )
+int
+garmin_chunk_next ( garmin_chunk_reader * r )
 {
-  GETU16(run->track_index);
-  GETU16(run->first_lap_index);
-  GETU16(run->last_lap_index);
-  GETU8(run->sport_type);
-  GETU8(run->program_type);
-  GETU8(run->multisport);
-  SKIP(3);
-  GETU32(run->quick_workout.time);
-  GETF32(run->quick_workout.distance);
-  garmin_unpack_d1008(&run->workout,pos);  
-}
+  garmin_unpacker  u;
+  uint8 *          base = r->addr;
+  uint32           size;
+  uint32           type;
+  uint32           chunk;
 
+  r->offset = r->next;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.52  D1010                                                             */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d1010 ( D1010 * run, uint8 ** pos )
-{
-  GETU32(run->track_index);
-  GETU32(run->first_lap_index);
-  GETU32(run->last_lap_index);
-  GETU8(run->sport_type);
-  GETU8(run->program_type);
-  GETU8(run->multisport);
-  SKIP(1);
-  GETU32(run->virtual_partner.time);
-  GETF32(run->virtual_partner.distance);
-  garmin_unpack_d1002(&run->workout,pos);
-}
+  if ( r->offset >= r->length ) return 0;
 
+  if ( r->length - r->offset < GARMIN_HEADER + 8 ) {
+    /* not enough left for a chunk header */
+    printf("%s: truncated chunk at offset %lu\n",
+	   r->filename,(unsigned long)r->offset);
+    return 0;
+  }
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.53  D1011                                                             */
-/* --------------------------------------------------------------------------*/
+  u.pos       = base + r->offset;
+  u.end       = base + r->length;
+  u.flags     = r->flags;
+  u.arena     = NULL;
+  u.truncated = 0;
 
-static void
-garmin_unpack_d1011 ( D1011 * lap, uint8 ** pos )
-{
-  GETU16(lap->index);
-  SKIP(2);
-  GETU32(lap->start_time);
-  GETU32(lap->total_time);
-  GETF32(lap->total_dist);
-  GETF32(lap->max_speed);
-  GETPOS(lap->begin);
-  GETPOS(lap->end);
-  GETU16(lap->calories);
-  GETU8(lap->avg_heart_rate);
-  GETU8(lap->max_heart_rate);
-  GETU8(lap->intensity);
-  GETU8(lap->avg_cadence);
-  GETU8(lap->trigger_method);
-}
+  if ( !garmin_unpack_header(&u,&size,&type,&chunk) ) return 0;
 
+  if ( size < 8 || size - 8 < chunk ||
+       size > r->length - r->offset - GARMIN_HEADER ) {
+    /* the header doesn't fit the file */
+    printf("%s: bad chunk size %u at offset %lu\n",
+	   r->filename,size,(unsigned long)r->offset);
+    return 0;
+  }
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.54  D1012                                                             */
-/* --------------------------------------------------------------------------*/
+  r->type  = type;
+  r->chunk = chunk;
+  r->next  = r->offset + GARMIN_HEADER + size;
 
-static void
-garmin_unpack_d1012 ( D1012 * point, uint8 ** pos )
-{
-  GETSTR(point->name);
-  SKIP(1);
-  GETU16(point->course_index);
-  SKIP(2);
-  GETU32(point->track_point_time);
-  GETU8(point->point_type);
+  return 1;
 }
 
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.55  D1013                                                             */
-/* --------------------------------------------------------------------------*/
+/*
+   Unpack the current chunk.  The data belongs to the caller.  If the
+   reader was opened with GARMIN_MAP_STRINGS, its strings point into the
+   file, so it must be freed with garmin_free_data_borrowed() before the
+   reader is closed.
+*/
 
-static void
-garmin_unpack_d1013 ( D1013 * limits, uint8 ** pos )
+garmin_data *
+garmin_chunk_data ( garmin_chunk_reader * r )
 {
-  GETU32(limits->max_courses);
-  GETU32(limits->max_course_laps);
-  GETU32(limits->max_course_pnt);
-  GETU32(limits->max_course_trk_pnt);
-}
+  garmin_unpacker  u;
 
+  if ( r->next == r->offset ) return NULL;
 
-/* --------------------------------------------------------------------------*/
-/* 7.4.XX  D1015 (Undocumented)                                              */
-/* --------------------------------------------------------------------------*/
-
-static void
-garmin_unpack_d1015 ( D1015 * lap, uint8 ** pos )
-{
-  GETU16(lap->index);
-  SKIP(2);
-  GETU32(lap->start_time);
-  GETU32(lap->total_time);
-  GETF32(lap->total_dist);
-  GETF32(lap->max_speed);
-  GETPOS(lap->begin);
-  GETPOS(lap->end);
-  GETU16(lap->calories);
-  GETU8(lap->avg_heart_rate);
-  GETU8(lap->max_heart_rate);
-  GETU8(lap->intensity);
-  GETU8(lap->avg_cadence);
-  GETU8(lap->trigger_method);
+  u.pos       = (uint8 *)r->addr + r->offset + GARMIN_HEADER + 8;
+  u.end       = u.pos + r->chunk;
+  u.flags     = r->flags;
+  u.arena     = NULL;
+  u.truncated = 0;
 
-  /* 
-     Garmin has not gotten back to me about what these fields mean, and
-     whether all of the bytes are needed or just, say, three of them.
-     This is annoying, because it means we may end up with .gmn files
-     that have oversized D1015 elements, but it shouldn't affect our
-     ability to read those files.  We don't make any assumptions about
-     the size of each element.
-  */
-
-  GETU8(lap->unknown[0]);
-  GETU8(lap->unknown[1]);
-  GETU8(lap->unknown[2]);
-  GETU8(lap->unknown[3]);
-  GETU8(lap->unknown[4]);
+  return garmin_unpack_chunk_data(&u,r->type,r->chunk);
 }
 
 
-/* List */
-
-static void
-garmin_unpack_dlist ( garmin_list * list, uint8 ** pos )
+void
+garmin_chunk_close ( garmin_chunk_reader * r )
 {
-  uint32             id;
-  uint32             elements;
-  uint32             type;
-  uint32             size;
-  uint32             i;
-
-  GETU32(list->id);
-  GETU32(elements);
-
-  for ( i = 0; i < elements; i++ ) {
-    GETU32(id);
-    GETU32(type);
-    GETU32(size);
-    if ( id == list->id ) {
-      garmin_list_append(list,garmin_unpack(pos,type));
-    } else {
-      /* list element has wrong list ID */
-      printf("garmin_unpack_dlist: list element had ID %d, expected ID %d\n",
-	     id,list->id);
-    }
+  if ( r != NULL ) {
+    if ( r->addr != NULL ) munmap(r->addr,r->length);
+    if ( r->filename != NULL ) free(r->filename);
+    free(r);
   }
 }
 
 
-/* Unpack a chunk of data. */
+/* ========================================================================= */
+/* garmin_load                                                               */
+/* ========================================================================= */
 
-static garmin_data *
-garmin_unpack_chunk ( uint8 ** pos )
+garmin_data *
+garmin_load ( const char * filename )
 {
   garmin_data * data = NULL;
-  uint8 *       start;
-  uint32        unpacked;
-  uint32        version;
-  uint32        size;
-  uint32        type;
-  uint32        chunk;
-
-  /* First, read the header and check that it's satisfactory. */
-  
-  if ( memcmp(*pos,GARMIN_MAGIC,strlen(GARMIN_MAGIC)) == 0 ) {
-    SKIP(12);
-    GETU32(version);
-    
-    if ( version > GARMIN_VERSION ) {
-      /* warning: version is more recent than supported. */
-      printf("garmin_unpack_chunk: version %.2f supported, %.2f found\n",
-	     GARMIN_VERSION/100.0, version/100.0);
-    }
-    
-    /* This is the size of the packed data (not including the header) */
-    
-    GETU32(size);
-
-    /* Now let's get the type of the data, and the size of the chunk. */
-
-    GETU32(type);
-    GETU32(chunk);
-
-    /* Unpack from here. */
+  garmin_map *  map;
 
-    start    = *pos;
-    data     = garmin_unpack(pos,type);
-    unpacked = *pos - start;
-
-    /* Double check - did we unpack the number of bytes we were supposed to? */
-
-    if ( unpacked != chunk ) {      
-      /* unpacked the wrong number of bytes! */
-      printf("garmin_unpack_chunk: unpacked %d bytes (expecting %d)\n",
-	     unpacked,chunk);
-    }
-    
-  } else {
-    /* unknown file format */
-    printf("garmin_unpack_chunk: not a .gmn file\n");
+  if ( (map = garmin_map_file(filename,0)) != NULL ) {
+    data      = map->data;
+    map->data = NULL;
+    garmin_unmap(map);
   }
 
   return data;
 }
 
-  
-/* ========================================================================= */
-/* garmin_load                                                               */
-/* ========================================================================= */
+
+/* 
+   Load a .gmn file into an arena.  The data must be released with
+   garmin_arena_free(), not garmin_free_data().
+*/
 
 garmin_data *
-garmin_load ( const char * filename )
+garmin_load_arena ( const char * filename, garmin_arena * arena )
 {
-  garmin_data * data   = NULL;
-  garmin_data * data_l = NULL;
-  garmin_list * list;
-  uint32        bytes;
-  uint8 *       buf;
-  uint8 *       pos;
-  uint8 *       start;
-  struct stat   sb;
-  int           fd;
+  garmin_data * data = NULL;
+  garmin_map *  map;
 
-  if ( (fd = open(filename,O_RDONLY)) != -1 ) {
-    if ( fstat(fd,&sb) != -1 ) {
-      if ( (buf = malloc(sb.st_size)) != NULL ) {
-	if ( (bytes = read(fd,buf,sb.st_size)) == sb.st_size ) {
-	  data_l = garmin_alloc_data(data_Dlist);
-	  list   = data_l->data;
-	  pos    = buf;
-	  while ( pos - buf < bytes ) {
-	    start = pos;
-	    garmin_list_append(list,garmin_unpack_chunk(&pos));
-	    if ( pos == start ) {
-	      /* did not unpack anything! */
-	      printf("garmin_load:  %s: nothing unpacked!\n",filename);
-	      break;
-	    }
-	  }
-
-	  /* 
-	     If we unpacked only a single element, return it.  Otherwise,
-	     return the list.
-	  */
-
-	  if ( list->elements == 1 ) {
-	    data = list->head->data;
-	    list->head->data = NULL;
-	    garmin_free_data(data_l);
-	  } else {
-	    data = data_l;
-	  }	     
-
-	} else {
-	  /* read failed */
-	  printf("%s: read: %s\n",filename,strerror(errno));
-	}
-	free(buf);
-      } else {
-	/* malloc failed */
-	printf("%s: malloc: %s\n",filename,strerror(errno));
-      }
-    } else {
-      /* fstat failed */
-      printf("%s: fstat: %s\n",filename,strerror(errno));
-    }
-    close(fd);
-  } else {
-    /* open failed */
-    printf("%s: open: %s\n",filename,strerror(errno));
+  if ( (map = garmin_map_into(filename,0,arena)) != NULL ) {
+    data      = map->data;
+    map->data = NULL;
+    garmin_unmap(map);
   }
 
   return data;
@@ -1229,9 +732,31 @@ garmin_load ( const char * filename )
 garmin_data *
 garmin_unpack_packet ( garmin_packet * p, garmin_datatype type )
 {
-  uint8 * pos = p->packet.data;
+  return garmin_unpack_packet_arena(p,type,NULL);
+}
+
+
+garmin_data *
+garmin_unpack_packet_arena ( garmin_packet *   p,
+			     garmin_datatype   type,
+			     garmin_arena *    arena )
+{
+  garmin_unpacker u;
+  uint32          size = garmin_packet_size(p);
+
+  /* Don't trust the size field beyond the packet buffer itself. */
+
+  if ( size > sizeof(garmin_packet) - PACKET_HEADER_SIZE ) {
+    size = sizeof(garmin_packet) - PACKET_HEADER_SIZE;
+  }
 
-  return garmin_unpack(&pos,type);
+  u.pos       = p->packet.data;
+  u.end       = p->packet.data + size;
+  u.flags     = 0;
+  u.arena     = arena;
+  u.truncated = 0;
+
+  return garmin_unpack_data(&u,type);
 }
 
 
@@ -1241,86 +766,50 @@ garmin_unpack_packet ( garmin_packet * p, garmin_datatype type )
 
 garmin_data *
 garmin_unpack ( uint8 **         pos, 
+		uint8 *          end,
 		garmin_datatype  type )
 {
-  garmin_data * d = garmin_alloc_data(type);
+  garmin_data *    d;
+  garmin_unpacker  u;
+
+  u.pos       = *pos;
+  u.end       = end;
+  u.flags     = 0;
+  u.arena     = NULL;
+  u.truncated = 0;
+  d       = garmin_unpack_data(&u,type);
+  *pos    = u.pos;
+
+  return d;
+}
+
+
+static garmin_data *
+garmin_unpack_data ( garmin_unpacker * u,
+		     garmin_datatype   type )
+{
+  garmin_data * d = garmin_arena_alloc_data(u->arena,type);
 
   /* Early exit if we were asked to allocate an unknown data type. */
 
   if ( d->data == NULL ) {
-    free(d);
+    if ( u->arena == NULL ) free(d);
     return NULL;
   }
 
   /* Now do the actual unpacking. */
 
-#define CASE_DATA(x) \
-  case data_D##x: garmin_unpack_d##x(d->data,pos); break
-
   switch ( type ) {
-  CASE_DATA(list);
-  CASE_DATA(100);
-  CASE_DATA(101);
-  CASE_DATA(102);
-  CASE_DATA(103);
-  CASE_DATA(104);
-  CASE_DATA(105);
-  CASE_DATA(106);
-  CASE_DATA(107);
-  CASE_DATA(108);
-  CASE_DATA(109);
-  CASE_DATA(110);
-  CASE_DATA(120);
-  CASE_DATA(150);
-  CASE_DATA(151);
-  CASE_DATA(152);
-  CASE_DATA(154);
-  CASE_DATA(155);
-  CASE_DATA(200);
-  CASE_DATA(201);
-  CASE_DATA(202);
-  CASE_DATA(210);
-  CASE_DATA(300);
-  CASE_DATA(301);
-  CASE_DATA(302);
-  CASE_DATA(303);
-  CASE_DATA(304);
-  CASE_DATA(310);
-  CASE_DATA(311);
-  CASE_DATA(312);
-  CASE_DATA(400);
-  CASE_DATA(403);
-  CASE_DATA(450);
-  CASE_DATA(500);
-  CASE_DATA(501);
-  CASE_DATA(550);
-  CASE_DATA(551);
-  CASE_DATA(600);
-  CASE_DATA(650);
-  CASE_DATA(700);
-  CASE_DATA(800);
-  CASE_DATA(906);
-  CASE_DATA(1000);
-  CASE_DATA(1001);
-  CASE_DATA(1002);
-  CASE_DATA(1003);
-  CASE_DATA(1004);
-  CASE_DATA(1005);
-  CASE_DATA(1006);
-  CASE_DATA(1007);
-  CASE_DATA(1008);
-  CASE_DATA(1009);
-  CASE_DATA(1010);
-  CASE_DATA(1011);
-  CASE_DATA(1012);
-  CASE_DATA(1013);
-  CASE_DATA(1015);
+  case data_Dlist:
+    garmin_unpack_dlist(d->data,u);
+    break;
+#define RECORD(x) \
+  case data_D##x: garmin_unpack_d##x(d->data,u); break;
+#include "schema.h"
   default: 
     printf("garmin_unpack: data type %d not supported\n",type);
     break;
   }
 
   return d;
-
-#undef CASE_DATA
 }
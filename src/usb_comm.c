@@ -19,140 +19,255 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <usb.h>
 #include "garmin.h"
+#include "byte_util.h"
 
 
 #define INTR_TIMEOUT  3000
 #define BULK_TIMEOUT  3000
+#define ASYNC_TIMEOUT  500   /* reader thread poll interval */
+#define ASYNC_DEPTH     32   /* default completion queue depth */
 
 
-/* Close the USB connection with the Garmin device. */
+/* 
+   The completion queue used when reading ahead.  A reader thread keeps a
+   read outstanding on the IN endpoints and stores each completed packet
+   in a ring of 'depth' entries.  garmin_read() takes them out in order.
+   The reader thread keeps no statistics of its own: each entry carries
+   what its read cost, and garmin_read() counts it when it takes it out.
+*/
 
-int
-garmin_close ( garmin_unit * garmin )
+typedef struct garmin_queue_entry {
+  int                  r;
+  float64              latency;  /* how long the read took          */
+  uint32               retries;  /* reads that timed out before it  */
+  garmin_packet        p;
+} garmin_queue_entry;
+
+
+typedef struct garmin_queue {
+  pthread_t            thread;
+  pthread_mutex_t      lock;
+  pthread_cond_t       ready;    /* an entry has been queued */
+  pthread_cond_t       space;    /* an entry has been taken  */
+  int                  depth;
+  int                  head;
+  int                  count;
+  int                  stop;
+  int                  error;    /* the read failure that stopped the reader */
+  garmin_queue_entry * entries;
+} garmin_queue;
+
+
+static const garmin_transport garmin_usb_transport;
+
+
+static void
+garmin_usb_close ( garmin_unit * garmin )
 {
   if ( garmin->usb.handle != NULL ) {
     usb_release_interface(garmin->usb.handle,0);
     usb_close(garmin->usb.handle);
     garmin->usb.handle = NULL;
   }
+}
+
+
+/* 
+   Close the connection with the Garmin device, and stop capturing.  The
+   next garmin_open picks a transport afresh.
+*/
+
+int
+garmin_close ( garmin_unit * garmin )
+{
+  garmin_stop_async(garmin);
+
+  if ( garmin->usb.open != 0 ) {
+    garmin->usb.transport->close(garmin);
+    garmin->usb.open = 0;
+  }
+  garmin->usb.transport = NULL;
+  garmin->usb.context   = NULL;
+
+  if ( garmin->usb.capture != NULL ) {
+    fclose(garmin->usb.capture);
+    garmin->usb.capture = NULL;
+  }
 
   return 0;
 }
 
 
 /* 
-   Open the USB connection with the first Garmin device we find.  Eventually,
-   I'd like to add the ability to select a particular device.  Returns 1 on
-   success, 0 on failure.  Prints diagnostic information and errors to stdout.
+   Open and claim a particular Garmin device and find its endpoints.
+   Returns 0 on success, 1 on failure.  On failure the handle may still be
+   open; garmin_open() takes care of closing it.
 */
 
-int
-garmin_open ( garmin_unit * garmin )
+static int
+garmin_open_device ( garmin_unit * garmin, struct usb_device * di )
 {
-  struct usb_bus *     bi;
-  struct usb_device *  di;
   int                  err = 0;
   int                  i;
 
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] found VID %04x, PID %04x on %s/%s\n",
+	   di->descriptor.idVendor,
+	   di->descriptor.idProduct,
+	   di->bus->dirname,
+	   di->filename);
+  }
+
+  garmin->usb.handle = usb_open(di);
+  garmin->usb.read_bulk = 0;
+
   if ( garmin->usb.handle == NULL ) {
-    usb_init();
-    usb_find_busses();
-    usb_find_devices();
-    
-    for ( bi = usb_busses; bi != NULL; bi = bi->next ) {
-      for ( di = bi->devices; di != NULL; di = di->next ) {
-	if ( di->descriptor.idVendor  == GARMIN_USB_VID &&
-	     di->descriptor.idProduct == GARMIN_USB_PID ) {
+    printf("usb_open failed: %s\n",usb_strerror());
+    err = 1;
+  } else if ( !err && garmin->verbose != 0 ) {
+    printf("[garmin] usb_open = %p\n",garmin->usb.handle);
+  }
+
+  if ( !err && usb_set_configuration(garmin->usb.handle,1) < 0 ) {
+    printf("usb_set_configuration failed: %s\n",usb_strerror());
+    err = 1;
+  } else if ( !err && garmin->verbose != 0 ) {
+    printf("[garmin] usb_set_configuration[1] succeeded\n");
+  }
 
+  if ( !err && usb_claim_interface(garmin->usb.handle,0) < 0 ) {
+    printf("usb_claim_interface failed: %s\n",usb_strerror());
+    err = 1;
+  } else if ( !err && garmin->verbose != 0 ) {
+    printf("[garmin] usb_claim_interface[0] succeeded\n");
+  }
+
+  if ( !err ) {
+
+    /* 
+       We've succeeded in opening and claiming the interface 
+       Let's set the bulk and interrupt in and out endpoints. 
+    */
+
+    for ( i = 0; 
+	  i < di->config->interface->altsetting->bNumEndpoints; 
+	  i++ ) {
+      struct usb_endpoint_descriptor * ep;
+	      
+      ep = &di->config->interface->altsetting->endpoint[i];
+      switch ( ep->bmAttributes & USB_ENDPOINT_TYPE_MASK ) {
+      case USB_ENDPOINT_TYPE_BULK:
+	if ( ep->bEndpointAddress & USB_ENDPOINT_DIR_MASK ) {
+	  garmin->usb.bulk_in = 
+	    ep->bEndpointAddress & USB_ENDPOINT_ADDRESS_MASK;
+	  if ( garmin->verbose != 0 ) {
+	    printf("[garmin] bulk IN  = %d\n",garmin->usb.bulk_in);
+	  }
+	} else {
+	  garmin->usb.bulk_out = 
+	    ep->bEndpointAddress & USB_ENDPOINT_ADDRESS_MASK;
 	  if ( garmin->verbose != 0 ) {
-	    printf("[garmin] found VID %04x, PID %04x on %s/%s\n",
-		   di->descriptor.idVendor,
-		   di->descriptor.idProduct,
-		   bi->dirname,
-		   di->filename);
+	    printf("[garmin] bulk OUT = %d\n",garmin->usb.bulk_out);
 	  }
+	}
+	break;
+      case USB_ENDPOINT_TYPE_INTERRUPT:
+	if ( ep->bEndpointAddress & USB_ENDPOINT_DIR_MASK ) {
+	  garmin->usb.intr_in = 
+	    ep->bEndpointAddress & USB_ENDPOINT_ADDRESS_MASK;
+	  if ( garmin->verbose != 0 ) {
+	    printf("[garmin] intr IN  = %d\n",garmin->usb.intr_in);
+	  }
+	}
+	break;
+      default:
+	break;
+      }
+    }
+  }
 
-	  garmin->usb.handle = usb_open(di);
-	  garmin->usb.read_bulk = 0;
+  return err;
+}
 
-	  err = 0;
 
-	  if ( garmin->usb.handle == NULL ) {
-	    printf("usb_open failed: %s\n",usb_strerror());
-	    err = 1;
-	  } else if ( !err && garmin->verbose != 0 ) {
-	    printf("[garmin] usb_open = %p\n",garmin->usb.handle);
-	  }
+/* 
+   Find every attached Garmin device.  Up to 'max' of them are stored in
+   'devices'; the return value is the number found.  The devices belong to
+   libusb and stay valid until the next bus scan, so don't call garmin_open
+   on a unit without a device (which rescans) while others are in use.
+*/
 
-	  if ( !err && usb_set_configuration(garmin->usb.handle,1) < 0 ) {
-	    printf("usb_set_configuration failed: %s\n",usb_strerror());
-	    err = 1;
-	  } else if ( !err && garmin->verbose != 0 ) {
-	    printf("[garmin] usb_set_configuration[1] succeeded\n");
-	  }
+int
+garmin_enumerate ( struct usb_device ** devices, int max )
+{
+  struct usb_bus *     bi;
+  struct usb_device *  di;
+  int                  n = 0;
 
-	  if ( !err && usb_claim_interface(garmin->usb.handle,0) < 0 ) {
-	    printf("usb_claim_interface failed: %s\n",usb_strerror());
-	    err = 1;
-	  } else if ( !err && garmin->verbose != 0 ) {
-	    printf("[garmin] usb_claim_interface[0] succeeded\n");
-	  }
+  usb_init();
+  usb_find_busses();
+  usb_find_devices();
 
-	  if ( !err ) {
+  for ( bi = usb_busses; bi != NULL; bi = bi->next ) {
+    for ( di = bi->devices; di != NULL && n < max; di = di->next ) {
+      if ( di->descriptor.idVendor  == GARMIN_USB_VID &&
+	   di->descriptor.idProduct == GARMIN_USB_PID ) {
+	devices[n++] = di;
+      }
+    }
+  }
 
-	    /* 
-	       We've succeeded in opening and claiming the interface 
-	       Let's set the bulk and interrupt in and out endpoints. 
-	    */
+  return n;
+}
 
-	    for ( i = 0; 
-		  i < di->config->interface->altsetting->bNumEndpoints; 
-		  i++ ) {
-	      struct usb_endpoint_descriptor * ep;
-	      
-	      ep = &di->config->interface->altsetting->endpoint[i];
-	      switch ( ep->bmAttributes & USB_ENDPOINT_TYPE_MASK ) {
-	      case USB_ENDPOINT_TYPE_BULK:
-		if ( ep->bEndpointAddress & USB_ENDPOINT_DIR_MASK ) {
-		  garmin->usb.bulk_in = 
-		    ep->bEndpointAddress & USB_ENDPOINT_ADDRESS_MASK;
-		  if ( garmin->verbose != 0 ) {
-		    printf("[garmin] bulk IN  = %d\n",garmin->usb.bulk_in);
-		  }
-		} else {
-		  garmin->usb.bulk_out = 
-		    ep->bEndpointAddress & USB_ENDPOINT_ADDRESS_MASK;
-		  if ( garmin->verbose != 0 ) {
-		    printf("[garmin] bulk OUT = %d\n",garmin->usb.bulk_out);
-		  }
-		}
-		break;
-	      case USB_ENDPOINT_TYPE_INTERRUPT:
-		if ( ep->bEndpointAddress & USB_ENDPOINT_DIR_MASK ) {
-		  garmin->usb.intr_in = 
-		    ep->bEndpointAddress & USB_ENDPOINT_ADDRESS_MASK;
-		  if ( garmin->verbose != 0 ) {
-		    printf("[garmin] intr IN  = %d\n",garmin->usb.intr_in);
-		  }
-		}
-		break;
-	      default:
-		break;
-	      }
-	    }
-	  }
 
-	  /* We've found what should be the Garmin interface. */
+/* 
+   Open the USB connection with the Garmin device selected in garmin->usb
+   (see garmin_init_device), or with the first Garmin device we find if
+   none was selected.  Returns 1 on success, 0 on failure.  Prints
+   diagnostic information and errors to stdout.
+*/
 
-	  break;
+static int
+garmin_usb_open ( garmin_unit * garmin )
+{
+  struct usb_bus *     bi;
+  struct usb_device *  di;
+  int                  err = 0;
+
+  if ( garmin->usb.handle == NULL ) {
+    if ( garmin->usb.device != NULL ) {
+
+      /* Don't rescan the bus; other threads may be using its devices. */
+
+      err = garmin_open_device(garmin,garmin->usb.device);
+    } else {
+      usb_init();
+      usb_find_busses();
+      usb_find_devices();
+    
+      for ( bi = usb_busses; bi != NULL; bi = bi->next ) {
+	for ( di = bi->devices; di != NULL; di = di->next ) {
+	  if ( di->descriptor.idVendor  == GARMIN_USB_VID &&
+	       di->descriptor.idProduct == GARMIN_USB_PID ) {
+
+	    /* We've found what should be the Garmin interface. */
+
+	    err = garmin_open_device(garmin,di);
+	    break;
+	  }
 	}
-      }
 
-      if ( garmin->usb.handle != NULL ) break;
+	if ( garmin->usb.handle != NULL ) break;
+      }
     }
   }
 
@@ -174,6 +289,69 @@ garmin_open ( garmin_unit * garmin )
 }
 
 
+/* 
+   Start writing every packet sent or received to a file, in the format
+   of garmin_print_packet.  garmin_replay can play the file back later.
+   Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_capture ( garmin_unit * garmin, const char * filename )
+{
+  FILE * fp;
+
+  if ( (fp = fopen(filename,"w")) == NULL ) {
+    printf("garmin_capture: %s: %s\n",filename,strerror(errno));
+    return 0;
+  }
+
+  if ( garmin->usb.capture != NULL ) fclose(garmin->usb.capture);
+  garmin->usb.capture = fp;
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] capturing packets to %s\n",filename);
+  }
+
+  return 1;
+}
+
+
+/* 
+   Open the connection with the Garmin device, if it isn't open already.
+   The transport is USB unless GARMIN_REPLAY names a captured session to
+   play back instead (GARMIN_REPLAY_LATENCY adds a delay in microseconds
+   to each packet read).  If GARMIN_CAPTURE is set, the session is
+   captured to the file it names.  Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_open ( garmin_unit * garmin )
+{
+  const char * file;
+  const char * latency;
+
+  if ( garmin->usb.open != 0 ) return 1;
+
+  if ( garmin->usb.transport == NULL ) {
+    if ( (file = getenv("GARMIN_REPLAY")) != NULL ) {
+      latency = getenv("GARMIN_REPLAY_LATENCY");
+      return garmin_replay(garmin,file,(latency != NULL) ? atoi(latency) : 0);
+    }
+    garmin->usb.transport = &garmin_usb_transport;
+  }
+
+  garmin->usb.open  = garmin->usb.transport->open(garmin);
+  garmin->usb.error = 0;
+
+  if ( garmin->usb.open != 0 && garmin->usb.capture == NULL &&
+       (file = getenv("GARMIN_CAPTURE")) != NULL ) {
+    garmin_capture(garmin,file);
+  }
+
+  return garmin->usb.open;
+}
+
+
 uint8
 garmin_packet_type ( garmin_packet * p )
 {
@@ -233,31 +411,39 @@ garmin_packetize ( garmin_packet *  p,
 }
 
 
-int
-garmin_read ( garmin_unit * garmin, garmin_packet * p )
+/* 
+   Read a single packet from whichever IN endpoint is currently active.
+   The unit normally talks to us over the interrupt endpoint, but when it
+   has a lot to say it sends a Pid_Data_Available there and switches to
+   the (much faster) bulk endpoint until it sends a zero-length packet.
+*/
+
+static int
+garmin_usb_read ( garmin_unit * garmin, garmin_packet * p, int timeout )
 {
   int r = -1;
 
-  garmin_open(garmin);
-
-  if ( garmin->usb.handle != NULL ) {
+  for ( ;; ) {
     if ( garmin->usb.read_bulk == 0 ) {
       r = usb_interrupt_read(garmin->usb.handle,
 			     garmin->usb.intr_in,
 			     p->data,
 			     sizeof(garmin_packet),
-			     INTR_TIMEOUT);
+			     timeout);
       /* 
 	 If the packet is a "Pid_Data_Available" packet, we need to read
 	 from the bulk endpoint until we get an empty packet.
       */
       
-      if ( garmin_packet_type(p) == GARMIN_PROTOCOL_USB &&
+      if ( r >= PACKET_HEADER_SIZE &&
+	   garmin_packet_type(p) == GARMIN_PROTOCOL_USB &&
 	   garmin_packet_id(p) == Pid_Data_Available ) {
-	
-	/* FIXME!!! */
-	
-	printf("Received a Pid_Data_Available from the unit!\n");
+	if ( garmin->verbose != 0 ) {
+	  garmin_print_packet(p,GARMIN_DIR_READ,stdout);
+	  printf("[garmin] switching to bulk IN\n");
+	}
+	garmin->usb.read_bulk = 1;
+	continue;
       }
       
     } else {
@@ -265,13 +451,284 @@ garmin_read ( garmin_unit * garmin, garmin_packet * p )
 			garmin->usb.bulk_in,
 			p->data,
 			sizeof(garmin_packet),
-			BULK_TIMEOUT);
+			timeout);
+
+      /* An empty packet hands control back to the interrupt endpoint. */
+
+      if ( r == 0 ) {
+	if ( garmin->verbose != 0 ) {
+	  printf("[garmin] switching to interrupt IN\n");
+	}
+	garmin->usb.read_bulk = 0;
+	continue;
+      }
+    }
+    break;
+  }
+
+  return r;
+}
+
+
+static int
+garmin_usb_write ( garmin_unit * garmin, garmin_packet * p, int size )
+{
+  int r;
+
+  r = usb_bulk_write(garmin->usb.handle,
+		     garmin->usb.bulk_out,
+		     p->data,
+		     size,
+		     BULK_TIMEOUT);
+  if ( r != size ) {
+    printf("usb_bulk_write failed: %s\n",usb_strerror());
+    if ( r >= 0 ) r = -EIO;
+  }
+
+  return r;
+}
+
+
+static const garmin_transport garmin_usb_transport = {
+  "usb",
+  garmin_usb_open,
+  garmin_usb_read,
+  garmin_usb_write,
+  garmin_usb_close
+};
+
+
+/* Read from the transport, and note how long it took in 'latency'. */
+
+static int
+garmin_transport_read ( garmin_unit *   garmin,
+			garmin_packet * p,
+			int             timeout,
+			float64 *       latency )
+{
+  float64 start = garmin_stats_clock();
+  int     r;
+
+  r = garmin->usb.transport->read(garmin,p,timeout);
+  *latency = garmin_stats_clock() - start;
+
+  return r;
+}
+
+
+/* 
+   The reader thread.  It stops when asked to, or when a read fails for a
+   reason other than a timeout.  The failure is kept in the queue, and
+   garmin_read reports it for every read once the packets read before it
+   have been taken.  A read that times out is simply issued again, and counted
+   as a retry of the next packet queued.
+*/
+
+static void *
+garmin_async_reader ( void * arg )
+{
+  garmin_unit *        garmin = arg;
+  garmin_queue *       q      = garmin->usb.queue;
+  garmin_queue_entry * e;
+  garmin_packet        p;
+  float64              latency;
+  uint32               retries = 0;
+  int                  r       = 0;
+
+  pthread_mutex_lock(&q->lock);
+  while ( !q->stop && r >= 0 ) {
+    if ( q->count == q->depth ) {
+      pthread_cond_wait(&q->space,&q->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&q->lock);
+    r = garmin_transport_read(garmin,&p,ASYNC_TIMEOUT,&latency);
+    pthread_mutex_lock(&q->lock);
+    if ( r == -ETIMEDOUT ) {
+      r = 0;
+      retries++;
+    } else if ( r < 0 ) {
+      q->error = r;
+      pthread_cond_signal(&q->ready);
+    } else {
+      e = &q->entries[(q->head + q->count) % q->depth];
+      e->r       = r;
+      e->latency = latency;
+      e->retries = retries;
+      retries    = 0;
+      memcpy(e->p.data,p.data,r);
+      q->count++;
+      pthread_cond_signal(&q->ready);
     }
   }
+  pthread_mutex_unlock(&q->lock);
+
+  return NULL;
+}
+
+
+/* 
+   Take the next completed read off the queue, waiting up to 'timeout' ms.
+   The cost of the read is returned in 'latency' and 'retries'.  Once the
+   reader has stopped on an error and the queue is empty, that error is
+   returned straight away.
+*/
+
+static int
+garmin_dequeue ( garmin_queue *  q,
+		 garmin_packet * p,
+		 int             timeout,
+		 float64 *       latency,
+		 uint32 *        retries )
+{
+  struct timeval   now;
+  struct timespec  until;
+  int              r = -ETIMEDOUT;
+
+  gettimeofday(&now,NULL);
+  until.tv_sec  = now.tv_sec + timeout / 1000;
+  until.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
+  if ( until.tv_nsec >= 1000000000 ) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&q->lock);
+  while ( q->count == 0 && q->error == 0 ) {
+    if ( pthread_cond_timedwait(&q->ready,&q->lock,&until) == ETIMEDOUT ) {
+      break;
+    }
+  }
+  if ( q->count > 0 ) {
+    r        = q->entries[q->head].r;
+    *latency = q->entries[q->head].latency;
+    *retries = q->entries[q->head].retries;
+    if ( r > 0 ) memcpy(p->data,q->entries[q->head].p.data,r);
+    q->head = (q->head + 1) % q->depth;
+    q->count--;
+    pthread_cond_signal(&q->space);
+  } else if ( q->error != 0 ) {
+    r = q->error;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return r;
+}
+
+
+/*
+   Start reading ahead.  A reader thread keeps the IN endpoints busy and
+   queues up to 'depth' packets (a default is used if depth <= 0), so the
+   unit can keep sending while we are busy with the previous packet.
+   Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_start_async ( garmin_unit * garmin, int depth )
+{
+  garmin_queue * q;
+
+  if ( garmin->usb.queue != NULL ) return 1;
+
+  if ( garmin_open(garmin) == 0 ) return 0;
+
+  if ( depth <= 0 ) depth = ASYNC_DEPTH;
+
+  if ( (q = calloc(1,sizeof(garmin_queue))) == NULL ) return 0;
+  if ( (q->entries = calloc(depth,sizeof(garmin_queue_entry))) == NULL ) {
+    free(q);
+    return 0;
+  }
+  q->depth = depth;
+  pthread_mutex_init(&q->lock,NULL);
+  pthread_cond_init(&q->ready,NULL);
+  pthread_cond_init(&q->space,NULL);
+
+  garmin->usb.queue = q;
+  if ( pthread_create(&q->thread,NULL,garmin_async_reader,garmin) != 0 ) {
+    printf("garmin_start_async: pthread_create: %s\n",strerror(errno));
+    garmin->usb.queue = NULL;
+    pthread_cond_destroy(&q->space);
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->lock);
+    free(q->entries);
+    free(q);
+    return 0;
+  }
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] reading ahead, queue depth %d\n",depth);
+  }
+
+  return 1;
+}
+
+
+/* Stop reading ahead.  Any packets still in the queue are discarded. */
+
+void
+garmin_stop_async ( garmin_unit * garmin )
+{
+  garmin_queue * q = garmin->usb.queue;
+
+  if ( q != NULL ) {
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_signal(&q->space);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread,NULL);
+
+    if ( garmin->verbose != 0 && q->count > 0 ) {
+      printf("[garmin] discarding %d queued packets\n",q->count);
+    }
+
+    garmin->usb.queue = NULL;
+    pthread_cond_destroy(&q->space);
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->lock);
+    free(q->entries);
+    free(q);
+  }
+}
+
+
+int
+garmin_read ( garmin_unit * garmin, garmin_packet * p )
+{
+  garmin_phase_stats * s     = &garmin->stats.phase[garmin->stats.current];
+  float64              start   = garmin_stats_clock();
+  float64              latency = 0;
+  uint32               retries = 0;
+  int                  r       = -ENODEV;
+
+  if ( garmin->usb.queue != NULL ) {
+    r = garmin_dequeue(garmin->usb.queue,p,INTR_TIMEOUT,&latency,&retries);
+  } else if ( garmin_open(garmin) != 0 ) {
+    r = garmin_transport_read(garmin,p,
+			      (garmin->usb.read_bulk) ? 
+			      BULK_TIMEOUT : INTR_TIMEOUT,
+			      &latency);
+  }
+
+  s->read_wait += garmin_stats_clock() - start;
+  s->retries   += retries;
+  if ( r >= 0 ) {
+    garmin_stats_latency(s->read_latency,latency);
+    s->packets_read++;
+    s->bytes_read += r;
+  } else if ( r == -ETIMEDOUT ) {
+    s->timeouts++;
+  } else {
+    s->errors++;
+    if ( garmin->usb.error == 0 ) garmin->usb.error = r;
+  }
 
   if ( garmin->verbose != 0 && r >= 0 ) {
     garmin_print_packet(p,GARMIN_DIR_READ,stdout);
   }
+  if ( garmin->usb.capture != NULL && r >= PACKET_HEADER_SIZE ) {
+    garmin_print_packet(p,GARMIN_DIR_READ,garmin->usb.capture);
+  }
 
   return r;
 }
@@ -280,25 +737,33 @@ garmin_read ( garmin_unit * garmin, garmin_packet * p )
 int
 garmin_write ( garmin_unit * garmin, garmin_packet * p )
 {
-  int r = -1;
-  int s = garmin_packet_size(p) + PACKET_HEADER_SIZE;
+  garmin_phase_stats * st = &garmin->stats.phase[garmin->stats.current];
+  float64              elapsed;
+  int                  r  = -ENODEV;
+  int                  s  = garmin_packet_size(p) + PACKET_HEADER_SIZE;
 
-  garmin_open(garmin);
-
-  if ( garmin->usb.handle != NULL ) {
+  if ( garmin_open(garmin) != 0 ) {
 
     if ( garmin->verbose != 0 ) {
       garmin_print_packet(p,GARMIN_DIR_WRITE,stdout);
     }
+    if ( garmin->usb.capture != NULL ) {
+      garmin_print_packet(p,GARMIN_DIR_WRITE,garmin->usb.capture);
+    }
 
-    r = usb_bulk_write(garmin->usb.handle,
-		       garmin->usb.bulk_out,
-		       p->data,
-		       s,
-		       BULK_TIMEOUT);
-    if ( r != s ) {
-      printf("usb_bulk_write failed: %s\n",usb_strerror());
-      exit(1);
+    elapsed = garmin_stats_clock();
+    r       = garmin->usb.transport->write(garmin,p,s);
+    elapsed = garmin_stats_clock() - elapsed;
+
+    st->write_wait += elapsed;
+    garmin_stats_latency(st->write_latency,elapsed);
+    if ( r == s ) {
+      st->packets_written++;
+      st->bytes_written += r;
+    } else {
+      st->errors++;
+      if ( r >= 0 ) r = -EIO;
+      if ( garmin->usb.error == 0 ) garmin->usb.error = r;
     }
   }
   
@@ -314,11 +779,10 @@ garmin_start_session ( garmin_unit * garmin )
   garmin_packetize(&p,Pid_Start_Session,0,NULL);
   p.packet.type = GARMIN_PROTOCOL_USB;
 
-  garmin_write(garmin,&p);
-  garmin_write(garmin,&p);
-  garmin_write(garmin,&p);
-
-  if ( garmin_read(garmin,&p) == 16 ) {
+  if ( garmin_write(garmin,&p) > 0 &&
+       garmin_write(garmin,&p) > 0 &&
+       garmin_write(garmin,&p) > 0 &&
+       garmin_read(garmin,&p) == 16 ) {
     garmin->id = get_uint32(p.packet.data);
   } else {
     garmin->id = 0;